@@ -4,12 +4,16 @@
 
 #include "algorithm/ColorMapping.hpp"
 #include "algorithm/GeometryHelper.hpp"
+#include "algorithm/ProgressiveHelper.hpp"
 #include "algorithm/RenderHelper.hpp"
 #include "algorithm/SliceHelper.hpp"
+#include "algorithm/VolumeHelper.hpp"
 #include "common/Logger.hpp"
 #include "common/Parrallel.hpp"
 #include "core/BlockVolumeManager.hpp"
+#include "core/FramePipelineExecutor.hpp"
 #include "core/GPUResource.hpp"
+#include "core/RenderPipeline.hpp"
 #include "core/VolumeBlockTree.hpp"
 #include "plugin/PluginLoader.hpp"
 #include "utils/Timer.hpp"
@@ -58,16 +62,22 @@ bool InitWindowContext(int w, int h)
     }
     return true;
 }
-void SDLDraw(const Image &pixels)
+//渲染结果只包含slice的region 更新纹理的左上角并放大到整个窗口
+void SDLDraw(const FramebufferView &pixels)
 {
     static SDL_Rect rect{0, 0, wc->width, wc->height};
-    SDL_UpdateTexture(wc->frame, nullptr, pixels.data(), pixels.pitch());
+    SDL_Rect src{0, 0, (std::min)(pixels.width, wc->width), (std::min)(pixels.height, wc->height)};
+    SDL_UpdateTexture(wc->frame, &src, pixels.data(), pixels.pitch());
     SDL_RenderClear(wc->renderer);
-    SDL_RenderCopy(wc->renderer, wc->frame, nullptr, &rect);
-    SDL_RenderCopyEx(wc->renderer, wc->frame, nullptr, &rect, 0.0, nullptr, SDL_FLIP_VERTICAL);
+    SDL_RenderCopy(wc->renderer, wc->frame, &src, &rect);
+    SDL_RenderCopyEx(wc->renderer, wc->frame, &src, &rect, 0.0, nullptr, SDL_FLIP_VERTICAL);
     SDL_RenderPresent(wc->renderer);
 }
-void RunRenderLoop(bool async)
+void SDLDraw(const Image &pixels)
+{
+    SDLDraw(FramebufferView(pixels));
+}
+void RunRenderLoop(bool async, bool pipelined = false)
 {
     PluginLoader::LoadPlugins("C:/Users/wyz/projects/MouseBrainVisualizeProject/bin");
     auto p = std::unique_ptr<IVolumeBlockProviderInterface>(
@@ -91,6 +101,8 @@ void RunRenderLoop(bool async)
     block_volume_manager.setProvider(std::move(p));
 
     block_volume_manager.init();
+    //缩小视图时由已经加载的高分辨率块生成低分辨率块
+    block_volume_manager.setLodDerivation(true);
 
     GPUResource gpu_resource(0);
     GPUResource::ResourceDesc desc{};
@@ -131,230 +143,21 @@ void RunRenderLoop(bool async)
 
     uint32_t render_type = 0;
 
-    std::function<const Image &()> slice_render;
-
-    if (async)
-    {
-        slice_render = [&]() -> const Image & { //如果不显示指定返回类型 lambda的函数返回类型会是Image 因为function =
-                                                //不要求返回类型一定相同 它会去引用
-            SliceExt sliceExt{slice, SliceHelper::GetSliceLod(slice),
-                              volume.getVoxel() * SliceHelper::SliceStepVoxelRatio, 0.f};
-            FrustumExt view_frustum{};
-            SliceHelper::ExtractViewFrustumExtFromSliceExt(sliceExt, view_frustum, volume.getVoxel());
-
-            auto intersect_blocks = volume_block_tree.computeIntersectBlock(view_frustum, sliceExt.lod);
-            LOG_INFO("slice render intersect block count: {}", intersect_blocks.size());
-            for (auto &b : intersect_blocks)
-            {
-                //              LOG_INFO("intersect block {} {} {} {}",b.x,b.y,b.z,b.w);
-            }
-
-            //获取页表位置 整个过程需要先acquireLock再acquireRelease 该期间对页表的操作是单线程的
-            auto &page_table = gpu_resource.getPageTable();
-            page_table.acquireLock();
-
-            std::vector<Volume::BlockIndex> missed_blocks;
-            std::vector<Renderer::PageTableItem> cur_renderer_page_table;
-            //查询页表中已经有的数据块 生成目前页表不存在的缺失块
-            auto query_ret = page_table.queriesAndLockExt(intersect_blocks);
-            for (const auto &ret : query_ret)
-            {
-                if (ret.cached)
-                {
-                    cur_renderer_page_table.emplace_back(ret.entry, ret.value);
-                }
-                else
-                {
-                    missed_blocks.emplace_back(ret.value);
-                }
-            }
-            LOG_INFO("first time missed blocks count: {}", missed_blocks.size());
-
-            //异步加载数据块 先查询缺失块是否已经加载到内存中
-            std::unordered_map<Volume::BlockIndex, void *> missed_block_buffer;
-            std::vector<Volume::BlockIndex> copy_missed_blocks;
-            copy_missed_blocks.swap(missed_blocks);
-            for (const auto &block : copy_missed_blocks)
-            {
-                auto p = block_volume_manager.getVolumeBlock(block, false);
-                if (p && block_volume_manager.lock(p))
-                {
-                    missed_blocks.emplace_back(block);
-                }
-                else
-                {
-                    p = nullptr;
-                }
-                missed_block_buffer[block] = p;
-            }
-
-            auto missed_block_entries = page_table.getEntriesAndLock(missed_blocks);
-            page_table.acquireRelease();
-            assert(missed_block_entries.size() == missed_blocks.size());
-
-            std::unordered_map<Volume::BlockIndex, PageTable::EntryItem> block_entries;
-            missed_blocks.clear();
-            for (const auto &entry : missed_block_entries)
-            {
-                if (!entry.cached)
-                {
-                    missed_blocks.emplace_back(entry.value);
-                    block_entries[entry.value] = entry.entry;
-                }
-                else
-                {
-                    block_volume_manager.unlock(missed_block_buffer[entry.value]);
-                    missed_block_buffer[entry.value] = nullptr;
-                }
-                cur_renderer_page_table.emplace_back(entry.entry, entry.value);
-            }
-            LOG_INFO("slice render missed block count: {}", missed_blocks.size());
-
-            auto thread_id = std::this_thread::get_id();
-            auto tid = std::hash<decltype(thread_id)>()(thread_id);
-
-            auto task = [&](int thread_idx, Volume::BlockIndex block_index) {
-                auto p = missed_block_buffer[block_index];
-                assert(p);
-                if (!p)
-                    return;
-                auto entry = block_entries[block_index];
-                GPUResource::ResourceDesc desc;
-                desc.id = tid;
-                desc.type = GPUResource::Texture;
-                desc.width = volume.getBlockLength();
-                desc.pitch = volume.getBlockLength();
-                desc.height = volume.getBlockLength();
-                desc.depth = volume.getBlockLength();
-                desc.size = volume.getBlockSize();
-                GPUResource::ResourceExtent extent{volume.getBlockLength(), volume.getBlockLength(),
-                                                   volume.getBlockLength()};
-                auto ret = gpu_resource.uploadResource(desc, entry, extent, p, volume.getBlockSize(), false);
-                assert(ret);
-                ret = block_volume_manager.unlock(p);
-                assert(ret);
-                page_table.update(block_index);
-            };
-
-            parallel_foreach(missed_blocks, task, missed_blocks.size());
-
-            gpu_resource.flush(tid);
-
-            slice_renderer->updatePageTable(cur_renderer_page_table);
-
-            slice_renderer->render(sliceExt, static_cast<SliceRenderer::RenderType>(render_type));
-
-            for (const auto &item : cur_renderer_page_table)
-            {
-                page_table.release(item.second);
-            }
-
-            const auto &ret = slice_renderer->getFrameBuffers().getColors();
-
-            return ret;
-        };
-    }
-    else
-    {
-        //同步框架 确保每一帧绘制完整
-        slice_render = [&]() -> const Image & {
-            SliceExt sliceExt{slice, SliceHelper::GetSliceLod(slice),
-                              volume.getVoxel() * SliceHelper::SliceStepVoxelRatio, 0.f};
-            FrustumExt view_frustum{};
-            SliceHelper::ExtractViewFrustumExtFromSliceExt(sliceExt, view_frustum, volume.getVoxel());
-
-            auto intersect_blocks = volume_block_tree.computeIntersectBlock(view_frustum, sliceExt.lod);
-            //            LOG_INFO("slice render intersect block count: {}",intersect_blocks.size());
-            //            for(auto& b:intersect_blocks){
-            //              LOG_INFO("intersect block {} {} {} {}",b.x,b.y,b.z,b.w);
-            //            }
-
-            //将slice分割成与GPU个数相等的子切片 使得最后真正需要上传的数据块数量最小
-            //需要快速找到最优解 如果最优解太耗时 则快速求近似解
-
-            std::vector<Volume::BlockIndex> missed_blocks;
-            std::vector<Renderer::PageTableItem> cur_renderer_page_table;
-            auto &page_table = gpu_resource.getPageTable();
-            page_table.acquireLock();
-
-            auto query_ret = page_table.queriesAndLockExt(intersect_blocks);
-            for (const auto &ret : query_ret)
-            {
-                if (ret.cached)
-                {
-                    cur_renderer_page_table.emplace_back(ret.entry, ret.value);
-                }
-                else
-                {
-                    missed_blocks.emplace_back(ret.value);
-                }
-            }
-            //            LOG_INFO("first time missed blocks count: {}",missed_blocks.size());
+    //交互时降低分辨率和lod 停止交互后逐帧细化
+    ProgressiveRefinement progressive;
+    ProgressiveRefinement::Level progressive_level{};
 
-            //同步加载 该帧内会等待数据块加载好 因此对所有缺失的数据块进行页表项申请
+    //同步时每一帧绘制完整 异步时缺失的块由祖先块代替 同一级需要继续渲染
+    SliceRenderPipeline pipeline(volume_block_tree, block_volume_manager, gpu_resource, slice_renderer);
+    pipeline.setMode(async ? RenderPipeline::ASYNC : RenderPipeline::SYNC);
 
-            auto missed_block_entries = page_table.getEntriesAndLock(missed_blocks);
-            page_table.acquireRelease(); // acquire lock and release 之间不能有耗时的操作
-
-            //在queriesAndLockExt和getEntriesAndLock之间可能有正在被上传的数据块刚好上传完
-            std::unordered_map<Volume::BlockIndex, PageTable::EntryItem> block_entries; //真正需要上传的数据块
-            std::mutex block_entries_mtx;
-            missed_blocks.clear(); //重新生成
-
-            for (const auto &entry : missed_block_entries)
-            {
-                if (!entry.cached)
-                {
-                    block_entries[entry.value] = entry.entry;
-                    missed_blocks.emplace_back(entry.value);
-                }
-                cur_renderer_page_table.emplace_back(entry.entry, entry.value);
-            }
-
-            auto thread_id = std::this_thread::get_id();
-            auto tid = std::hash<decltype(thread_id)>()(thread_id);
-
-            auto task = [&](int thread_idx, Volume::BlockIndex block_index) {
-                LOG_INFO("start {} {} {} {}", block_index.x, block_index.y, block_index.z, block_index.w);
-                auto p = block_volume_manager.getVolumeBlockAndLock(block_index);
-
-                auto entry = block_entries[block_index];
-
-                GPUResource::ResourceDesc desc{};
-                desc.id = tid;
-                desc.type = GPUResource::Texture;
-                desc.width = volume.getBlockLength();
-                desc.pitch = volume.getBlockLength();
-                desc.height = volume.getBlockLength();
-                desc.depth = volume.getBlockLength();
-                desc.size = volume.getBlockSize();
-                GPUResource::ResourceExtent extent{volume.getBlockLength(), volume.getBlockLength(),
-                                                   volume.getBlockLength()};
-                auto ret = gpu_resource.uploadResource(desc, entry, extent, p, volume.getBlockSize(), false);
-                assert(ret);
-                ret = block_volume_manager.unlock(p);
-                assert(ret);
-                page_table.update(block_index);
-                LOG_INFO("finish {} {} {} {}", block_index.x, block_index.y, block_index.z, block_index.w);
-            };
-            parallel_foreach(missed_blocks, task, missed_blocks.size());
-            //            LOG_INFO("finish parallel task");
-            gpu_resource.flush(tid);
-            //            LOG_INFO("finish flush");
-            slice_renderer->updatePageTable(cur_renderer_page_table);
-
-            slice_renderer->render(sliceExt, static_cast<SliceRenderer::RenderType>(render_type));
-
-            for (const auto &item : cur_renderer_page_table)
-            {
-                page_table.release(item.second);
-            }
-
-            const auto &ret = slice_renderer->getFrameBuffers().getColors();
-
-            return ret;
-        };
-    }
+    //返回读回缓冲中的结果 不经过Framebuffer的拷贝
+    auto slice_render = [&]() -> FramebufferView {
+        SliceExt sliceExt{slice, SliceHelper::GetSliceLod(slice),
+                          volume.getVoxel() * SliceHelper::SliceStepVoxelRatio, 0.f};
+        sliceExt = ProgressiveRefinement::GetLevelSlice(sliceExt, progressive_level, volume.getMaxLod());
+        return pipeline.render(sliceExt, static_cast<SliceRenderer::RenderType>(render_type));
+    };
 
     bool exit = false;
     uint32_t delta_t = 0;
@@ -394,6 +197,7 @@ void RunRenderLoop(bool async)
                 }
                 case SDLK_c: {
                     render_type = 1 - render_type;
+                    progressive.onInteraction();
                     break;
                 }
                 case SDLK_LCTRL: {
@@ -414,6 +218,7 @@ void RunRenderLoop(bool async)
                 break;
             }
             case SDL_MOUSEWHEEL: {
+                progressive.onInteraction();
                 if (zoom)
                 {
                     float offset = event.wheel.y;
@@ -444,6 +249,7 @@ void RunRenderLoop(bool async)
 
                     slice.origin += -slice.x_dir * x_offset * slice.voxels_per_pixel * voxel -
                                     slice.y_dir * y_offset * slice.voxels_per_pixel * voxel;
+                    progressive.onInteraction();
                 }
 
                 break;
@@ -452,16 +258,56 @@ void RunRenderLoop(bool async)
         }
     };
 
+    //求交和页表 上传和渲染 读回分别在不同的线程中 帧之间重叠执行
+    //在途的帧数量有上限 所以使用完整质量持续提交 不做逐级细化
+    if (pipelined)
+    {
+        FramePipelineExecutor executor(pipeline);
+        int frames_in_flight = 0;
+        while (!exit)
+        {
+            last_t = SDL_GetTicks();
+
+            process_input(exit, delta_t);
+            SliceExt sliceExt{slice, SliceHelper::GetSliceLod(slice),
+                              volume.getVoxel() * SliceHelper::SliceStepVoxelRatio, 0.f};
+            executor.submit(sliceExt, static_cast<SliceRenderer::RenderType>(render_type));
+            //在途的帧数达到上限后才等待最早的一帧 显示的画面落后输入MaxFramesInFlight-1帧
+            if (++frames_in_flight < FramePipelineExecutor::MaxFramesInFlight)
+                continue;
+            FramePipelineExecutor::Result result;
+            if (executor.acquire(result))
+            {
+                frames_in_flight--;
+                SDLDraw(result.colors);
+            }
+
+            delta_t = SDL_GetTicks() - last_t;
+        }
+        executor.stop();
+        return;
+    }
+
     while (!exit)
     {
         last_t = SDL_GetTicks();
 
         process_input(exit, delta_t);
+        //视图没有变化并且已经细化到完整质量 保留上一帧
+        if (!progressive.beginFrame(progressive_level))
+        {
+            SDL_Delay(5);
+            continue;
+        }
         START_TIMER
-        const auto &colors = slice_render();
+        auto colors = slice_render();
         //        STOP_TIMER("slice render")
 
-        SDLDraw(colors);
+        //细化的帧在渲染期间有新的交互时不显示 下一帧直接使用交互的级别
+        if (progressive.endFrame(pipeline.isFrameComplete()))
+        {
+            SDLDraw(colors);
+        }
 
         delta_t = SDL_GetTicks() - last_t;
         //        std::cout<<"delta_t: "<<delta_t<<std::endl;
@@ -492,6 +338,8 @@ void RunMultiThreadingRenderLoop(bool async)
     block_volume_manager.setProvider(std::move(p));
 
     block_volume_manager.init();
+    //缩小视图时由已经加载的高分辨率块生成低分辨率块
+    block_volume_manager.setLodDerivation(true);
 
     GPUResource gpu_resource(0);
     GPUResource::ResourceDesc desc{};
@@ -537,286 +385,50 @@ void RunMultiThreadingRenderLoop(bool async)
     slice.normal = {0.f, 0.f, 1.f};
     slice.origin = {5.52f, 5.52f, 5.9f};
 
-    std::function<const Image &()> slice_render;
-
     uint32_t render_type = 0;
 
-    const int slice_renderer_count = slice_renderers.size();
-
-    if (async)
+    //每个渲染器一个pipeline 共用一个GPUResource 页表的并发由PageTable保证
+    std::vector<std::unique_ptr<SliceRenderPipeline>> pipelines;
+    for (auto slice_renderer : slice_renderers)
     {
-        slice_render = [&]() -> const Image & {
-            static Image merge_color(window_w, window_h);
-
-            SliceExt sliceExt{slice, SliceHelper::GetSliceLod(slice),
-                              volume.getVoxel() * SliceHelper::SliceStepVoxelRatio, 0.f};
-            //进行Slice分割 使用最简单的均分
-            std::vector<SliceExt> sub_slices;
-            SliceHelper::UniformDivideSlice(sliceExt, slice_renderer_count, sub_slices);
-            for (int i = 0; i < sub_slices.size(); i++)
-            {
-                sub_slices[i].id = 100 + i;
-            }
-
-            auto slice_render_task = [&](const SliceExt &sub_slice, SliceRenderer *slice_renderer) -> const Image & {
-                int id = sub_slice.id;
-                FrustumExt view_frustum{};
-                SliceHelper::ExtractViewFrustumExtFromSliceExt(sub_slice, view_frustum, volume.getVoxel());
-
-                auto intersect_blocks = volume_block_tree.computeIntersectBlock(view_frustum, sub_slice.lod);
-//                LOG_INFO("slice render intersect block count: {}", intersect_blocks.size());
-//                for (auto &b : intersect_blocks)
-//                {
-//                    LOG_INFO("slice id: {},intersect block {} {} {} {}", sub_slice.id, b.x, b.y, b.z, b.w);
-//                }
-                std::vector<Volume::BlockIndex> missed_blocks;
-                std::vector<Renderer::PageTableItem> cur_renderer_page_table;
-                auto &page_table = gpu_resource.getPageTable();
-                page_table.acquireLock();
-
-                auto query_ret = page_table.queriesAndLockExt(intersect_blocks);
-                for (const auto &ret : query_ret)
-                {
-                    if (ret.cached)
-                    {
-                        cur_renderer_page_table.emplace_back(ret.entry, ret.value);
-                    }
-                    else
-                    {
-                        missed_blocks.emplace_back(ret.value);
-                    }
-                }
-//                LOG_INFO("first time missed blocks count: {}", missed_blocks.size());
-
-                //异步加载数据块 先查询缺失块是否已经加载到内存中
-                std::unordered_map<Volume::BlockIndex, void *> missed_block_buffer;
-                std::vector<Volume::BlockIndex> copy_missed_blocks;
-                copy_missed_blocks.swap(missed_blocks);
-                for (const auto &block : copy_missed_blocks)
-                {
-                    auto p = block_volume_manager.getVolumeBlock(block, false);
-                    if (p && block_volume_manager.lock(p))
-                    {
-                        missed_blocks.emplace_back(block);
-                    }
-                    else
-                    {
-                        p = nullptr;
-                    }
-                    missed_block_buffer[block] = p;
-                }
-//                LOG_INFO("{} second time missed block count: {}", id, missed_blocks.size());
-                auto missed_block_entries = page_table.getEntriesAndLock(missed_blocks);
-                page_table.acquireRelease();
-                assert(missed_block_entries.size() == missed_blocks.size());
-//                LOG_INFO("{} get entries",id);
-                std::unordered_map<Volume::BlockIndex, PageTable::EntryItem> block_entries;
-                missed_blocks.clear();
-                for (const auto &entry : missed_block_entries)
-                {
-                    if (!entry.cached)
-                    {
-                        missed_blocks.emplace_back(entry.value);
-                        block_entries[entry.value] = entry.entry;
-                    }
-                    else
-                    {
-                        block_volume_manager.unlock(missed_block_buffer[entry.value]);
-                        LOG_ERROR("unlock");
-                        missed_block_buffer[entry.value] = nullptr;
-                    }
-                    cur_renderer_page_table.emplace_back(entry.entry, entry.value);
-                }
-//                LOG_INFO("{} slice render missed block count: {}", id,missed_blocks.size());
-
-                auto thread_id = std::this_thread::get_id();
-                auto tid = std::hash<decltype(thread_id)>()(thread_id);
-
-                auto task = [&](int thread_idx, Volume::BlockIndex block_index) {
-                    auto p = missed_block_buffer[block_index];
-                    assert(p);
-                    if (!p)
-                        return;
-                    auto entry = block_entries[block_index];
-
-                    GPUResource::ResourceDesc desc{};
-                    desc.id = tid;
-                    desc.type = GPUResource::Texture;
-                    desc.width = volume.getBlockLength();
-                    desc.pitch = volume.getBlockLength();
-                    desc.height = volume.getBlockLength();
-                    desc.depth = volume.getBlockLength();
-                    desc.size = volume.getBlockSize();
-                    GPUResource::ResourceExtent extent{volume.getBlockLength(), volume.getBlockLength(),
-                                                       volume.getBlockLength()};
-                    auto ret = gpu_resource.uploadResource(desc, entry, extent, p, volume.getBlockSize(), false);
-                    assert(ret);
-//                    LOG_DEBUG("after upload");
-                    ret = block_volume_manager.unlock(p);
-                    assert(ret);
-//                    LOG_DEBUG("after unlock");
-                    page_table.update(block_index);
-//                    LOG_DEBUG("after update");
-                };
-                parallel_foreach(missed_blocks, task, missed_blocks.size());
-//                LOG_DEBUG("after task {}",id);
-                gpu_resource.flush(tid);
-//                LOG_DEBUG("after flush {}",id);
-
-                slice_renderer->updatePageTable(cur_renderer_page_table);
-//                LOG_DEBUG("after update page table {}",id);
-                slice_renderer->render(sliceExt, static_cast<SliceRenderer::RenderType>(sub_slice.id - 100));
-//                LOG_DEBUG("after render {}",id);
-                for (const auto &item : cur_renderer_page_table)
-                {
-                    page_table.release(item.second);
-                }
-//                LOG_DEBUG("after release {}",id);
-                return slice_renderer->getFrameBuffers().getColors();
-            };
-            std::vector<std::future<const Image &>> sub_images;
-            for (int i = 0; i < slice_renderer_count; i++)
-            {
-                sub_images.emplace_back(
-                    std::async(std::launch::async, slice_render_task, sub_slices[i], slice_renderers[i]));
-            }
-
-            std::vector<const Image *> sub_colors;
-            for (auto &r : sub_images)
-            {
-                sub_colors.emplace_back(&r.get());
-//                LOG_DEBUG("get future");
-            }
-//          LOG_DEBUG("before merge");
-//            START_TIMER
-            SliceHelper::UniformMergeSlice(sub_slices, sub_colors, merge_color);
-//            LOG_DEBUG("after merge");
-//            STOP_TIMER("merge slice")
-
-            return merge_color;
-        };
+        pipelines.emplace_back(std::make_unique<SliceRenderPipeline>(volume_block_tree, block_volume_manager,
+                                                                     gpu_resource, slice_renderer));
+        pipelines.back()->setMode(async ? RenderPipeline::ASYNC : RenderPipeline::SYNC);
     }
-    else
-    {
-        slice_render = [&]() -> const Image & {
-            static Image merge_color(window_w, window_h);
-
-            SliceExt sliceExt{slice, SliceHelper::GetSliceLod(slice),
-                              volume.getVoxel() * SliceHelper::SliceStepVoxelRatio, 0.f};
-            //进行Slice分割 使用最简单的均分
-            std::vector<SliceExt> sub_slices;
-            SliceHelper::UniformDivideSlice(sliceExt, slice_renderer_count, sub_slices);
-            for (int i = 0; i < sub_slices.size(); i++)
-            {
-                sub_slices[i].id = 100 + i;
-            }
 
-            auto slice_render_task = [&](const SliceExt &sub_slice, SliceRenderer *slice_renderer) -> const Image & {
-                FrustumExt view_frustum{};
-                SliceHelper::ExtractViewFrustumExtFromSliceExt(sub_slice, view_frustum, volume.getVoxel());
-
-                auto intersect_blocks = volume_block_tree.computeIntersectBlock(view_frustum, sub_slice.lod);
-                LOG_INFO("slice render intersect block count: {}", intersect_blocks.size());
-                for (auto &b : intersect_blocks)
-                {
-                    LOG_INFO("slice id: {},intersect block {} {} {} {}", sub_slice.id, b.x, b.y, b.z, b.w);
-                }
-                std::vector<Volume::BlockIndex> missed_blocks;
-                std::vector<Renderer::PageTableItem> cur_renderer_page_table;
-                auto &page_table = gpu_resource.getPageTable();
-                page_table.acquireLock();
-
-                auto query_ret = page_table.queriesAndLockExt(intersect_blocks);
-                for (const auto &ret : query_ret)
-                {
-                    if (ret.cached)
-                    {
-                        cur_renderer_page_table.emplace_back(ret.entry, ret.value);
-                    }
-                    else
-                    {
-                        missed_blocks.emplace_back(ret.value);
-                    }
-                }
-                LOG_INFO("first time missed blocks count: {}", missed_blocks.size());
-
-                auto missed_block_entries = page_table.getEntriesAndLock(missed_blocks);
-                page_table.acquireRelease(); // acquire lock and release 之间不能有耗时的操作
+    const int slice_renderer_count = slice_renderers.size();
 
-                //在queriesAndLockExt和getEntriesAndLock之间可能有正在被上传的数据块刚好上传完
-                std::unordered_map<Volume::BlockIndex, PageTable::EntryItem> block_entries; //真正需要上传的数据块
-                std::mutex block_entries_mtx;
-                missed_blocks.clear(); //重新生成
+    auto slice_render = [&]() -> const Image & {
+        static Image merge_color(window_w, window_h);
 
-                for (const auto &entry : missed_block_entries)
-                {
-                    if (!entry.cached)
-                    {
-                        block_entries[entry.value] = entry.entry;
-                        missed_blocks.emplace_back(entry.value);
-                    }
-                    cur_renderer_page_table.emplace_back(entry.entry, entry.value);
-                }
-
-                auto thread_id = std::this_thread::get_id();
-                auto tid = std::hash<decltype(thread_id)>()(thread_id);
-
-                auto task = [&](int thread_idx, Volume::BlockIndex block_index) {
-                    auto p = block_volume_manager.getVolumeBlockAndLock(block_index);
-
-                    auto entry = block_entries[block_index];
-
-                    GPUResource::ResourceDesc desc{};
-                    desc.id = tid;
-                    desc.type = GPUResource::Texture;
-                    desc.width = volume.getBlockLength();
-                    desc.pitch = volume.getBlockLength();
-                    desc.height = volume.getBlockLength();
-                    desc.depth = volume.getBlockLength();
-                    desc.size = volume.getBlockSize();
-                    GPUResource::ResourceExtent extent{volume.getBlockLength(), volume.getBlockLength(),
-                                                       volume.getBlockLength()};
-                    auto ret = gpu_resource.uploadResource(desc, entry, extent, p, volume.getBlockSize(), false);
-                    assert(ret);
-                    ret = block_volume_manager.unlock(p);
-                    assert(ret);
-                    page_table.update(block_index);
-                };
-                parallel_foreach(missed_blocks, task, missed_blocks.size());
-
-                gpu_resource.flush(tid);
-
-                slice_renderer->updatePageTable(cur_renderer_page_table);
-                LOG_DEBUG("after update page table");
-                slice_renderer->render(sliceExt, static_cast<SliceRenderer::RenderType>(sub_slice.id - 100));
-
-                for (const auto &item : cur_renderer_page_table)
-                {
-                    page_table.release(item.second);
-                }
+        SliceExt sliceExt{slice, SliceHelper::GetSliceLod(slice),
+                          volume.getVoxel() * SliceHelper::SliceStepVoxelRatio, 0.f};
+        //进行Slice分割 使用最简单的均分
+        std::vector<SliceExt> sub_slices;
+        SliceHelper::UniformDivideSlice(sliceExt, slice_renderer_count, sub_slices);
+        for (int i = 0; i < sub_slices.size(); i++)
+        {
+            sub_slices[i].id = 100 + i;
+        }
 
-                return slice_renderer->getFrameBuffers().getColors();
-            };
-            std::vector<std::future<const Image &>> sub_images;
-            for (int i = 0; i < slice_renderer_count; i++)
-            {
-                sub_images.emplace_back(
-                    std::async(std::launch::async, slice_render_task, sub_slices[i], slice_renderers[i]));
-            }
+        std::vector<std::future<FramebufferView>> sub_images;
+        for (int i = 0; i < slice_renderer_count; i++)
+        {
+            sub_images.emplace_back(std::async(std::launch::async, [&, i]() {
+                return pipelines[i]->render(sub_slices[i], static_cast<SliceRenderer::RenderType>(render_type));
+            }));
+        }
 
-            std::vector<const Image *> sub_colors;
-            for (auto &r : sub_images)
-            {
-                sub_colors.emplace_back(&r.get());
-            }
+        std::vector<FramebufferView> sub_colors;
+        for (auto &r : sub_images)
+        {
+            sub_colors.emplace_back(r.get());
+        }
 
-            START_TIMER
-            SliceHelper::UniformMergeSlice(sub_slices, sub_colors, merge_color);
-            STOP_TIMER("merge slice")
+        SliceHelper::UniformMergeSlice(sub_slices, sub_colors, merge_color);
 
-            return merge_color;
-        };
-    }
+        return merge_color;
+    };
     bool exit = false;
     uint32_t delta_t = 0;
     uint32_t last_t = 0;
@@ -953,6 +565,8 @@ void RunDivideAndMergeRenderLoop(bool async)
     block_volume_manager.setProvider(std::move(p));
 
     block_volume_manager.init();
+    //缩小视图时由已经加载的高分辨率块生成低分辨率块
+    block_volume_manager.setLodDerivation(true);
 
     int gpu_count = 2;
     std::vector<std::unique_ptr<GPUResource>> gpu_resources;
@@ -1008,280 +622,56 @@ void RunDivideAndMergeRenderLoop(bool async)
     slice.normal = {0.f, 0.f, 1.f};
     slice.origin = {5.52f, 5.52f, 5.9f};
 
-    std::function<const Image &()> slice_render;
-
     uint32_t render_type = 0;
 
-    if (async)
+    //每个GPU一个pipeline
+    std::vector<std::unique_ptr<SliceRenderPipeline>> pipelines;
+    for (int i = 0; i < gpu_count; i++)
     {
-        slice_render = [&]() -> const Image& {
-            static Image merge_color(window_w, window_h);
-
-            SliceExt sliceExt{slice, SliceHelper::GetSliceLod(slice),
-                              volume.getVoxel() * SliceHelper::SliceStepVoxelRatio, 0.f};
-            //进行Slice分割 使用最简单的均分
-            std::vector<SliceExt> sub_slices;
-            SliceHelper::UniformDivideSlice(sliceExt, gpu_count, sub_slices);
-            for (int i = 0; i < sub_slices.size(); i++)
-            {
-                sub_slices[i].id = 100 + i;
-            }
-            auto slice_render_task = [&](const SliceExt &sub_slice, SliceRenderer *slice_renderer,
-                                         GPUResource *gpu_resource) -> const Image & {
-                FrustumExt view_frustum{};
-                SliceHelper::ExtractViewFrustumExtFromSliceExt(sub_slice, view_frustum, volume.getVoxel());
-
-                auto intersect_blocks = volume_block_tree.computeIntersectBlock(view_frustum, sub_slice.lod);
-                LOG_INFO("slice render intersect block count: {}", intersect_blocks.size());
-                for (auto &b : intersect_blocks)
-                {
-                    LOG_INFO("slice id: {},intersect block {} {} {} {}", sub_slice.id, b.x, b.y, b.z, b.w);
-                }
-                std::vector<Volume::BlockIndex> missed_blocks;
-                std::vector<Renderer::PageTableItem> cur_renderer_page_table;
-                auto &page_table = gpu_resource->getPageTable();
-                page_table.acquireLock();
-
-                auto query_ret = page_table.queriesAndLockExt(intersect_blocks);
-                for (const auto &ret : query_ret)
-                {
-                    if (ret.cached)
-                    {
-                        cur_renderer_page_table.emplace_back(ret.entry, ret.value);
-                    }
-                    else
-                    {
-                        missed_blocks.emplace_back(ret.value);
-                    }
-                }
-                LOG_INFO("first time missed blocks count: {}", missed_blocks.size());
-
-                //异步加载数据块 先查询缺失块是否已经加载到内存中
-                std::unordered_map<Volume::BlockIndex, void *> missed_block_buffer;
-                std::vector<Volume::BlockIndex> copy_missed_blocks;
-                copy_missed_blocks.swap(missed_blocks);
-                for (const auto &block : copy_missed_blocks)
-                {
-                    auto p = block_volume_manager.getVolumeBlock(block, false);
-                    if (p && block_volume_manager.lock(p))
-                    {
-                        missed_blocks.emplace_back(block);
-                    }
-                    else
-                    {
-                        p = nullptr;
-                    }
-                    missed_block_buffer[block] = p;
-                }
-
-                auto missed_block_entries = page_table.getEntriesAndLock(missed_blocks);
-                page_table.acquireRelease(); // acquire lock and release 之间不能有耗时的操作
-
-                //在queriesAndLockExt和getEntriesAndLock之间可能有正在被上传的数据块刚好上传完
-                std::unordered_map<Volume::BlockIndex, PageTable::EntryItem> block_entries; //真正需要上传的数据块
-                missed_blocks.clear(); //重新生成
-
-                for (const auto &entry : missed_block_entries)
-                {
-                    if (!entry.cached)
-                    {
-                        missed_blocks.emplace_back(entry.value);
-                        block_entries[entry.value] = entry.entry;
-                    }
-                    else
-                    {
-                        block_volume_manager.unlock(missed_block_buffer[entry.value]);
-                        LOG_ERROR("unlock");
-                        missed_block_buffer[entry.value] = nullptr;
-                    }
-                    cur_renderer_page_table.emplace_back(entry.entry, entry.value);
-                }
-
-                auto thread_id = std::this_thread::get_id();
-                auto tid = std::hash<decltype(thread_id)>()(thread_id);
-
-                auto task = [&](int thread_idx, Volume::BlockIndex block_index) {
-                    auto p = missed_block_buffer[block_index];
-                    assert(p);
-                    if (!p)
-                        return;
-                    auto entry = block_entries[block_index];
-
-                    GPUResource::ResourceDesc desc{};
-                    desc.id = tid;
-                    desc.type = GPUResource::Texture;
-                    desc.width = volume.getBlockLength();
-                    desc.pitch = volume.getBlockLength();
-                    desc.height = volume.getBlockLength();
-                    desc.depth = volume.getBlockLength();
-                    desc.size = volume.getBlockSize();
-                    GPUResource::ResourceExtent extent{volume.getBlockLength(), volume.getBlockLength(),
-                                                       volume.getBlockLength()};
-                    auto ret = gpu_resource->uploadResource(desc, entry, extent, p, volume.getBlockSize(), false);
-                    assert(ret);
-                    ret = block_volume_manager.unlock(p);
-                    assert(ret);
-                    page_table.update(block_index);
-                };
-                parallel_foreach(missed_blocks, task, missed_blocks.size());
-
-                gpu_resource->flush(tid);
-
-                slice_renderer->updatePageTable(cur_renderer_page_table);
-
-                slice_renderer->render(sliceExt, static_cast<SliceRenderer::RenderType>(render_type));
-
-                for (const auto &item : cur_renderer_page_table)
-                {
-                    page_table.release(item.second);
-                }
-
-                return slice_renderer->getFrameBuffers().getColors();
-            };
-
-            std::vector<std::future<const Image &>> sub_images;
-            for (int i = 0; i < gpu_count; i++)
-            {
-                sub_images.emplace_back(std::async(std::launch::async, slice_render_task, sub_slices[i],
-                                                   slice_renderers[i], gpu_resources[i].get()));
-            }
-
-            std::vector<const Image *> sub_colors;
-            for (auto &r : sub_images)
-            {
-                sub_colors.emplace_back(&r.get());
-            }
-
-            START_TIMER
-            SliceHelper::UniformMergeSlice(sub_slices, sub_colors, merge_color);
-            STOP_TIMER("merge slice")
-
-            return merge_color;
-        };
+        pipelines.emplace_back(std::make_unique<SliceRenderPipeline>(volume_block_tree, block_volume_manager,
+                                                                     *gpu_resources[i], slice_renderers[i]));
+        pipelines.back()->setMode(async ? RenderPipeline::ASYNC : RenderPipeline::SYNC);
     }
-    else
-    {
-        slice_render = [&]() -> const Image & {
-            static Image merge_color(window_w, window_h);
-
-            SliceExt sliceExt{slice, SliceHelper::GetSliceLod(slice),
-                              volume.getVoxel() * SliceHelper::SliceStepVoxelRatio, 0.f};
-            //进行Slice分割 使用最简单的均分
-            std::vector<SliceExt> sub_slices;
-            SliceHelper::UniformDivideSlice(sliceExt, gpu_count, sub_slices);
-            for (int i = 0; i < sub_slices.size(); i++)
-            {
-                sub_slices[i].id = 100 + i;
-            }
-            auto slice_render_task = [&](const SliceExt &sub_slice, SliceRenderer *slice_renderer,
-                                         GPUResource *gpu_resource) -> const Image & {
-                FrustumExt view_frustum{};
-                SliceHelper::ExtractViewFrustumExtFromSliceExt(sub_slice, view_frustum, volume.getVoxel());
-
-                auto intersect_blocks = volume_block_tree.computeIntersectBlock(view_frustum, sub_slice.lod);
-                LOG_INFO("slice render intersect block count: {}", intersect_blocks.size());
-                for (auto &b : intersect_blocks)
-                {
-                    LOG_INFO("slice id: {},intersect block {} {} {} {}", sub_slice.id, b.x, b.y, b.z, b.w);
-                }
-                std::vector<Volume::BlockIndex> missed_blocks;
-                std::vector<Renderer::PageTableItem> cur_renderer_page_table;
-                auto &page_table = gpu_resource->getPageTable();
-                page_table.acquireLock();
-
-                auto query_ret = page_table.queriesAndLockExt(intersect_blocks);
-                for (const auto &ret : query_ret)
-                {
-                    if (ret.cached)
-                    {
-                        cur_renderer_page_table.emplace_back(ret.entry, ret.value);
-                    }
-                    else
-                    {
-                        missed_blocks.emplace_back(ret.value);
-                    }
-                }
-                LOG_INFO("first time missed blocks count: {}", missed_blocks.size());
-
-                auto missed_block_entries = page_table.getEntriesAndLock(missed_blocks);
-                page_table.acquireRelease(); // acquire lock and release 之间不能有耗时的操作
-
-                //在queriesAndLockExt和getEntriesAndLock之间可能有正在被上传的数据块刚好上传完
-                std::unordered_map<Volume::BlockIndex, PageTable::EntryItem> block_entries; //真正需要上传的数据块
-                std::mutex block_entries_mtx;
-                missed_blocks.clear(); //重新生成
-
-                for (const auto &entry : missed_block_entries)
-                {
-                    if (!entry.cached)
-                    {
-                        block_entries[entry.value] = entry.entry;
-                        missed_blocks.emplace_back(entry.value);
-                    }
-                    cur_renderer_page_table.emplace_back(entry.entry, entry.value);
-                }
-
-                auto thread_id = std::this_thread::get_id();
-                auto tid = std::hash<decltype(thread_id)>()(thread_id);
-
-                auto task = [&](int thread_idx, Volume::BlockIndex block_index) {
-                    auto p = block_volume_manager.getVolumeBlockAndLock(block_index);
-
-                    auto entry = block_entries[block_index];
-
-                    GPUResource::ResourceDesc desc{};
-                    desc.id = tid;
-                    desc.type = GPUResource::Texture;
-                    desc.width = volume.getBlockLength();
-                    desc.pitch = volume.getBlockLength();
-                    desc.height = volume.getBlockLength();
-                    desc.depth = volume.getBlockLength();
-                    desc.size = volume.getBlockSize();
-                    GPUResource::ResourceExtent extent{volume.getBlockLength(), volume.getBlockLength(),
-                                                       volume.getBlockLength()};
-                    auto ret = gpu_resource->uploadResource(desc, entry, extent, p, volume.getBlockSize(), false);
-                    assert(ret);
-                    ret = block_volume_manager.unlock(p);
-                    assert(ret);
-                    page_table.update(block_index);
-                };
-                parallel_foreach(missed_blocks, task, missed_blocks.size());
-
-                gpu_resource->flush(tid);
 
-                slice_renderer->updatePageTable(cur_renderer_page_table);
-
-                slice_renderer->render(sliceExt, static_cast<SliceRenderer::RenderType>(render_type));
-
-                for (const auto &item : cur_renderer_page_table)
-                {
-                    page_table.release(item.second);
-                }
-
-                return slice_renderer->getFrameBuffers().getColors();
-            };
-
-            std::vector<std::future<const Image &>> sub_images;
-            for (int i = 0; i < gpu_count; i++)
-            {
-                sub_images.emplace_back(std::async(std::launch::async, slice_render_task, sub_slices[i],
-                                                   slice_renderers[i], gpu_resources[i].get()));
-            }
+    auto slice_render = [&]() -> const Image & {
+        static Image merge_color(window_w, window_h);
+
+        SliceExt sliceExt{slice, SliceHelper::GetSliceLod(slice),
+                          volume.getVoxel() * SliceHelper::SliceStepVoxelRatio, 0.f};
+        //按照每个GPU页表中已有的块分割 每个GPU尽量只渲染自己已经有的块
+        SliceSlab slice_slab{};
+        SliceHelper::ExtractSliceSlabFromSliceExt(sliceExt, slice_slab, volume.getVoxel());
+        auto slice_blocks = volume_block_tree.computeIntersectBlock(slice_slab, sliceExt.lod);
+        std::vector<SliceExt> sub_slices;
+        SliceHelper::ResidencyAwareDivideSlice(
+            sliceExt, volume, gpu_count, slice_blocks,
+            [&](int gpu, const Volume::BlockIndex &block) { return gpu_resources[gpu]->getPageTable().query(block); },
+            sub_slices);
+        for (int i = 0; i < sub_slices.size(); i++)
+        {
+            sub_slices[i].id = 100 + i;
+        }
 
-            std::vector<const Image *> sub_colors;
-            for (auto &r : sub_images)
-            {
-                sub_colors.emplace_back(&r.get());
-            }
+        std::vector<std::future<FramebufferView>> sub_images;
+        for (int i = 0; i < gpu_count; i++)
+        {
+            sub_images.emplace_back(std::async(std::launch::async, [&, i]() {
+                return pipelines[i]->render(sub_slices[i], static_cast<SliceRenderer::RenderType>(render_type));
+            }));
+        }
 
-            START_TIMER
-            SliceHelper::UniformMergeSlice(sub_slices, sub_colors, merge_color);
-            STOP_TIMER("merge slice")
+        std::vector<FramebufferView> sub_colors;
+        for (auto &r : sub_images)
+        {
+            sub_colors.emplace_back(r.get());
+        }
 
-            return merge_color;
-        };
-    }
+        START_TIMER
+        SliceHelper::UniformMergeSlice(sub_slices, sub_colors, merge_color);
+        STOP_TIMER("merge slice")
 
+        return merge_color;
+    };
     bool exit = false;
     uint32_t delta_t = 0;
     uint32_t last_t = 0;
@@ -1404,6 +794,7 @@ int main(int argc, char **argv)
           "\n\t3 RunSyncDivideAndMergeRenderLoop"
           "\n\t4 RunAsyncMultiThreadingRenderLoop"
           "\n\t5 RunSyncMultiThreadingRenderLoop"
+          "\n\t6 RunAsyncPipelinedRenderLoop"
        << std::endl;
 
     SET_LOG_LEVEL_DEBUG
@@ -1449,6 +840,11 @@ int main(int argc, char **argv)
             LOG_INFO("RunSyncMultiThreadingRenderLoop");
             RunMultiThreadingRenderLoop(false);
         }
+        else if (t == 6)
+        {
+            LOG_INFO("RunAsyncPipelinedRenderLoop");
+            RunRenderLoop(true, true);
+        }
         else
         {
             std::cerr << ss.str();
@@ -0,0 +1,91 @@
+//
+// Created by wyz on 2022/5/29.
+//
+#include "algorithm/VolumeHelper.hpp"
+#include "common/Parrallel.hpp"
+#include "core/VolumeBlockStatistics.hpp"
+#include "extension/VolumeBlockProviderInterface.hpp"
+#include "plugin/PluginLoader.hpp"
+#include "utils/Timer.hpp"
+#include <iostream>
+#include <numeric>
+#include <unordered_map>
+using namespace mrayns;
+
+/**
+ * 通过block-provider插件解码所有lod的块 生成块统计信息的sidecar文件
+ * usage: VolumeBlockStatisticsBuilder <plugin_dir> <provider_key> <input> <output> [max_lod]
+ */
+int main(int argc,char** argv){
+    if(argc < 5){
+        std::cout<<"usage: VolumeBlockStatisticsBuilder <plugin_dir> <provider_key> <input> <output> [max_lod]"<<std::endl;
+        return 1;
+    }
+    try{
+        PluginLoader::LoadPlugins(argv[1]);
+        auto p = std::unique_ptr<IVolumeBlockProviderInterface>(
+            PluginLoader::CreatePlugin<IVolumeBlockProviderInterface>(argv[2]));
+        if(!p){
+            throw std::runtime_error(std::string("can't create provider: ") + argv[2]);
+        }
+        p->setHostNode(&HostNode::getInstance());
+        p->open(argv[3]);
+        auto volume = p->getVolume();
+        if(!volume.isValid()){
+            throw std::runtime_error("provider return invalid volume");
+        }
+        if(argc > 5){
+            volume.max_lod = (std::min)(volume.getMaxLod(),std::stoi(argv[5]));
+        }
+        VolumeBlockStatistics statistics;
+        statistics.create(volume);
+
+        int batch_count = actual_worker_count(0) * 2;
+        std::vector<std::vector<uint8_t>> buffers(batch_count,std::vector<uint8_t>(volume.getBlockSize()));
+        std::vector<int> indices(batch_count);
+        //完成回调按照dst找到对应的缓冲 priority只是调度的提示 provider可以改变它
+        std::unordered_map<const void*,size_t> buffer_pos;
+        for(int j = 0; j < batch_count; j++){
+            buffer_pos[buffers[j].data()] = j;
+        }
+        START_TIMER
+        for(int lod = 0; lod <= volume.getMaxLod(); lod++){
+            auto dim = VolumeHelper::ComputeLodVolumeBlockDim(volume,lod);
+            std::vector<Volume::BlockIndex> blocks;
+            for(int z = 0; z < dim.z; z++){
+                for(int y = 0; y < dim.y; y++){
+                    for(int x = 0; x < dim.x; x++){
+                        blocks.emplace_back(x,y,z,lod);
+                    }
+                }
+            }
+            for(size_t i = 0; i < blocks.size(); i += batch_count){
+                size_t n = (std::min)(blocks.size() - i,static_cast<size_t>(batch_count));
+                std::vector<IVolumeBlockProviderInterface::BlockRequest> requests;
+                for(size_t j = 0; j < n; j++){
+                    requests.push_back({blocks[i + j],buffers[j].data(),static_cast<float>(j)});
+                }
+                std::vector<char> ok(n,0);
+                p->getVolumeBlocks(requests,[&](const IVolumeBlockProviderInterface::BlockRequest& request,bool success){
+                    ok[buffer_pos.at(request.dst)] = success;
+                });
+                indices.resize(n);
+                std::iota(indices.begin(),indices.end(),0);
+                parallel_foreach(indices,[&](int,int j){
+                    if(!ok[j]){
+                        throw std::runtime_error("provider load block failed");
+                    }
+                    statistics.record(blocks[i + j],VolumeBlockStatistics::Compute(volume,buffers[j].data()));
+                });
+            }
+            LOG_INFO("compute lod {} statistics finish, block count: {}",lod,blocks.size());
+        }
+        statistics.save(argv[4]);
+        STOP_TIMER("build volume block statistics")
+    }
+    catch(const std::exception& err){
+        std::cout<<err.what()<<std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -5,6 +5,8 @@
 #pragma once
 #include "../common/Define.hpp"
 #include "../core/Renderer.hpp"
+#include <algorithm>
+#include <cmath>
 MRAYNS_BEGIN
 
 inline void ComputeTransferFunction1DExt(TransferFunctionExt1D& tf){
@@ -36,4 +38,28 @@ inline void ComputeTransferFunction1DExt(TransferFunctionExt1D& tf){
     }
 }
 
+/**
+ * 不透明度大于threshold的传输函数项的前缀和 O(1)判断一个值域经过传输函数后是否完全透明
+ * 块内采样的插值结果不会超出块的[min,max] 因此可以用块的值域剔除完全透明的块
+ * 着色器中传输函数是线性插值采样的 值v会读到v-1到v+1的项 所以查询范围向两侧各扩展一个值
+ */
+struct TransferFunctionOpacityTable{
+    static constexpr int TFDim = TransferFunctionExt1D::TFDim;
+    int prefix[TFDim + 1]{};
+
+    void build(const TransferFunctionExt1D& tf,float threshold = 0.f){
+        prefix[0] = 0;
+        for(int i = 0; i < TFDim; i++){
+            prefix[i + 1] = prefix[i] + (tf.tf[i * 4 + 3] > threshold ? 1 : 0);
+        }
+    }
+
+    bool isTransparent(float minValue,float maxValue) const{
+        int lo = (std::max)(static_cast<int>(std::floor(minValue)) - 1,0);
+        int hi = (std::min)(static_cast<int>(std::ceil(maxValue)) + 1,TFDim - 1);
+        if(lo > hi) return true;
+        return prefix[hi + 1] - prefix[lo] == 0;
+    }
+};
+
 MRAYNS_END
@@ -0,0 +1,233 @@
+//
+// Created by wyz on 2022/5/27.
+//
+#pragma once
+#include "VolumeHelper.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MRAYNS_DOWNSAMPLE_SSE2
+#endif
+
+MRAYNS_BEGIN
+
+/**
+ * 用lod n的8个子块生成lod n+1的父块 只支持uint8
+ * 父块的内部体素完全来自8个子块 padding部分来自子块的邻居块 邻居块不在内存中时取最近子块的体素
+ */
+struct DownsampleHelper{
+    using BlockIndex = Volume::BlockIndex;
+    enum Mode:int{
+        AVERAGE = 0,MAXIMUM = 1
+    };
+
+    static BlockIndex GetChildBlockIndex(const BlockIndex& blockIndex,int dx,int dy,int dz){
+        return BlockIndex{blockIndex.x * 2 + dx,blockIndex.y * 2 + dy,blockIndex.z * 2 + dz,blockIndex.w - 1};
+    }
+
+    /**
+     * @brief lod n-1中生成blockIndex需要的块 必须的子块在前 可选的邻居块在后
+     * 超出lod n-1范围的子块不存在 按全零处理 不会出现在结果中
+     * @return 必须的子块的数量
+     */
+    static int GetSourceBlocks(const Volume& volume,const BlockIndex& blockIndex,std::vector<BlockIndex>& sourceBlocks){
+        assert(blockIndex.w > 0);
+        sourceBlocks.clear();
+        auto lod_block_dim = VolumeHelper::ComputeLodVolumeBlockDim(volume,blockIndex.w - 1);
+        for(int dz = 0; dz < 2; dz++){
+            for(int dy = 0; dy < 2; dy++){
+                for(int dx = 0; dx < 2; dx++){
+                    auto child = GetChildBlockIndex(blockIndex,dx,dy,dz);
+                    if(child.x < lod_block_dim.x && child.y < lod_block_dim.y && child.z < lod_block_dim.z){
+                        sourceBlocks.emplace_back(child);
+                    }
+                }
+            }
+        }
+        int child_count = static_cast<int>(sourceBlocks.size());
+        if(volume.getBlockPadding() == 0) return child_count;
+        std::vector<BlockIndex> neighbors;
+        for(int i = 0; i < child_count; i++){
+            VolumeHelper::GetVolumeNeighborBlocks(volume,sourceBlocks[i],neighbors);
+            for(auto& neighbor:neighbors){
+                if(std::find(sourceBlocks.begin(),sourceBlocks.end(),neighbor) == sourceBlocks.end()){
+                    sourceBlocks.emplace_back(neighbor);
+                }
+            }
+        }
+        return child_count;
+    }
+
+    /**
+     * @brief dst[i]由r0~r3四行中[2i,2i+1]两个体素共8个体素计算得到
+     */
+    static void DownsampleRow(const uint8_t* r0,const uint8_t* r1,const uint8_t* r2,const uint8_t* r3,
+                              uint8_t* dst,int count,Mode mode){
+        int i = 0;
+#ifdef MRAYNS_DOWNSAMPLE_SSE2
+        const __m128i low_mask = _mm_set1_epi16(0x00ff);
+        if(mode == AVERAGE){
+            const __m128i round = _mm_set1_epi16(4);
+            //每行相邻两个字节相加得到8个uint16 四行累加后最大为2040 不会溢出
+            auto pair_sum = [&low_mask](__m128i v){
+                return _mm_add_epi16(_mm_and_si128(v,low_mask),_mm_srli_epi16(v,8));
+            };
+            for(; i + 16 <= count; i += 16){
+                __m128i lo = _mm_setzero_si128();
+                __m128i hi = _mm_setzero_si128();
+                for(auto r:{r0,r1,r2,r3}){
+                    lo = _mm_add_epi16(lo,pair_sum(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r + 2 * i))));
+                    hi = _mm_add_epi16(hi,pair_sum(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r + 2 * i + 16))));
+                }
+                lo = _mm_srli_epi16(_mm_add_epi16(lo,round),3);
+                hi = _mm_srli_epi16(_mm_add_epi16(hi,round),3);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),_mm_packus_epi16(lo,hi));
+            }
+        }
+        else{
+            auto load_max = [&](int offset){
+                auto m01 = _mm_max_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + offset)),
+                                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + offset)));
+                auto m23 = _mm_max_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r2 + offset)),
+                                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(r3 + offset)));
+                auto m = _mm_max_epu8(m01,m23);
+                return _mm_max_epi16(_mm_and_si128(m,low_mask),_mm_srli_epi16(m,8));
+            };
+            for(; i + 16 <= count; i += 16){
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),_mm_packus_epi16(load_max(2 * i),load_max(2 * i + 16)));
+            }
+        }
+#endif
+        for(; i < count; i++){
+            int a = 2 * i,b = 2 * i + 1;
+            if(mode == AVERAGE){
+                int sum = r0[a] + r0[b] + r1[a] + r1[b] + r2[a] + r2[b] + r3[a] + r3[b];
+                dst[i] = static_cast<uint8_t>((sum + 4) >> 3);
+            }
+            else{
+                uint8_t m = (std::max)({r0[a],r0[b],r1[a],r1[b],r2[a],r2[b],r3[a],r3[b]});
+                dst[i] = m;
+            }
+        }
+    }
+
+    /**
+     * @brief 生成blockIndex的[z0,z1)这些z平面 sources为lod n-1中已经在内存中的块
+     * 子块必须都在sources中 邻居块可以缺失
+     */
+    static void DownsampleBlock(const Volume& volume,const BlockIndex& blockIndex,
+                                const std::unordered_map<BlockIndex,const uint8_t*>& sources,
+                                uint8_t* dst,Mode mode,int z0 = 0,int z1 = -1){
+        assert(blockIndex.w > 0);
+        const int block_length = volume.getBlockLength();
+        const int padding = volume.getBlockPadding();
+        const int nopad = volume.getBlockLengthWithoutPadding();
+        if(z1 < 0) z1 = block_length;
+        const auto lod_block_dim = VolumeHelper::ComputeLodVolumeBlockDim(volume,blockIndex.w - 1);
+
+        //父块每个轴上的局部坐标i对应lod n-1中的体素2g和2g+1 g = index * nopad + i - padding
+        //owner是包含这两个体素的块相对于第一个子块的偏移 范围是[-1,2]
+        //fallback是最近的子块 体素坐标截断到块内
+        struct AxisSample{
+            int owner;
+            int local;
+            int fallback;
+            int fallback_local0;
+            int fallback_local1;
+        };
+        auto compute_axis = [&](int index){
+            std::vector<AxisSample> samples(block_length);
+            for(int i = 0; i < block_length; i++){
+                int s = 2 * (index * nopad + i - padding);
+                int child = 2 * index;
+                auto& sample = samples[i];
+                sample.owner = (s >= 0 ? s / nopad : (s - nopad + 1) / nopad) - child;
+                sample.local = s - (child + sample.owner) * nopad + padding;
+                sample.fallback = (std::min)((std::max)(sample.owner,0),1);
+                int fl = s - (child + sample.fallback) * nopad + padding;
+                sample.fallback_local0 = (std::min)((std::max)(fl,0),block_length - 1);
+                sample.fallback_local1 = (std::min)((std::max)(fl + 1,0),block_length - 1);
+            }
+            return samples;
+        };
+        auto xs = compute_axis(blockIndex.x);
+        auto ys = compute_axis(blockIndex.y);
+        auto zs = compute_axis(blockIndex.z);
+
+        //nullptr表示块超出lod n-1的范围 全零
+        bool missing = false;
+        auto get_source = [&](int ox,int oy,int oz)->const uint8_t*{
+            auto child = GetChildBlockIndex(blockIndex,ox,oy,oz);
+            missing = false;
+            if(child.x < 0 || child.y < 0 || child.z < 0
+                || child.x >= lod_block_dim.x || child.y >= lod_block_dim.y || child.z >= lod_block_dim.z){
+                return nullptr;
+            }
+            auto it = sources.find(child);
+            if(it == sources.end()){
+                missing = true;
+                return nullptr;
+            }
+            return it->second;
+        };
+        const size_t row_size = block_length;
+        const size_t slice_size = row_size * block_length;
+        for(int k = z0; k < z1; k++){
+            for(int j = 0; j < block_length; j++){
+                uint8_t* dst_row = dst + k * slice_size + j * row_size;
+                const auto& sy = ys[j];
+                const auto& sz = zs[k];
+                int i = 0;
+                while(i < block_length){
+                    //x方向上owner相同的一段可以整体处理
+                    int i1 = i;
+                    while(i1 < block_length && xs[i1].owner == xs[i].owner) i1++;
+                    auto src = get_source(xs[i].owner,sy.owner,sz.owner);
+                    if(src){
+                        const uint8_t* rows[4];
+                        for(int dz = 0; dz < 2; dz++){
+                            for(int dy = 0; dy < 2; dy++){
+                                rows[dz * 2 + dy] = src + (sz.local + dz) * slice_size + (sy.local + dy) * row_size + xs[i].local;
+                            }
+                        }
+                        DownsampleRow(rows[0],rows[1],rows[2],rows[3],dst_row + i,i1 - i,mode);
+                    }
+                    else if(!missing){
+                        memset(dst_row + i,0,i1 - i);
+                    }
+                    else{
+                        src = get_source(xs[i].fallback,sy.fallback,sz.fallback);
+                        for(int ii = i; ii < i1; ii++){
+                            if(!src){
+                                dst_row[ii] = 0;
+                                continue;
+                            }
+                            const auto& sx = xs[ii];
+                            const uint8_t* rows[4];
+                            for(int dz = 0; dz < 2; dz++){
+                                for(int dy = 0; dy < 2; dy++){
+                                    int lz = dz ? sz.fallback_local1 : sz.fallback_local0;
+                                    int ly = dy ? sy.fallback_local1 : sy.fallback_local0;
+                                    rows[dz * 2 + dy] = src + lz * slice_size + ly * row_size;
+                                }
+                            }
+                            uint8_t tmp[4][2];
+                            for(int r = 0; r < 4; r++){
+                                tmp[r][0] = rows[r][sx.fallback_local0];
+                                tmp[r][1] = rows[r][sx.fallback_local1];
+                            }
+                            DownsampleRow(tmp[0],tmp[1],tmp[2],tmp[3],dst_row + ii,1,mode);
+                        }
+                    }
+                    i = i1;
+                }
+            }
+        }
+    }
+};
+
+MRAYNS_END
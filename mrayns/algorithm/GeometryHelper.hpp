@@ -4,6 +4,7 @@
 
 #pragma once
 #include "../geometry/Camera.hpp"
+#include <cmath>
 
 MRAYNS_BEGIN
 
@@ -184,6 +185,51 @@ struct GeometryHelper{
         return BoxVisibility::Intersecting;
     }
 
+    /**
+     * 基于分离轴定理的精确相交测试 slab与AABB都是凸的盒子 只需要测试15条轴
+     * 3条slab轴(法线方向的距离区间 以及切片空间中矩形的裁剪) 3条AABB轴 以及9条叉积轴
+     */
+    static BoxVisibility GetBoxVisibility(const SliceSlab& slab,const BoundBox& box){
+        const Vector3f slab_axis[3] = {slab.x_dir,slab.y_dir,slab.normal};
+        const float slab_half[3] = {slab.half_w,slab.half_h,slab.half_depth};
+        Vector3f box_center = (box.min_p + box.max_p) * 0.5f;
+        Vector3f box_half = (box.max_p - box.min_p) * 0.5f;
+        Vector3f t = slab.center - box_center;
+
+        auto box_radius = [&](const Vector3f& axis)->float{
+            return box_half.x * std::abs(axis.x) + box_half.y * std::abs(axis.y) + box_half.z * std::abs(axis.z);
+        };
+        auto slab_radius = [&](const Vector3f& axis)->float{
+            return slab_half[0] * std::abs(dot(slab_axis[0],axis))
+                 + slab_half[1] * std::abs(dot(slab_axis[1],axis))
+                 + slab_half[2] * std::abs(dot(slab_axis[2],axis));
+        };
+
+        //slab axes: distance interval to the slice plane and rect clip in slice space
+        bool fully_inside = true;
+        for(int i = 0; i < 3; i++){
+            float dist = std::abs(dot(t,slab_axis[i]));
+            float r = box_radius(slab_axis[i]);
+            if(dist > slab_half[i] + r) return BoxVisibility::Invisible;
+            if(dist + r > slab_half[i]) fully_inside = false;
+        }
+        //box axes
+        for(int j = 0; j < 3; j++){
+            if(std::abs(t[j]) > box_half[j] + slab_radius(Vector3f(j==0,j==1,j==2)))
+                return BoxVisibility::Invisible;
+        }
+        //cross axes, skip near parallel ones which are covered by the tests above
+        for(int j = 0; j < 3; j++){
+            for(int i = 0; i < 3; i++){
+                Vector3f axis = cross(Vector3f(j==0,j==1,j==2),slab_axis[i]);
+                if(dot(axis,axis) < 1e-6f) continue;
+                if(std::abs(dot(t,axis)) > box_radius(axis) + slab_radius(axis))
+                    return BoxVisibility::Invisible;
+            }
+        }
+        return fully_inside ? BoxVisibility::FullyVisible : BoxVisibility::Intersecting;
+    }
+
     static bool TestBoxValid(const BoundBox& box){
         return box.min_p.x <= box.max_p.x && box.min_p.y <= box.max_p.y && box.min_p.z <= box.max_p.z;
     }
@@ -0,0 +1,81 @@
+//
+// Created by wyz on 2022/5/30.
+//
+#pragma once
+#include "ColorMapping.hpp"
+#include "../core/VolumeBlockStatistics.hpp"
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+MRAYNS_BEGIN
+
+/**
+ * 块内的占用位图 由cell的min max和当前的传输函数计算 每一帧或者传输函数改变时更新
+ * 1表示cell内可能有不透明的体素 0表示可以直接跳过整个cell
+ * GPU和CPU渲染器使用相同的布局 cell的划分见VolumeBlockStatistics::CellRange
+ */
+struct OccupancyHelper{
+    static constexpr int CellsPerAxis = VolumeBlockStatistics::CellsPerAxis;
+    static constexpr int CellCount = VolumeBlockStatistics::CellCount;
+    static constexpr int WordCount = CellCount / 32;
+    static_assert(CellCount % 32 == 0,"");
+
+    struct Occupancy{
+        uint32_t bits[WordCount];
+    };
+
+    static int GetCellIndex(int cx,int cy,int cz){
+        return (cz * CellsPerAxis + cy) * CellsPerAxis + cx;
+    }
+
+    //没有cell统计信息的块必须全部标记为占用
+    static void FillOccupancy(Occupancy& occupancy,bool occupied){
+        std::memset(occupancy.bits,occupied ? 0xff : 0,sizeof(occupancy.bits));
+    }
+
+    /**
+     * @brief 传输函数线性插值的扩展由isTransparent处理 和块的剔除使用同样的判断
+     */
+    static void ComputeOccupancy(const VolumeBlockStatistics::CellRange& cellRange,
+                                 const TransferFunctionOpacityTable& opacityTable,
+                                 Occupancy& occupancy){
+        FillOccupancy(occupancy,false);
+        for(int i = 0; i < CellCount; i++){
+            if(!opacityTable.isTransparent(cellRange.min_value[i],cellRange.max_value[i])){
+                occupancy.bits[i / 32] |= 1u << (i % 32);
+            }
+        }
+    }
+
+    static bool IsOccupied(const Occupancy& occupancy,int cellIndex){
+        return (occupancy.bits[cellIndex / 32] >> (cellIndex % 32)) & 1u;
+    }
+
+    /**
+     * @param localPos 采样点在块内不含padding部分的归一化坐标[0,1)
+     */
+    static int GetCellIndex(const Vector3f& localPos){
+        auto cell = [](float v){
+            return (std::min)((std::max)(static_cast<int>(v * CellsPerAxis),0),CellsPerAxis - 1);
+        };
+        return GetCellIndex(cell(localPos.x),cell(localPos.y),cell(localPos.z));
+    }
+
+    /**
+     * @brief 光线从localPos沿着方向离开当前cell的距离 单位与localPos相同 用于DDA跳过空的cell
+     * @param invDir 方向的倒数 方向的分量为0时为inf
+     */
+    static float GetCellExitDistance(const Vector3f& localPos,const Vector3f& invDir){
+        constexpr float cell_length = 1.f / CellsPerAxis;
+        float t = std::numeric_limits<float>::max();
+        for(int i = 0; i < 3; i++){
+            float c = std::floor(localPos[i] * CellsPerAxis) * cell_length;
+            float bound = invDir[i] >= 0.f ? c + cell_length : c;
+            t = (std::min)(t,(bound - localPos[i]) * invDir[i]);
+        }
+        return (std::max)(t,0.f);
+    }
+};
+
+MRAYNS_END
@@ -0,0 +1,135 @@
+//
+// Created by wyz on 2022/5/31.
+//
+#pragma once
+#include "RenderHelper.hpp"
+#include "SliceHelper.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+MRAYNS_BEGIN
+
+/**
+ * 交互时用粗糙的质量渲染 停止交互idleMS之后逐级细化到完整质量
+ * 每一级的lod_bias和pixel_scale减半 直到0和1 细化时已经加载的块会继续使用 缺失的块由祖先块代替
+ * 细化中的帧有新的交互时应该中止 交互的帧不会被中止
+ * onInteraction可以在其它线程调用 其余函数只在渲染线程调用
+ */
+class ProgressiveRefinement{
+  public:
+    struct Level{
+        int lod_bias{0};//在正常lod的基础上增加的lod
+        int pixel_scale{1};//每个轴上的像素缩放 1为完整分辨率
+        bool isFull() const{
+            return lod_bias == 0 && pixel_scale == 1;
+        }
+    };
+
+    explicit ProgressiveRefinement(int interactiveLodBias = 2,int interactivePixelScale = 4,int idleMS = 150)
+    :interactive_level{(std::max)(interactiveLodBias,0),(std::max)(interactivePixelScale,1)},idle_ms(idleMS)
+    {}
+
+    void onInteraction(){
+        last_interaction_ms = nowMS();
+        interaction_count++;
+    }
+
+    bool isInteracting() const{
+        return nowMS() - last_interaction_ms.load() < idle_ms;
+    }
+
+    Level getLevel(int step) const{
+        return Level{interactive_level.lod_bias >> step,(std::max)(interactive_level.pixel_scale >> step,1)};
+    }
+
+    //从交互的级别细化到完整质量需要的帧数
+    int getRefineStepCount() const{
+        int step = 0;
+        while(!getLevel(step).isFull()) step++;
+        return step;
+    }
+
+    /**
+     * @brief 开始新的一帧 视图没有变化并且已经是完整质量时返回false 不需要再渲染
+     */
+    bool beginFrame(Level& level){
+        uint64_t count = interaction_count.load();
+        if(count != view_interaction_count){
+            view_interaction_count = count;
+            completed_step = -1;
+        }
+        frame_interaction_count = count;
+        if(isInteracting()){
+            frame_step = 0;
+        }
+        else{
+            if(completed_step >= getRefineStepCount()) return false;
+            frame_step = completed_step + 1;
+        }
+        level = getLevel(frame_step);
+        return true;
+    }
+
+    //细化的帧在开始之后有新的交互
+    bool shouldAbort() const{
+        return frame_step > 0 && interaction_count.load() != frame_interaction_count;
+    }
+
+    /**
+     * @param complete 异步加载时帧内有缺失的块 这一级需要在下一帧重新渲染
+     * @return 帧被中止时返回false 结果不应该显示
+     */
+    bool endFrame(bool complete = true){
+        if(shouldAbort()) return false;
+        if(complete){
+            completed_step = (std::max)(completed_step,frame_step);
+        }
+        return true;
+    }
+
+    /**
+     * @brief 缩小像素分辨率 每个像素覆盖更多的体素 结果在framebuffer的左上角
+     */
+    static SliceExt GetLevelSlice(const SliceExt& slice,const Level& level,int maxLod){
+        SliceExt ret = slice;
+        int s = level.pixel_scale;
+        ret.n_pixels_w = (std::max)(slice.n_pixels_w / s,1);
+        ret.n_pixels_h = (std::max)(slice.n_pixels_h / s,1);
+        ret.region.min_x = slice.region.min_x / s;
+        ret.region.min_y = slice.region.min_y / s;
+        ret.region.max_x = (std::min)(slice.region.max_x / s,ret.n_pixels_w - 1);
+        ret.region.max_y = (std::min)(slice.region.max_y / s,ret.n_pixels_h - 1);
+        ret.voxels_per_pixel = slice.voxels_per_pixel * static_cast<float>(s);
+        ret.lod = (std::min)(SliceHelper::GetSliceLod(ret) + level.lod_bias,maxLod);
+        return ret;
+    }
+
+    /**
+     * @brief VolumeRendererExt的framebuffer大小在创建时固定 所以用更大的步长代替缩小分辨率
+     * lod_dist按照放大后的屏幕误差重新计算 CPU求交和shader使用同一张表
+     */
+    static void ApplyLevelToCamera(const Volume& volume,VolumeRendererCamera& camera,const Level& level){
+        camera.raycasting_step *= static_cast<float>(level.pixel_scale);
+        float quality = RenderHelper::LodQuality / static_cast<float>((1 << level.lod_bias) * level.pixel_scale);
+        RenderHelper::GetScreenSpaceErrorLodDist(volume,camera,camera.lod_dist.lod_dist,volume.getMaxLod(),quality);
+    }
+
+  private:
+    static int64_t nowMS(){
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    Level interactive_level;
+    int64_t idle_ms;
+    std::atomic<int64_t> last_interaction_ms{0};
+    std::atomic<uint64_t> interaction_count{0};
+
+    uint64_t view_interaction_count{0};
+    uint64_t frame_interaction_count{0};
+    int completed_step{-1};
+    int frame_step{0};
+};
+
+MRAYNS_END
@@ -3,6 +3,8 @@
 //
 #pragma once
 #include "../core/Volume.hpp"
+#include "../geometry/Camera.hpp"
+#include <cmath>
 
 MRAYNS_BEGIN
 
@@ -21,6 +23,38 @@ struct RenderHelper{
         lod_dist[max_lod] = std::numeric_limits<float>::max();
     }
 
+    //全局的质量系数 负载高时可以调低 目标像素误差会按1/LodQuality放大
+    inline static float LodQuality = 1.f;
+    //一个体素投影到屏幕上的目标大小(像素)
+    inline static float TargetPixelError = 1.f;
+
+    /**
+     * 基于屏幕空间误差的lod距离表 与GetDefaultLodDist输出格式相同 CPU求交和shader的ComputeCurrentSampleLod共用
+     * lod i的体素大小为voxel * 2^i 在距离d处投影为 voxel * 2^i * height / (2 * d * tan(fovy/2)) 个像素
+     * 选择投影大小不超过目标误差的最粗lod 即 lod_dist[i]为lod i+1刚好满足误差的距离
+     * 距离是到lod0块中心计算的 额外加上半个块对角线保证块内任意采样点都满足误差
+     */
+    static void GetScreenSpaceErrorLodDist(const Volume& volume,
+                                           const Camera& camera,
+                                           float* lod_dist,
+                                           int max_lod,
+                                           float quality = LodQuality){
+        max_lod = (std::min)(max_lod,VolumeRendererLodDist::MaxLod - 1);
+        auto volume_space = volume.getVolumeSpace();
+        float voxel = (std::min)({volume_space.x,volume_space.y,volume_space.z});
+        auto virtual_block_length_space = volume_space * static_cast<float>(volume.getBlockLengthWithoutPadding());
+        float half_block_diag = length(virtual_block_length_space) * 0.5f;
+        //与GeometryHelper::ExtractProjMatrixFromCamera一致 投影矩阵的fovy为camera.fov * 0.5
+        float half_fovy = radians(camera.fov * 0.5f) * 0.5f;
+        float pixels_per_unit_dist = static_cast<float>(camera.height) / (2.f * std::tan(half_fovy));
+        float target = TargetPixelError / (std::max)(quality,0.01f);
+        for(int i = 0; i < max_lod; i++){
+            float coarser_voxel = voxel * static_cast<float>(1 << (i + 1));
+            lod_dist[i] = coarser_voxel * pixels_per_unit_dist / target + half_block_diag;
+        }
+        lod_dist[max_lod] = std::numeric_limits<float>::max();
+    }
+
 
 
 };
@@ -2,11 +2,14 @@
 // Created by wyz on 2022/4/13.
 //
 #include "SliceHelper.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <omp.h>
 MRAYNS_BEGIN
 
 
-void SliceHelper::UniformMergeSlice(const std::vector<SliceExt>& subSlices,std::vector<const Image*> subColors,Image& result)
+void SliceHelper::UniformMergeSlice(const std::vector<SliceExt>& subSlices,const std::vector<FramebufferView>& subColors,Image& result)
 {
 #ifndef NDEBUG
     bool ok = true;
@@ -19,30 +22,229 @@ void SliceHelper::UniformMergeSlice(const std::vector<SliceExt>& subSlices,std::
         }
     }
     assert(ok);
-    for(const auto img:subColors){
-        if(img->width() != w || img->height() != h){
+    assert(subSlices.size() == subColors.size());
+    for(int i = 0; i < subSlices.size(); i++){
+        const auto& region = subSlices[i].region;
+        const auto& img = subColors[i];
+        if(img.isValid() && (img.width != region.max_x - region.min_x + 1 || img.height != region.max_y - region.min_y + 1)){
             ok = false;
             break;
         }
     }
     assert(ok);
-    assert(subSlices.size() == subColors.size());
 #endif
 
     for(int i = 0; i < subSlices.size(); i++){
         const auto& slice = subSlices[i];
-        const auto img = subColors[i];
-        if(!img) continue;
+        const auto& img = subColors[i];
+        if(!img.isValid()) continue;
+        //子图像只包含region部分 按行拷贝到结果中
         int sx = slice.region.min_x;
         int sy = slice.region.min_y;
-        int dx = slice.region.max_x;
         int dy = slice.region.max_y;
-//#pragma omp parallel for
+        size_t row_bytes = static_cast<size_t>(slice.region.max_x - sx + 1) * sizeof(RGBA);
+#pragma omp parallel for
         for(int y = sy; y <= dy; y++){
-            for(int x = sx; x <= dx; x++){
-                result(x,y) = (*img)(x,y);
+            std::memcpy(&result(sx,y),&img(0,y - sy),row_bytes);
+        }
+    }
+}
+
+void SliceHelper::ResidencyAwareDivideSlice(const SliceExt& slice,const Volume& volume,int n,
+                                            const std::vector<Volume::BlockIndex>& blocks,
+                                            const BlockResidency& isResident,
+                                            std::vector<SliceExt>& subSlices,
+                                            const BlockCost& blockCost,
+                                            float uploadCost)
+{
+    const bool split_x = (slice.region.max_x - slice.region.min_x) >= (slice.region.max_y - slice.region.min_y);
+    const int r0 = split_x ? slice.region.min_x : slice.region.min_y;
+    const int length = (split_x ? slice.region.max_x : slice.region.max_y) - r0 + 1;
+    const int columns = (std::min)(length,ResidencyDivideMaxColumns);
+    if(n <= 1 || blocks.empty() || columns < n || !isResident){
+        UniformDivideSlice(slice,n,subSlices);
+        return;
+    }
+
+    //每个块投影到切分方向上覆盖的列[first,last]
+    struct BlockSpan{
+        int first;
+        int last;
+        float cost;
+    };
+    std::vector<BlockSpan> spans;
+    std::vector<size_t> span_blocks;
+    auto space = volume.getVolumeSpace();
+    float voxel = (std::min)({space.x,space.y,space.z});
+    float pixel_space = slice.voxels_per_pixel * voxel;
+    Vector3f axis = split_x ? slice.x_dir : slice.y_dir;
+    //与ExtractSliceSlabFromSliceExt的像素映射一致 y方向与y_dir相反
+    float sign = split_x ? 1.f : -1.f;
+    float center = (split_x ? slice.n_pixels_w : slice.n_pixels_h) * 0.5f - 0.5f;
+    for(size_t i = 0; i < blocks.size(); i++){
+        const auto& block = blocks[i];
+        Vector3f block_space = space * static_cast<float>(volume.getBlockLengthWithoutPadding() << block.w);
+        Vector3f box_min = Vector3f(block.x,block.y,block.z) * block_space;
+        float p_min = std::numeric_limits<float>::max();
+        float p_max = std::numeric_limits<float>::lowest();
+        for(int k = 0; k < 8; k++){
+            Vector3f corner = box_min + Vector3f(k & 1,(k >> 1) & 1,(k >> 2) & 1) * block_space;
+            float p = center + sign * dot(corner - slice.origin,axis) / pixel_space;
+            p_min = (std::min)(p_min,p);
+            p_max = (std::max)(p_max,p);
+        }
+        int first = static_cast<int>(std::floor((p_min - r0) * columns / length));
+        int last = static_cast<int>(std::floor((p_max - r0) * columns / length));
+        if(last < 0 || first >= columns) continue;
+        spans.push_back({(std::max)(first,0),(std::min)(last,columns - 1),blockCost ? blockCost(block) : 1.f});
+        span_blocks.push_back(i);
+    }
+    if(spans.empty()){
+        UniformDivideSlice(slice,n,subSlices);
+        return;
+    }
+
+    //条带[c0,c1]的代价 = 所有块 - 在c0之前结束的块 - 在c1之后开始的块
+    std::vector<std::vector<double>> end_before(n,std::vector<double>(columns + 1,0.0));
+    std::vector<std::vector<double>> start_after(n,std::vector<double>(columns + 1,0.0));
+    std::vector<double> total(n,0.0);
+    std::vector<double> resident_weight(n,0.0);
+    std::vector<double> resident_center(n,0.0);
+    for(int g = 0; g < n; g++){
+        auto& eb = end_before[g];
+        auto& sa = start_after[g];
+        for(size_t i = 0; i < spans.size(); i++){
+            const auto& span = spans[i];
+            bool resident = isResident(g,blocks[span_blocks[i]]);
+            double cost = span.cost * (resident ? 1.f : 1.f + uploadCost);
+            total[g] += cost;
+            eb[span.last + 1] += cost;
+            sa[span.first] += cost;
+            if(resident){
+                resident_weight[g] += span.cost;
+                resident_center[g] += span.cost * (span.first + span.last) * 0.5;
             }
         }
+        for(int c = 1; c <= columns; c++){
+            eb[c] += eb[c - 1];
+        }
+        //sa[c]为在c之后开始的块
+        double acc = 0.0;
+        for(int c = columns; c >= 0; c--){
+            double cur = sa[c];
+            sa[c] = acc;
+            acc += cur;
+        }
+    }
+    auto strip_cost = [&](int g,int c0,int c1){
+        return total[g] - end_before[g][c0] - start_after[g][c1];
+    };
+
+    //代价为(最大值,总和) 按字典序比较
+    struct Cost{
+        double max_cost;
+        double sum_cost;
+        bool operator<(const Cost& other) const{
+            if(max_cost != other.max_cost) return max_cost < other.max_cost;
+            return sum_cost < other.sum_cost;
+        }
+    };
+    const Cost inf_cost{std::numeric_limits<double>::max(),std::numeric_limits<double>::max()};
+    //每个GPU的条带为列[begin,end)
+    std::vector<int> strip_begin(n),strip_end(n);
+    if(n <= ResidencyDivideExactMaxCount){
+        //dp[mask][c] 用mask中的GPU覆盖前c列
+        const int mask_count = 1 << n;
+        std::vector<Cost> dp(static_cast<size_t>(mask_count) * (columns + 1),inf_cost);
+        std::vector<int> prev_c(dp.size(),-1),prev_g(dp.size(),-1);
+        auto at = [&](int mask,int c){ return static_cast<size_t>(mask) * (columns + 1) + c; };
+        dp[at(0,0)] = Cost{0.0,0.0};
+        for(int mask = 0; mask < mask_count; mask++){
+            int used = 0;
+            for(int g = 0; g < n; g++) used += (mask >> g) & 1;
+            for(int c = used; c <= columns - (n - used); c++){
+                const auto cur = dp[at(mask,c)];
+                if(cur.max_cost == inf_cost.max_cost) continue;
+                for(int g = 0; g < n; g++){
+                    if(mask & (1 << g)) continue;
+                    int next_mask = mask | (1 << g);
+                    //剩下的GPU每个至少需要一列
+                    int c1_max = columns - (n - used - 1);
+                    for(int c1 = c + 1; c1 <= c1_max; c1++){
+                        double cost = strip_cost(g,c,c1 - 1);
+                        Cost next{(std::max)(cur.max_cost,cost),cur.sum_cost + cost};
+                        auto idx = at(next_mask,c1);
+                        if(next < dp[idx]){
+                            dp[idx] = next;
+                            prev_c[idx] = c;
+                            prev_g[idx] = g;
+                        }
+                    }
+                }
+            }
+        }
+        int mask = mask_count - 1,c = columns;
+        while(mask){
+            auto idx = at(mask,c);
+            int g = prev_g[idx];
+            strip_begin[g] = prev_c[idx];
+            strip_end[g] = c;
+            c = prev_c[idx];
+            mask ^= 1 << g;
+        }
+    }
+    else{
+        //近似解 GPU按照常驻块的中心排序 没有常驻块的放在中间 然后只对切分位置做dp
+        std::vector<int> order(n);
+        std::vector<double> key(n);
+        for(int g = 0; g < n; g++){
+            order[g] = g;
+            key[g] = resident_weight[g] > 0.0 ? resident_center[g] / resident_weight[g] : columns * 0.5;
+        }
+        std::stable_sort(order.begin(),order.end(),[&](int a,int b){ return key[a] < key[b]; });
+        std::vector<Cost> dp(static_cast<size_t>(n + 1) * (columns + 1),inf_cost);
+        std::vector<int> prev_c(dp.size(),-1);
+        auto at = [&](int i,int c){ return static_cast<size_t>(i) * (columns + 1) + c; };
+        dp[at(0,0)] = Cost{0.0,0.0};
+        for(int i = 0; i < n; i++){
+            int g = order[i];
+            for(int c = i; c <= columns - (n - i); c++){
+                const auto cur = dp[at(i,c)];
+                if(cur.max_cost == inf_cost.max_cost) continue;
+                for(int c1 = c + 1; c1 <= columns - (n - i - 1); c1++){
+                    double cost = strip_cost(g,c,c1 - 1);
+                    Cost next{(std::max)(cur.max_cost,cost),cur.sum_cost + cost};
+                    auto idx = at(i + 1,c1);
+                    if(next < dp[idx]){
+                        dp[idx] = next;
+                        prev_c[idx] = c;
+                    }
+                }
+            }
+        }
+        int c = columns;
+        for(int i = n; i > 0; i--){
+            int g = order[i - 1];
+            strip_end[g] = c;
+            c = prev_c[at(i,c)];
+            strip_begin[g] = c;
+        }
+    }
+
+    subSlices.clear();
+    for(int g = 0; g < n; g++){
+        SliceExt sub_slice = slice;
+        int begin = r0 + strip_begin[g] * length / columns;
+        int end = r0 + strip_end[g] * length / columns - 1;
+        if(split_x){
+            sub_slice.region.min_x = begin;
+            sub_slice.region.max_x = end;
+        }
+        else{
+            sub_slice.region.min_y = begin;
+            sub_slice.region.max_y = end;
+        }
+        subSlices.emplace_back(sub_slice);
     }
 }
 
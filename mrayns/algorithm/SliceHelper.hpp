@@ -3,9 +3,13 @@
 //
 #pragma once
 #include "../core/Slice.hpp"
+#include "../core/Volume.hpp"
 #include "../geometry/Frustum.hpp"
 #include "../common/Image.hpp"
+#include "../core/Framebuffer.hpp"
 #include <cmath>
+#include <functional>
+#include <vector>
 
 MRAYNS_BEGIN
 
@@ -78,6 +82,27 @@ struct SliceHelper{
         }
     }
 
+    /**
+     * 与slice_render.frag中像素到体空间位置的映射保持一致
+     * 片元坐标以左上为原点 shader中uv.y = window.y*0.5 - y 所以region的y方向与y_dir相反
+     * 矩形覆盖region中首尾像素的中心 depth方向覆盖整个光线步进的区间
+     */
+    static void ExtractSliceSlabFromSliceExt(const SliceExt& slice,SliceSlab& slab,float voxel){
+        float pixel_space = slice.voxels_per_pixel * voxel;
+        float u0 = (float)slice.region.min_x + 0.5f - (float)slice.n_pixels_w * 0.5f;
+        float u1 = (float)slice.region.max_x + 0.5f - (float)slice.n_pixels_w * 0.5f;
+        float v0 = (float)slice.n_pixels_h * 0.5f - (float)slice.region.max_y - 0.5f;
+        float v1 = (float)slice.n_pixels_h * 0.5f - (float)slice.region.min_y - 0.5f;
+        slab.x_dir = slice.x_dir;
+        slab.y_dir = slice.y_dir;
+        slab.normal = slice.normal;
+        slab.center = slice.origin + slice.x_dir * (u0 + u1) * 0.5f * pixel_space
+                                   + slice.y_dir * (v0 + v1) * 0.5f * pixel_space;
+        slab.half_w = (u1 - u0) * 0.5f * pixel_space;
+        slab.half_h = (v1 - v0) * 0.5f * pixel_space;
+        slab.half_depth = slice.depth * 0.5f;
+    }
+
     static void UniformDivideSlice(const SliceExt& slice,int n,std::vector<SliceExt>& subSlices){
         if(n == 0) return;
         if(n == 1) {
@@ -111,7 +136,30 @@ struct SliceHelper{
             subSlices = std::move(top_slices);
         }
     }
-    static void UniformMergeSlice(const std::vector<SliceExt>& subSlices,std::vector<const Image*> subColors,Image& result);
+    using BlockResidency = std::function<bool(int gpu,const Volume::BlockIndex&)>;
+    using BlockCost = std::function<float(const Volume::BlockIndex&)>;
+    //GPU个数不超过这个值时求精确解 否则按照常驻块的位置固定GPU的顺序只求切分位置
+    inline static int ResidencyDivideExactMaxCount = 6;
+    //沿切分方向最多的候选列数
+    inline static int ResidencyDivideMaxColumns = 64;
+
+    /**
+     * @brief 沿region较长的方向切分为n个条带 第i个子切片分配给第i个GPU
+     * 块的代价为blockCost 不在该GPU中的块额外乘以(1+uploadCost) 最小化代价最大的GPU 相同时最小化总代价
+     * 块按照投影到切分方向上的像素范围计算与条带是否相交
+     * @param blocks 整个slice相交的块
+     * @param isResident 块是否已经在第gpu个GPU的页表中 包括正在上传的块
+     * @param blockCost 为空时每个块的代价都为1
+     */
+    static void ResidencyAwareDivideSlice(const SliceExt& slice,const Volume& volume,int n,
+                                          const std::vector<Volume::BlockIndex>& blocks,
+                                          const BlockResidency& isResident,
+                                          std::vector<SliceExt>& subSlices,
+                                          const BlockCost& blockCost = nullptr,
+                                          float uploadCost = 4.f);
+
+    //subColors是每个子切片region大小的图像 原点对应region的min 无效的图像跳过
+    static void UniformMergeSlice(const std::vector<SliceExt>& subSlices,const std::vector<FramebufferView>& subColors,Image& result);
 
 
 };
@@ -3,6 +3,8 @@
 //
 #pragma once
 #include "../core/Volume.hpp"
+#include <unordered_map>
+#include <algorithm>
 
 MRAYNS_BEGIN
 
@@ -83,6 +85,24 @@ struct VolumeHelper{
         block_center *= volume.getVolumeSpace() * b;
         return length(block_center-pos);
     }
+    /**
+     * 按照orderedBlocks中的先后顺序对blocks进行稳定排序 不在orderedBlocks中的块放在最后
+     * orderedBlocks一般是VolumeBlockTree返回的已经按优先级排序的相交块
+     */
+    static void SortBlocksByOrder(std::vector<BlockIndex>& blocks,const std::vector<BlockIndex>& orderedBlocks){
+        std::unordered_map<BlockIndex,size_t> order;
+        order.reserve(orderedBlocks.size());
+        for(size_t i = 0; i < orderedBlocks.size(); i++){
+            order.emplace(orderedBlocks[i],i);
+        }
+        auto get_order = [&](const BlockIndex& b){
+            auto it = order.find(b);
+            return it == order.end() ? orderedBlocks.size() : it->second;
+        };
+        std::stable_sort(blocks.begin(),blocks.end(),[&](const BlockIndex& a,const BlockIndex& b){
+            return get_order(a) < get_order(b);
+        });
+    }
 };
 
 
@@ -59,6 +59,13 @@ class Image{
     int width() const { return w; }
     int height() const { return h; }
     bool isValid() const{ return d;}
+    //只改变宽高不重新分配 w*h不能超过创建时的大小
+    void reshape(int w,int h){
+        if(w < 0 || h < 0 || w * h > s)
+            throw std::out_of_range("Image reshape out of capacity");
+        this->w = w;
+        this->h = h;
+    }
     void destroy(){
         w = h = s = 0;
         if(d){
@@ -9,6 +9,7 @@
 #include <vector>
 #include <queue>
 #include <future>
+#include <condition_variable>
 #include <thread>
 #include "../common/Define.hpp"
 
@@ -166,4 +167,80 @@ inline ThreadPool::~ThreadPool()
     {
         worker.join();
     }
-}
\ No newline at end of file
+}
+/**
+ * bounded blocking queue between pipeline stages, push waits while the queue is full.
+ * after close push returns false and pop returns false once the remaining items are taken.
+ */
+template <typename T>
+class BoundedQueue
+{
+  public:
+    explicit BoundedQueue(size_t capacity) : capacity((std::max)(capacity, size_t(1))), closed(false)
+    {
+    }
+
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mut);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed)
+        {
+            return false;
+        }
+        items.push(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mut);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty())
+        {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop();
+        notFull.notify_one();
+        return true;
+    }
+
+    bool tryPop(T &item)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if (items.empty())
+        {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop();
+        notFull.notify_one();
+        return true;
+    }
+
+    bool empty() const
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        return items.empty();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            closed = true;
+        }
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+  private:
+    std::queue<T> items;
+    mutable std::mutex mut;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    size_t capacity;
+    bool closed;
+};
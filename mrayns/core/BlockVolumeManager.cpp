@@ -7,6 +7,8 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <new>
 #include "../common/Logger.hpp"
 #include "../utils/Timer.hpp"
 #include "../common/LRU.hpp"
@@ -100,6 +102,10 @@ struct BlockVolumeManager::BlockVolumeManagerImpl{
 
         Lock lock;
         size_t t{0};
+        //部分解码的块只有[valid_z0,valid_z1)的z平面是有效的 需要完整数据时原地升级
+        bool partial{false};
+        int valid_z0{0};
+        int valid_z1{0};
         bool isLoaded() const{
             return index.isValid() && memory_block.data && memory_block.size>0;
         }
@@ -175,6 +181,9 @@ struct BlockVolumeManager::BlockVolumeManagerImpl{
         }
     }
 
+    //按页对齐 provider可以用direct io直接读入
+    static constexpr size_t MemoryBlockAlignment = 4096;
+
     BlockVolumeManagerImpl(){
         //todo
         memory_block_size = 512 * 512 *512;
@@ -182,7 +191,7 @@ struct BlockVolumeManager::BlockVolumeManagerImpl{
         for(int i = 0;i<memory_block_count;i++){
             MemoryBlockDesc desc;
             desc.memory_block.size = memory_block_size;
-            desc.memory_block.data = ::operator new(memory_block_size);
+            desc.memory_block.data = ::operator new(memory_block_size,std::align_val_t(MemoryBlockAlignment));
             //must set to zero !!!
             memset(desc.memory_block.data,0,desc.memory_block.size);
             free_mem_blocks.push(desc);
@@ -197,7 +206,7 @@ struct BlockVolumeManager::BlockVolumeManagerImpl{
         for(int i = 0;i<count;i++){
             MemoryBlockDesc desc;
             desc.memory_block.size = mem_block_size;
-            desc.memory_block.data = ::operator new(mem_block_size);
+            desc.memory_block.data = ::operator new(mem_block_size,std::align_val_t(MemoryBlockAlignment));
             free_mem_blocks.push(desc);
         }
     }
@@ -206,6 +215,11 @@ struct BlockVolumeManager::BlockVolumeManagerImpl{
         return ++count;
     }
 
+    size_t getFreeMemoryBlockCount(){
+        std::lock_guard<std::mutex> lk(free_mtx);
+        return free_mem_blocks.size();
+    }
+
     //从free_mem_blocks中获取一个数据块
     // 如果free_mem_blocks是空的 则返回一个非法的MemoryBlock
     //否则 一定会返回一个MemoryBlock 但是其原来可能存储着数据
@@ -238,6 +252,7 @@ struct BlockVolumeManager::BlockVolumeManagerImpl{
             free_mem_blocks.pop();
             mem.index = index;
             mem.t  = GetCurrentT();
+            mem.partial = false;
             assert(!mem.lock.isLocked());
             if(lockType == Lock::NONE){
                 free_mem_blocks.push(mem);
@@ -395,6 +410,13 @@ struct BlockVolumeManager::BlockVolumeManagerImpl{
         auto ret = queryMemoryBlockFromLocked(index);
         return ret.isLoaded() && ret.lock.isWriteLocked();
     }
+    //写锁释放后块可能变为读锁也可能回到free中 loading_cv只覆盖前者 因此轮询
+    void waitForBlockWriting(const BlockIndex& index){
+        while(isBlockMemoryWriting(index)){
+            std::unique_lock<std::mutex> lk(wait_mtx);
+            cv.wait_for(lk,std::chrono::milliseconds(1));
+        }
+    }
     //从free_mem_blocks和locked_mem_blocks中查询对应的Block 如果找到则返回对应的MemoryBlock并加指定的锁
     //如果没找到或者无法加锁 则返回一个非法的MemoryBlock
     //internal的函数是private的 一般不需要加锁 只需要在调用它们的public函数里加锁就行
@@ -567,6 +589,108 @@ struct BlockVolumeManager::BlockVolumeManagerImpl{
     }
 
 
+    /**
+     * @return -1 represent not find the memory block,
+     * 0 represent the block is partially valid but not cover [z0,z1) and 1 represent covered
+     */
+    int queryMemoryBlockCoverage(const BlockIndex& index,int z0,int z1){
+        auto covered = [z0,z1](const MemoryBlockDesc& desc){
+            return !desc.partial || (desc.valid_z0 <= z0 && z1 <= desc.valid_z1);
+        };
+        {
+            std::lock_guard<std::mutex> lk(locked_mtx);
+            auto p = _queryMemoryBlockFromLocked(index);
+            if(p && p->isLoaded()) return covered(*p) ? 1 : 0;
+        }
+        {
+            std::lock_guard<std::mutex> lk(free_mtx);
+            auto mem = queryMemoryBlockFromFree(index);
+            if(mem.isLoaded()) return covered(mem) ? 1 : 0;
+        }
+        return -1;
+    }
+    //must call while the block is write locked, before release the write lock
+    void setMemoryBlockValidRange(const BlockIndex& index,bool partial,int z0 = 0,int z1 = 0){
+        std::lock_guard<std::mutex> lk(locked_mtx);
+        auto p = _queryMemoryBlockFromLocked(index);
+        assert(p && p->lock.isWriteLocked());
+        if(!p) return;
+        if(!partial){
+            p->partial = false;
+            return;
+        }
+        //与原有的有效范围相交或相邻时合并 否则只保留新解码的范围
+        if(p->partial && p->valid_z0 < p->valid_z1 && z0 <= p->valid_z1 && p->valid_z0 <= z1){
+            p->valid_z0 = (std::min)(p->valid_z0,z0);
+            p->valid_z1 = (std::max)(p->valid_z1,z1);
+        }
+        else{
+            p->valid_z0 = z0;
+            p->valid_z1 = z1;
+        }
+        p->partial = true;
+    }
+    //provider加载失败的块 标记为没有有效数据 之后的请求会重新加载
+    void invalidateMemoryBlock(const BlockIndex& index){
+        std::lock_guard<std::mutex> lk(locked_mtx);
+        auto p = _queryMemoryBlockFromLocked(index);
+        assert(p && p->lock.isWriteLocked());
+        if(!p) return;
+        p->partial = true;
+        p->valid_z0 = p->valid_z1 = 0;
+    }
+    //把free中的块原地加上写锁 用于部分解码块的升级 块被读锁住时返回非法的MemoryBlock
+    MemoryBlock lockFreeMemoryBlockForWrite(const BlockIndex& index){
+        std::unique_lock<std::mutex> lk(free_mtx);
+        auto mem_desc = queryMemoryBlockFromFree(index);
+        if(!mem_desc.isLoaded()) return MemoryBlock{};
+        removeMemoryBlockDescInFree(mem_desc);
+        lk.unlock();
+        mem_desc.lock = Lock::WRITE_LOCK;
+        mem_desc.t = GetCurrentT();
+        std::lock_guard<std::mutex> lkk(locked_mtx);
+        appendMemoryBlockToLocked(mem_desc);
+        return mem_desc.memory_block;
+    }
+    using LodSources = std::unordered_map<BlockIndex,const uint8_t*>;
+    //给生成lod n+1块需要的lod n块加读锁 子块必须完整的在内存中 否则不加锁并返回false
+    //邻居块只在完整的在内存中时才使用 需要在getFreeMemoryBlock之前调用 否则子块可能被替换
+    //加锁后free中至少还要剩下reserve个块 否则之后的getFreeMemoryBlock可能一直等待
+    bool lockLodSourceBlocks(const Volume& volume,const BlockIndex& index,LodSources& sources,size_t reserve = 1){
+        std::vector<BlockIndex> blocks;
+        int child_count = DownsampleHelper::GetSourceBlocks(volume,index,blocks);
+        const int block_length = volume.getBlockLength();
+        for(int i = 0; i < child_count; i++){
+            if(queryMemoryBlockCoverage(blocks[i],0,block_length) != 1) return false;
+        }
+        sources.clear();
+        for(int i = 0; i < static_cast<int>(blocks.size()); i++){
+            if(i >= child_count && queryMemoryBlockCoverage(blocks[i],0,block_length) != 1) continue;
+            auto block = fetchMemoryBlock(Lock::READ_LOCK,blocks[i],false);
+            if(!block.isValid()){
+                if(i >= child_count) continue;
+                unlockLodSourceBlocks(sources);
+                sources.clear();
+                return false;
+            }
+            sources[blocks[i]] = reinterpret_cast<const uint8_t*>(block.data);
+        }
+        std::unique_lock<std::mutex> lk(free_mtx);
+        size_t free_count = free_mem_blocks.size();
+        lk.unlock();
+        if(free_count < reserve){
+            unlockLodSourceBlocks(sources);
+            sources.clear();
+            return false;
+        }
+        return true;
+    }
+    void unlockLodSourceBlocks(const LodSources& sources){
+        for(auto& source:sources){
+            reduceMemoryReadBlockLock(source.first,Lock::READ_LOCK);
+        }
+    }
+
   private:
     MemoryBlockDesc createMemoryBlockDesc(){
 
@@ -590,6 +714,33 @@ void BlockVolumeManager::setProvider(std::unique_ptr<IVolumeBlockProviderInterfa
     this->volume = this->provider->getVolume();
     assert(this->volume.isValid());
 }
+void BlockVolumeManager::setLodDerivation(bool enable,DownsampleHelper::Mode mode)
+{
+    lod_derivation = enable;
+    lod_derivation_mode = mode;
+}
+void BlockVolumeManager::setBlockStatistics(std::shared_ptr<VolumeBlockStatistics> statistics)
+{
+    block_statistics = std::move(statistics);
+}
+void BlockVolumeManager::recordBlockStatistics(const BlockIndex& blockIndex,const void* data)
+{
+    if(!block_statistics || volume.getVoxelType() != Volume::UINT8) return;
+    VolumeBlockStatistics::Statistics statistics;
+    if(!block_statistics->query(blockIndex,statistics)){
+        block_statistics->record(blockIndex,VolumeBlockStatistics::Compute(volume,data));
+    }
+    //sidecar文件中没有cell的统计 块解码后总是需要计算
+    if(!block_statistics->hasCellRange(blockIndex)){
+        auto cell_range = std::make_unique<VolumeBlockStatistics::CellRange>();
+        VolumeBlockStatistics::ComputeCellRange(volume,data,*cell_range);
+        block_statistics->recordCellRange(blockIndex,*cell_range);
+    }
+}
+bool BlockVolumeManager::isLodDerivable(const BlockIndex& blockIndex) const
+{
+    return lod_derivation && blockIndex.w > 0 && volume.getVoxelType() == Volume::UINT8;
+}
 void BlockVolumeManager::clear()
 {
 }
@@ -603,41 +754,93 @@ const Volume &BlockVolumeManager::getVolume() const
 }
 void *BlockVolumeManager::getVolumeBlock(const BlockIndex& blockIndex, bool sync)
 {
-    bool writing = impl->isBlockMemoryWriting(blockIndex);
-    if(writing && sync){
-        auto block = impl->fetchMemoryBlock(BlockVolumeManagerImpl::Lock::NONE,blockIndex,sync);
-        assert(block.isValid());
-        return block.data;
-    }
-    else if(writing){
-        LOG_DEBUG("block is writing: {} {} {} {}",blockIndex.x,blockIndex.y,blockIndex.z,blockIndex.w);
-        return nullptr;
-    }
+    return getVolumeBlockRange(blockIndex,0,volume.getBlockLength(),sync);
+}
+void *BlockVolumeManager::getVolumeBlockRange(const BlockIndex& blockIndex,int z0,int z1,bool sync)
+{
+    z0 = (std::max)(z0,0);
+    z1 = (std::min)(z1,volume.getBlockLength());
+    if(z0 >= z1) return nullptr;
+    bool whole = z0 == 0 && z1 == volume.getBlockLength();
+
     BlockVolumeManagerImpl::MemoryBlock block;
-    {
-        std::lock_guard<std::mutex> lk(get_mtx);
-        // 1. query from cache if the block data is already cached
-//        LOG_DEBUG("before fetch block: {} {} {} {}", blockIndex.x, blockIndex.y, blockIndex.z, blockIndex.w);
-         block = impl->fetchMemoryBlock(BlockVolumeManagerImpl::Lock::NONE, blockIndex, sync);
-//        LOG_DEBUG("after fetch block: {} {} {} {}", blockIndex.x, blockIndex.y, blockIndex.z, blockIndex.w);
-        if (block.isValid())
-        {
-            impl->recordPtrForBlockIndex(block.data, blockIndex);
-            LOG_DEBUG("record ptr for block: {} {} {} {}", blockIndex.x, blockIndex.y, blockIndex.z, blockIndex.w);
-            return block.data;
+    //lod n的子块都在内存中时由它们生成 不经过provider
+    BlockVolumeManagerImpl::LodSources lod_sources;
+    while(true){
+        bool writing = impl->isBlockMemoryWriting(blockIndex);
+        if(writing && sync){
+            //正在写入的可能是不覆盖请求范围的部分块 写入完成后重新检查
+            impl->waitForBlockWriting(blockIndex);
+            continue;
         }
-        if(impl->isBlockMemoryWriting(blockIndex)){
+        else if(writing){
+            LOG_DEBUG("block is writing: {} {} {} {}",blockIndex.x,blockIndex.y,blockIndex.z,blockIndex.w);
             return nullptr;
         }
-        // 2. if not cached, request data from provider
-        // 2.1 get free memory block buffer
-        block = impl->getFreeMemoryBlock(BlockVolumeManagerImpl::Lock::WRITE_LOCK, blockIndex);
+        {
+            std::lock_guard<std::mutex> lk(get_mtx);
+            // 0. partially decoded block not cover the request range, upgrade it in place
+            if(impl->queryMemoryBlockCoverage(blockIndex,z0,z1) == 0){
+                block = impl->lockFreeMemoryBlockForWrite(blockIndex);
+                if(block.isValid()){
+                    if(isLodDerivable(blockIndex)){
+                        impl->lockLodSourceBlocks(volume,blockIndex,lod_sources);
+                    }
+                    break;
+                }
+                if(!sync){
+                    LOG_DEBUG("partial block is locked and can't upgrade: {} {} {} {}",blockIndex.x,blockIndex.y,blockIndex.z,blockIndex.w);
+                    return nullptr;
+                }
+            }
+            else{
+                // 1. query from cache if the block data is already cached
+                block = impl->fetchMemoryBlock(BlockVolumeManagerImpl::Lock::NONE, blockIndex, false);
+                if (block.isValid())
+                {
+                    impl->recordPtrForBlockIndex(block.data, blockIndex);
+                    LOG_DEBUG("record ptr for block: {} {} {} {}", blockIndex.x, blockIndex.y, blockIndex.z, blockIndex.w);
+                    return block.data;
+                }
+                if(impl->isBlockMemoryWriting(blockIndex)){
+                    if(!sync) return nullptr;
+                    continue;
+                }
+                // 2. if not cached, derive from cached children or request data from provider
+                if(isLodDerivable(blockIndex)){
+                    impl->lockLodSourceBlocks(volume,blockIndex,lod_sources);
+                }
+                // 2.1 get free memory block buffer
+                block = impl->getFreeMemoryBlock(BlockVolumeManagerImpl::Lock::WRITE_LOCK, blockIndex);
+                break;
+            }
+        }
+        //部分块被读锁住 等读者释放后升级 等待时不持有get_mtx
+        std::unique_lock<std::mutex> wait_lk(impl->wait_mtx);
+        impl->cv.wait_for(wait_lk,std::chrono::milliseconds(1));
     }
 
 //2.2 if sync wait for complete or async return immediately
 //    LOG_INFO("4");
+    auto load = [this,whole,z0,z1,lod_sources](void* dst,const BlockIndex& blockIndex){
+        if(!lod_sources.empty()){
+            DownsampleHelper::DownsampleBlock(volume,blockIndex,lod_sources,reinterpret_cast<uint8_t*>(dst),lod_derivation_mode,z0,z1);
+            impl->unlockLodSourceBlocks(lod_sources);
+            impl->setMemoryBlockValidRange(blockIndex,!whole,z0,z1);
+            if(whole) recordBlockStatistics(blockIndex,dst);
+        }
+        else if(whole){
+            provider->getVolumeBlock(dst,blockIndex);
+            impl->setMemoryBlockValidRange(blockIndex,false);
+            recordBlockStatistics(blockIndex,dst);
+        }
+        else{
+            provider->getVolumeBlockRange(dst,blockIndex,z0,z1);
+            impl->setMemoryBlockValidRange(blockIndex,true,z0,z1);
+        }
+    };
     if(sync){
-        provider->getVolumeBlock(block.data,blockIndex);
+        load(block.data,blockIndex);
         bool ret = impl->changeMemoryBlockLock(BlockVolumeManagerImpl::Lock::NONE,blockIndex,true);
         assert(ret);
         impl->recordPtrForBlockIndex(block.data, blockIndex);
@@ -648,7 +851,7 @@ void *BlockVolumeManager::getVolumeBlock(const BlockIndex& blockIndex, bool sync
         //maybe a thread pool is a nice choice
         thread_pool.AppendTask([=](){
           LOG_INFO("start detach thread loading: {} {} {} {}",blockIndex.x,blockIndex.y,blockIndex.z,blockIndex.w);
-          provider->getVolumeBlock(block.data,blockIndex);
+          load(block.data,blockIndex);
           bool ret = impl->changeMemoryBlockLock(BlockVolumeManagerImpl::Lock::NONE,blockIndex,true);
           assert(ret);
           impl->recordPtrForBlockIndex(block.data, blockIndex);
@@ -658,31 +861,161 @@ void *BlockVolumeManager::getVolumeBlock(const BlockIndex& blockIndex, bool sync
         return nullptr;
     }
 }
-//该函数是同步的 会等待数据块加载完毕 因此对于writelock的数据块 它应该被知道 并且等待writelock的数据块加载完
-void *BlockVolumeManager::getVolumeBlockAndLock(const BlockIndex& blockIndex)
+std::vector<void*> BlockVolumeManager::getVolumeBlocks(const std::vector<BlockIndex>& blockIndices,bool sync)
 {
+    using BlockRequest = IVolumeBlockProviderInterface::BlockRequest;
+    std::vector<void*> ret(blockIndices.size(),nullptr);
+    std::vector<BlockRequest> requests;
+    std::unordered_map<void*,size_t> request_pos;
+    struct DeriveRequest{
+        BlockRequest request;
+        BlockVolumeManagerImpl::LodSources sources;
+    };
+    std::vector<DeriveRequest> derives;
 
-    if(impl->isBlockMemoryWriting(blockIndex)){
-        auto block = impl->fetchMemoryBlock(BlockVolumeManagerImpl::Lock::READ_LOCK, blockIndex, true);
-        assert(block.isValid());
-        impl->recordPtrForBlockIndex(block.data,blockIndex);
-        return block.data;
+    auto on_complete = [this](const BlockRequest& request,bool ok){
+        if(ok){
+            impl->setMemoryBlockValidRange(request.index,false);
+            recordBlockStatistics(request.index,request.dst);
+        }
+        else{
+            LOG_ERROR("provider load block failed: {} {} {} {}",request.index.x,request.index.y,request.index.z,request.index.w);
+            impl->invalidateMemoryBlock(request.index);
+        }
+        bool r = impl->changeMemoryBlockLock(BlockVolumeManagerImpl::Lock::NONE,request.index,true);
+        assert(r);
+        impl->recordPtrForBlockIndex(request.dst,request.index);
+    };
+    auto derive = [this,on_complete](const DeriveRequest& derive){
+        DownsampleHelper::DownsampleBlock(volume,derive.request.index,derive.sources,
+                                          reinterpret_cast<uint8_t*>(derive.request.dst),lod_derivation_mode);
+        impl->unlockLodSourceBlocks(derive.sources);
+        on_complete(derive.request,true);
+    };
+    //提交已经申请到内存的块 同步时等待它们加载完
+    auto submit = [&](){
+        LOG_INFO("submit {} blocks to provider in one batch, {} blocks derived from lod children",requests.size(),derives.size());
+        if(sync){
+            std::mutex ret_mtx;
+            if(!derives.empty()){
+                parallel_foreach(derives,[&](int,const DeriveRequest& request){
+                    derive(request);
+                    std::lock_guard<std::mutex> lk(ret_mtx);
+                    ret[request_pos.at(request.request.dst)] = request.request.dst;
+                });
+            }
+            if(!requests.empty()){
+                provider->getVolumeBlocks(requests,[&](const BlockRequest& request,bool ok){
+                    on_complete(request,ok);
+                    std::lock_guard<std::mutex> lk(ret_mtx);
+                    if(ok) ret[request_pos.at(request.dst)] = request.dst;
+                });
+            }
+        }
+        else{
+            for(auto& request:derives){
+                thread_pool.AppendTask([derive,request](){
+                    derive(request);
+                });
+            }
+            if(!requests.empty()){
+                thread_pool.AppendTask([this,requests,on_complete](){
+                    provider->getVolumeBlocks(requests,on_complete);
+                });
+            }
+        }
+        requests.clear();
+        derives.clear();
+        request_pos.clear();
+    };
+    //返回false表示没有空闲块了 这时不能在持有get_mtx时等待 因为还没有提交的块不会完成
+    auto prepare = [&](size_t i){
+        const auto& blockIndex = blockIndices[i];
+        if(impl->isBlockMemoryWriting(blockIndex)) return true;
+        BlockVolumeManagerImpl::MemoryBlock block;
+        BlockVolumeManagerImpl::LodSources lod_sources;
+        std::lock_guard<std::mutex> lk(get_mtx);
+        if(impl->queryMemoryBlockCoverage(blockIndex,0,volume.getBlockLength()) == 0){
+            block = impl->lockFreeMemoryBlockForWrite(blockIndex);
+            if(!block.isValid()) return true;
+        }
+        else{
+            block = impl->fetchMemoryBlock(BlockVolumeManagerImpl::Lock::NONE, blockIndex, false);
+            if(block.isValid()){
+                impl->recordPtrForBlockIndex(block.data, blockIndex);
+                ret[i] = block.data;
+                return true;
+            }
+            if(impl->isBlockMemoryWriting(blockIndex)) return true;
+            if(impl->getFreeMemoryBlockCount() == 0) return false;
+            if(isLodDerivable(blockIndex) && impl->lockLodSourceBlocks(volume,blockIndex,lod_sources)){
+                block = impl->getFreeMemoryBlock(BlockVolumeManagerImpl::Lock::WRITE_LOCK, blockIndex);
+                derives.push_back({{blockIndex,block.data,static_cast<float>(i)},std::move(lod_sources)});
+                request_pos[block.data] = i;
+                return true;
+            }
+            block = impl->getFreeMemoryBlock(BlockVolumeManagerImpl::Lock::WRITE_LOCK, blockIndex);
+        }
+        requests.push_back({blockIndex,block.data,static_cast<float>(i)});
+        request_pos[block.data] = i;
+        return true;
+    };
+    //缺失的块比空闲块多时分批提交 每批最多用完当前的空闲块
+    for(size_t i = 0; i < blockIndices.size(); i++){
+        if(prepare(i) || (requests.empty() && derives.empty())) continue;
+        submit();
+        //同步时这一批已经完成并释放了写锁 异步时剩下缺失的块留给之后的请求
+        if(sync) prepare(i);
     }
-
+    if(!requests.empty() || !derives.empty()){
+        submit();
+    }
+    if(sync){
+        //blocks loading by others, failed or no free memory, fall back to wait for single block
+        for(size_t i = 0; i < blockIndices.size(); i++){
+            if(!ret[i]){
+                ret[i] = getVolumeBlock(blockIndices[i],true);
+            }
+        }
+    }
+    return ret;
+}
+//该函数是同步的 会等待数据块加载完毕 因此对于writelock的数据块 它应该被知道 并且等待writelock的数据块加载完
+void *BlockVolumeManager::getVolumeBlockAndLock(const BlockIndex& blockIndex)
+{
     BlockVolumeManagerImpl::MemoryBlock block;
-    {
-        std::lock_guard<std::mutex> lk(get_mtx);
-        block = impl->fetchMemoryBlock(BlockVolumeManagerImpl::Lock::READ_LOCK, blockIndex, true);
-        if (block.isValid())
+    while(true){
+        //正在写入的可能是部分块 写入完成后按覆盖范围读锁或者升级 不能直接当作完整的块返回
+        impl->waitForBlockWriting(blockIndex);
         {
-            impl->recordPtrForBlockIndex(block.data, blockIndex);
-            return block.data;
+            std::lock_guard<std::mutex> lk(get_mtx);
+            if(impl->isBlockMemoryWriting(blockIndex)) continue;
+            if(impl->queryMemoryBlockCoverage(blockIndex,0,volume.getBlockLength()) == 0){
+                //partially decoded block, upgrade in place when no one reads it
+                block = impl->lockFreeMemoryBlockForWrite(blockIndex);
+                if(block.isValid()) break;
+            }
+            else{
+                //也包括等待期间部分块被替换的情况 重新申请空闲块
+                block = impl->fetchMemoryBlock(BlockVolumeManagerImpl::Lock::READ_LOCK, blockIndex, false);
+                if (block.isValid())
+                {
+                    impl->recordPtrForBlockIndex(block.data, blockIndex);
+                    return block.data;
+                }
+                block = impl->getFreeMemoryBlock(BlockVolumeManagerImpl::Lock::WRITE_LOCK, blockIndex);
+                break;
+            }
         }
-        block = impl->getFreeMemoryBlock(BlockVolumeManagerImpl::Lock::WRITE_LOCK, blockIndex);
+        //部分块被读锁住 等待时不持有get_mtx 其它线程的请求不受影响
+        std::unique_lock<std::mutex> wait_lk(impl->wait_mtx);
+        impl->cv.wait_for(wait_lk,std::chrono::milliseconds(1));
     }
 
     START_TIMER
     provider->getVolumeBlock(block.data,blockIndex);
+    impl->setMemoryBlockValidRange(blockIndex,false);
+    recordBlockStatistics(blockIndex,block.data);
 
     STOP_TIMER("get volume block");
 
@@ -3,10 +3,13 @@
 //
 #pragma once
 #include "Volume.hpp"
+#include "VolumeBlockStatistics.hpp"
 #include "../extension/VolumeBlockProviderInterface.hpp"
 #include <memory>
 #include <mutex>
+#include <vector>
 #include "../common/Parrallel.hpp"
+#include "../algorithm/DownsampleHelper.hpp"
 MRAYNS_BEGIN
 /**
  *
@@ -31,6 +34,17 @@ class BlockVolumeManager{
      */
     void init();
 
+    /**
+     * @brief when all lod n children of a lod n+1 block are cached, build it from them instead of the provider.
+     * Padding comes from cached neighbors of the children, only for uint8 volume.
+     */
+    void setLodDerivation(bool enable,DownsampleHelper::Mode mode = DownsampleHelper::AVERAGE);
+
+    /**
+     * @brief blocks fully loaded later will record their statistics if not recorded yet
+     */
+    void setBlockStatistics(std::shared_ptr<VolumeBlockStatistics> statistics);
+
     void clear();
 
     void destroy();
@@ -52,6 +66,19 @@ class BlockVolumeManager{
      */
     void* getVolumeBlock(const BlockIndex& blockIndex,bool sync = true);
 
+    /**
+     * @brief only z-planes in [z0,z1) of the returned block (with padding) are guaranteed valid,
+     * used for axis-aligned slice which only samples a few planes of each block.
+     * The block is recorded as partially valid and will be upgraded when the whole block is requested.
+     */
+    void* getVolumeBlockRange(const BlockIndex& blockIndex,int z0,int z1,bool sync = true);
+
+    /**
+     * @brief submit the missed blocks of a frame to the provider as one batch, blocks should be in priority order.
+     * @return ptr for each block, nullptr represent the block is loading or no empty memory to load it
+     */
+    std::vector<void*> getVolumeBlocks(const std::vector<BlockIndex>& blockIndices,bool sync = true);
+
     /**
      *
      */
@@ -73,6 +100,10 @@ class BlockVolumeManager{
   private:
     BlockVolumeManager();
 
+    bool isLodDerivable(const BlockIndex& blockIndex) const;
+
+    void recordBlockStatistics(const BlockIndex& blockIndex,const void* data);
+
     struct BlockVolumeManagerImpl;
     std::unique_ptr<BlockVolumeManagerImpl> impl;
     std::unique_ptr<IVolumeBlockProviderInterface> provider;
@@ -80,6 +111,11 @@ class BlockVolumeManager{
     std::mutex get_mtx;
     std::mutex lock_mtx;
 
+    bool lod_derivation{false};
+    DownsampleHelper::Mode lod_derivation_mode{DownsampleHelper::AVERAGE};
+
+    std::shared_ptr<VolumeBlockStatistics> block_statistics;
+
     ThreadPool thread_pool;
 };
 MRAYNS_END
\ No newline at end of file
@@ -0,0 +1,210 @@
+//
+// Created by wyz on 2022/6/3.
+//
+#include "FramePipelineExecutor.hpp"
+#include "../common/Logger.hpp"
+#include "../common/Parrallel.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+
+MRAYNS_BEGIN
+
+struct FramePipelineExecutor::Impl{
+    using Frame = RenderPipeline::Frame;
+
+    struct Job{
+        uint64_t id{0};
+        std::unique_ptr<Frame> frame;
+        uint64_t readback{0};
+    };
+
+    Impl(RenderPipeline& pipeline,int queueCapacity)
+    :pipeline(pipeline),request_queue(queueCapacity),prepared_queue(queueCapacity),result_queue(queueCapacity)
+    {
+        prepare_thread = std::thread(&Impl::prepareLoop,this);
+        render_thread = std::thread(&Impl::renderLoop,this);
+    }
+
+    uint64_t submit(std::unique_ptr<Frame> frame){
+        if(stopping){
+            throw std::runtime_error("FramePipelineExecutor submit after stop");
+        }
+        Job job;
+        job.id = ++submit_count;
+        job.frame = std::move(frame);
+        request_queue.push(std::move(job));
+        return submit_count;
+    }
+
+    //调用者取下一帧时释放上一次返回的结果
+    void releaseResults(){
+        std::lock_guard<std::mutex> lk(release_mtx);
+        released_count = acquired_count;
+        release_cv.notify_all();
+    }
+
+    /**
+     * @brief 读回缓冲是循环使用的 渲染第id帧会覆盖第id-lag帧的结果 需要等待调用者释放
+     * 不支持异步读回的渲染器结果就是framebuffer 下一帧渲染前上一帧必须已经释放
+     */
+    bool waitForRelease(uint64_t id){
+        uint64_t lag = readback_supported ? Renderer::ReadbackBufferCount : 1;
+        if(id <= lag) return !stopping;
+        std::unique_lock<std::mutex> lk(release_mtx);
+        release_cv.wait(lk,[&](){
+            return stopping || released_count >= id - lag;
+        });
+        return !stopping;
+    }
+
+    bool isReleased(uint64_t id){
+        uint64_t lag = readback_supported ? Renderer::ReadbackBufferCount : 1;
+        std::lock_guard<std::mutex> lk(release_mtx);
+        return id <= lag || released_count >= id - lag;
+    }
+
+    void prepareLoop(){
+        Job job;
+        while(request_queue.pop(job)){
+            if(stopping) continue;
+            pipeline.beginFrame(*job.frame);
+            pipeline.prepareFrame(*job.frame);
+            //prepared_queue只在这里关闭 停止时render线程会取完剩余的帧
+            prepared_queue.push(std::move(job));
+        }
+        prepared_queue.close();
+    }
+
+    void deliver(Job& job){
+        Result result;
+        result.id = job.id;
+        result.colors = pipeline.acquireFrame(*job.frame,job.readback);
+        result.complete = job.frame->complete;
+        result.timings = job.frame->timings;
+        result_queue.push(result);
+    }
+
+    void renderLoop(){
+        Job job;
+        Job pending;
+        bool has_pending = false;
+        while(prepared_queue.pop(job)){
+            //已经申请的页表项仍然需要上传后才能释放
+            if(stopping){
+                pipeline.discardFrame(*job.frame);
+                continue;
+            }
+            //等待之前先交出上一帧 避免调用者和render线程互相等待
+            if(has_pending && !isReleased(job.id)){
+                deliver(pending);
+                has_pending = false;
+            }
+            if(!waitForRelease(job.id)){
+                pipeline.discardFrame(*job.frame);
+                continue;
+            }
+            job.readback = pipeline.drawFrame(*job.frame);
+            if(!job.readback){
+                readback_supported = false;
+            }
+            if(has_pending){
+                deliver(pending);
+                has_pending = false;
+            }
+            //后面还有帧时 这一帧的读回在下一帧提交之后再等待
+            if(job.readback && !prepared_queue.empty()){
+                pending = std::move(job);
+                has_pending = true;
+            }
+            else{
+                deliver(job);
+            }
+        }
+        if(has_pending){
+            deliver(pending);
+        }
+        result_queue.close();
+    }
+
+    void stop(){
+        if(stopped) return;
+        stopped = true;
+        {
+            std::lock_guard<std::mutex> lk(release_mtx);
+            stopping = true;
+        }
+        release_cv.notify_all();
+        request_queue.close();
+        result_queue.close();
+        prepare_thread.join();
+        render_thread.join();
+        LOG_INFO("FramePipelineExecutor stopped after {} frames",submit_count);
+    }
+
+    RenderPipeline& pipeline;
+    BoundedQueue<Job> request_queue;
+    BoundedQueue<Job> prepared_queue;
+    BoundedQueue<Result> result_queue;
+    std::thread prepare_thread;
+    std::thread render_thread;
+
+    uint64_t submit_count{0};
+    uint64_t acquired_count{0};
+    bool stopped{false};
+
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> readback_supported{true};
+    std::mutex release_mtx;
+    std::condition_variable release_cv;
+    uint64_t released_count{0};
+};
+
+FramePipelineExecutor::FramePipelineExecutor(RenderPipeline& pipeline,int queueCapacity)
+{
+    impl = std::make_unique<Impl>(pipeline,queueCapacity);
+}
+
+FramePipelineExecutor::~FramePipelineExecutor()
+{
+    impl->stop();
+}
+
+uint64_t FramePipelineExecutor::submit(const SliceExt& slice,SliceRenderer::RenderType type){
+    if(!dynamic_cast<SliceRenderPipeline*>(&impl->pipeline)){
+        throw std::runtime_error("FramePipelineExecutor submit slice to non slice pipeline");
+    }
+    auto frame = std::make_unique<Impl::Frame>();
+    frame->slice = slice;
+    frame->render_type = type;
+    return impl->submit(std::move(frame));
+}
+
+uint64_t FramePipelineExecutor::submit(const VolumeRendererCamera& camera){
+    if(!dynamic_cast<VolumeRenderPipeline*>(&impl->pipeline)){
+        throw std::runtime_error("FramePipelineExecutor submit camera to non volume pipeline");
+    }
+    auto frame = std::make_unique<Impl::Frame>();
+    frame->camera = camera;
+    return impl->submit(std::move(frame));
+}
+
+bool FramePipelineExecutor::acquire(Result& result){
+    impl->releaseResults();
+    if(!impl->result_queue.pop(result)) return false;
+    impl->acquired_count++;
+    return true;
+}
+
+bool FramePipelineExecutor::tryAcquire(Result& result){
+    impl->releaseResults();
+    if(!impl->result_queue.tryPop(result)) return false;
+    impl->acquired_count++;
+    return true;
+}
+
+void FramePipelineExecutor::stop(){
+    impl->stop();
+}
+
+MRAYNS_END
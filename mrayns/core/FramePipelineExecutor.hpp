@@ -0,0 +1,67 @@
+//
+// Created by wyz on 2022/6/3.
+//
+#pragma once
+
+#include "RenderPipeline.hpp"
+#include <memory>
+
+MRAYNS_BEGIN
+
+/**
+ * @brief 帧间流水线执行RenderPipeline
+ * prepare线程求交并申请页表项 render线程上传 渲染并提交读回 调用者取读回的结果
+ * 第N+1帧求交和申请页表项时第N帧在上传和渲染 第N帧提交之后才等待第N-1帧的读回 拷贝和CPU的工作重叠
+ * 阶段之间是有界队列 队列满时前面的阶段等待 吞吐接近最慢的阶段而不是所有阶段之和
+ * 页表项在prepare时加锁 渲染后释放 页表容量不足时prepare会等待前面的帧释放
+ * 执行期间pipeline和它的渲染器只能由执行器使用 VolumeRendererExt的renderPass整个在render线程中
+ */
+class FramePipelineExecutor{
+  public:
+    //调用者在途(已经submit但还没有acquire)的帧数不能超过读回缓冲的数量 否则渲染会等待调用者释放结果
+    static constexpr int MaxFramesInFlight = Renderer::ReadbackBufferCount;
+
+    struct Result{
+        uint64_t id{0};
+        FramebufferView colors;
+        bool complete{true};
+        RenderPipeline::StageTimings timings;
+    };
+
+    /**
+     * @param queueCapacity 每两个阶段之间最多缓存的帧数
+     */
+    explicit FramePipelineExecutor(RenderPipeline& pipeline,int queueCapacity = 1);
+
+    ~FramePipelineExecutor();
+
+    /**
+     * @brief 队列满时等待 只能用于SliceRenderPipeline
+     * @return 帧的id 从1开始递增
+     */
+    uint64_t submit(const SliceExt& slice,SliceRenderer::RenderType type);
+
+    /**
+     * @brief 同上 只能用于VolumeRenderPipeline camera的lod_dist需要已经计算好
+     */
+    uint64_t submit(const VolumeRendererCamera& camera);
+
+    /**
+     * @brief 按照提交的顺序等待下一帧的结果 上一次返回的结果在调用时失效
+     * @return 执行器停止并且没有剩余的结果时返回false
+     */
+    bool acquire(Result& result);
+
+    bool tryAcquire(Result& result);
+
+    /**
+     * @brief 丢弃还没有渲染的帧并等待线程结束 之后不能再submit
+     */
+    void stop();
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+MRAYNS_END
@@ -32,4 +32,31 @@ class Framebuffer{
     Image depths;
 };
 
+/**
+ * @brief 不拥有内存的颜色结果 可以直接指向渲染器映射的读回缓冲 紧密排列
+ */
+struct FramebufferView{
+    const RGBA* colors{nullptr};
+    int width{0};
+    int height{0};
+
+    FramebufferView() = default;
+
+    FramebufferView(const RGBA* colors,int w,int h)
+    :colors(colors),width(w),height(h)
+    {}
+
+    explicit FramebufferView(const Image& image)
+    :colors(image.data()),width(image.width()),height(image.height())
+    {}
+
+    const RGBA& operator()(int x,int y) const noexcept{
+        return colors[y * width + x];
+    }
+    const RGBA* data() const{ return colors; }
+    int pitch() const { return sizeof(RGBA) * width; }
+    size_t size() const { return height * pitch(); }
+    bool isValid() const { return colors; }
+};
+
 MRAYNS_END
\ No newline at end of file
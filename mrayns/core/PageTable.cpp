@@ -11,6 +11,7 @@
 #include <cassert>
 #include "../common/Logger.hpp"
 #include "../common/LRU.hpp"
+#include "../algorithm/VolumeHelper.hpp"
 #include <unordered_set>
 MRAYNS_BEGIN
 
@@ -731,6 +732,26 @@ std::vector<PageTable::EntryItemExt> PageTable::queriesAndLockExt(const std::vec
 {
     return impl->queryItemsAndReadLock(values);
 }
+std::vector<PageTable::EntryItemExt> PageTable::queryAncestorsAndLockExt(const std::vector<ValueItem>& values,int maxLod)
+{
+    assert(IsAcquireLocked());
+    std::vector<EntryItemExt> ret;
+    std::unordered_set<ValueItem> found;
+    for(const auto& value:values){
+        for(int lod = value.w + 1; lod <= maxLod; lod++){
+            auto ancestor = VolumeHelper::GetLodBlockIndex(value,lod);
+            //已经找到的祖先块一定是缓存的 不需要再加锁
+            if(found.count(ancestor)) break;
+            auto items = impl->queryItemsAndReadLock({ancestor});
+            if(!items.empty() && items.front().cached){
+                found.insert(ancestor);
+                ret.emplace_back(items.front());
+                break;
+            }
+        }
+    }
+    return ret;
+}
 int PageTable::getAvailableCount()
 {
     return impl->getCacheCount();
@@ -76,6 +76,10 @@ class PageTable{
 
     std::vector<EntryItemExt> queriesAndLockExt(const std::vector<ValueItem>& );
 
+    //对每个值向上查找已经缓存的最近的祖先块并加读锁 用于缺失块的低分辨率替代
+    //相同的祖先块只返回并加锁一次 没有找到祖先的值不会出现在结果中
+    std::vector<EntryItemExt> queryAncestorsAndLockExt(const std::vector<ValueItem>& ,int maxLod);
+
     bool queryCached(const ValueItem&);
 
     EntryItemExt getEntryAndLock(const ValueItem&);
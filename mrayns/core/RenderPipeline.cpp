@@ -0,0 +1,499 @@
+//
+// Created by wyz on 2022/6/2.
+//
+#include "RenderPipeline.hpp"
+#include "../algorithm/GeometryHelper.hpp"
+#include "../algorithm/SliceHelper.hpp"
+#include "../algorithm/VolumeHelper.hpp"
+#include "../common/Logger.hpp"
+#include "../common/Parrallel.hpp"
+#include <limits>
+#include <queue>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+MRAYNS_BEGIN
+
+using Clock = std::chrono::steady_clock;
+
+static double ElapsedMS(const Clock::time_point& start){
+    return std::chrono::duration<double,std::milli>(Clock::now() - start).count();
+}
+
+RenderPipeline::RenderPipeline(VolumeBlockTree& volumeBlockTree,BlockVolumeManager& blockVolumeManager,GPUResource& gpuResource,
+                               Renderer* renderer)
+:volume_block_tree(volumeBlockTree),block_volume_manager(blockVolumeManager),gpu_resource(gpuResource),renderer(renderer),
+  volume(blockVolumeManager.getVolume())
+{
+    if(!renderer){
+        throw std::runtime_error("RenderPipeline with nullptr renderer");
+    }
+}
+
+void RenderPipeline::setMode(Mode mode){
+    this->mode = mode;
+}
+
+RenderPipeline::Mode RenderPipeline::getMode() const{
+    return mode;
+}
+
+void RenderPipeline::setDeadline(int ms){
+    deadline_ms = (std::max)(ms,0);
+}
+
+bool RenderPipeline::isFrameComplete() const{
+    return frame_complete;
+}
+
+const RenderPipeline::StageTimings& RenderPipeline::getStageTimings() const{
+    return timings;
+}
+
+void RenderPipeline::setBlockStatistics(std::shared_ptr<VolumeBlockStatistics> statistics){
+    block_statistics = std::move(statistics);
+    volume_block_tree.setBlockStatistics(block_statistics);
+    block_volume_manager.setBlockStatistics(block_statistics);
+    renderer->setBlockStatistics(block_statistics);
+}
+
+void RenderPipeline::setBlockStatistics(const std::string& sidecar){
+    setBlockStatistics(VolumeBlockStatistics::Load(volume,sidecar));
+}
+
+const std::shared_ptr<VolumeBlockStatistics>& RenderPipeline::getBlockStatistics() const{
+    return block_statistics;
+}
+
+void RenderPipeline::beginFrame(Frame& frame) const{
+    frame.deadline = Clock::now() + std::chrono::milliseconds(deadline_ms);
+}
+
+void RenderPipeline::discardFrame(Frame& frame){
+    uploadBlocks(frame,frame.page_result);
+    releaseBlocks(frame.page_result);
+}
+
+FramebufferView RenderPipeline::acquireFrame(Frame& frame,uint64_t readback){
+    auto start = Clock::now();
+    auto colors = renderer->acquireReadback(readback);
+    frame.timings.readback = ElapsedMS(start);
+    return colors;
+}
+
+FramebufferView RenderPipeline::runFrame(Frame& frame){
+    beginFrame(frame);
+    prepareFrame(frame);
+    auto colors = acquireFrame(frame,drawFrame(frame));
+    timings = frame.timings;
+    frame_complete = frame.complete;
+    return colors;
+}
+
+void RenderPipeline::prepareBlocks(Frame& frame,const std::vector<BlockIndex>& blocks,PageResult& result,bool fallbackToAncestor){
+    auto& page_table = gpu_resource.getPageTable();
+    auto start = Clock::now();
+
+    //截止时间之前等待缺失的块 不能在acquireLock期间等待 之后按照ASYNC处理
+    if(mode == DEADLINE){
+        std::vector<BlockIndex> pending_blocks;
+        for(const auto& block:blocks){
+            if(!page_table.query(block)) pending_blocks.emplace_back(block);
+        }
+        while(!pending_blocks.empty()){
+            auto ptrs = block_volume_manager.getVolumeBlocks(pending_blocks,false);
+            std::vector<BlockIndex> still_pending;
+            for(size_t i = 0; i < pending_blocks.size(); i++){
+                if(!ptrs[i]) still_pending.emplace_back(pending_blocks[i]);
+            }
+            pending_blocks.swap(still_pending);
+            if(pending_blocks.empty() || Clock::now() >= frame.deadline) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        frame.timings.load += ElapsedMS(start);
+        start = Clock::now();
+    }
+
+    //获取页表位置 acquireLock和acquireRelease之间对页表的操作是单线程的 不能有耗时的操作
+    page_table.acquireLock();
+
+    std::vector<BlockIndex> missed_blocks;
+    auto query_ret = page_table.queriesAndLockExt(blocks);
+    for(const auto& ret:query_ret){
+        if(ret.cached){
+            result.items.emplace_back(ret.entry,ret.value);
+        }
+        else{
+            missed_blocks.emplace_back(ret.value);
+        }
+    }
+
+    //异步时只有已经在内存中并且加锁成功的块才会上传 同步时上传线程中再等待解码
+    std::unordered_map<BlockIndex,void*> block_buffers;
+    std::vector<BlockIndex> unavailable_blocks;
+    if(mode != SYNC){
+        std::vector<BlockIndex> copy_missed_blocks;
+        copy_missed_blocks.swap(missed_blocks);
+        auto missed_block_ptrs = block_volume_manager.getVolumeBlocks(copy_missed_blocks,false);
+        for(size_t i = 0; i < copy_missed_blocks.size(); i++){
+            const auto& block = copy_missed_blocks[i];
+            auto p = missed_block_ptrs[i];
+            if(p && block_volume_manager.lock(p)){
+                missed_blocks.emplace_back(block);
+                block_buffers[block] = p;
+            }
+            else{
+                unavailable_blocks.emplace_back(block);
+            }
+        }
+    }
+
+    auto missed_block_entries = page_table.getEntriesAndLock(missed_blocks);
+    //不在内存中的块用页表中最近的祖先块代替 和其它块一起在渲染后释放
+    if(fallbackToAncestor && !unavailable_blocks.empty()){
+        auto ancestor_entries = page_table.queryAncestorsAndLockExt(unavailable_blocks,volume.getMaxLod());
+        for(const auto& entry:ancestor_entries){
+            result.items.emplace_back(entry.entry,entry.value);
+        }
+    }
+    page_table.acquireRelease();
+    assert(missed_block_entries.size() == missed_blocks.size());
+
+    //在queriesAndLockExt和getEntriesAndLock之间可能有正在被上传的数据块刚好上传完
+    std::vector<BlockIndex> upload_blocks;
+    for(const auto& entry:missed_block_entries){
+        if(!entry.cached){
+            upload_blocks.emplace_back(entry.value);
+            result.upload_entries[entry.value] = entry.entry;
+            if(mode != SYNC){
+                result.upload_buffers[entry.value] = block_buffers[entry.value];
+            }
+        }
+        else if(mode != SYNC){
+            block_volume_manager.unlock(block_buffers[entry.value]);
+        }
+        result.items.emplace_back(entry.entry,entry.value);
+    }
+    //按照相交块的优先级由近及远上传 工作线程按顺序取块
+    VolumeHelper::SortBlocksByOrder(upload_blocks,blocks);
+    result.upload_blocks.insert(result.upload_blocks.end(),upload_blocks.begin(),upload_blocks.end());
+    result.unavailable.insert(result.unavailable.end(),unavailable_blocks.begin(),unavailable_blocks.end());
+
+    frame.timings.page += ElapsedMS(start);
+    frame.timings.unavailable_block_count += static_cast<int>(unavailable_blocks.size());
+    if(!unavailable_blocks.empty()) frame.complete = false;
+}
+
+void RenderPipeline::uploadBlocks(Frame& frame,PageResult& result){
+    auto& page_table = gpu_resource.getPageTable();
+    auto start = Clock::now();
+
+    auto thread_id = std::this_thread::get_id();
+    auto tid = std::hash<decltype(thread_id)>()(thread_id);
+    const int block_length = volume.getBlockLength();
+
+    auto task = [&](int thread_idx,BlockIndex block_index){
+        void* p = mode == SYNC ? block_volume_manager.getVolumeBlockAndLock(block_index) : result.upload_buffers.at(block_index);
+        assert(p);
+        if(!p) return;
+        GPUResource::ResourceDesc desc{};
+        desc.id = tid;
+        desc.type = GPUResource::Texture;
+        desc.width = block_length;
+        desc.pitch = block_length;
+        desc.height = block_length;
+        desc.depth = block_length;
+        desc.size = volume.getBlockSize();
+        GPUResource::ResourceExtent extent{block_length,block_length,block_length};
+        auto ret = gpu_resource.uploadResource(desc,result.upload_entries.at(block_index),extent,p,volume.getBlockSize(),false);
+        assert(ret);
+        ret = block_volume_manager.unlock(p);
+        assert(ret);
+        page_table.update(block_index);
+    };
+    auto& upload_blocks = result.upload_blocks;
+    parallel_foreach(upload_blocks,task,(std::min)(static_cast<int>(upload_blocks.size()),actual_worker_count(0)));
+
+    gpu_resource.flush(tid);
+    frame.timings.upload += ElapsedMS(start);
+    frame.timings.upload_block_count += static_cast<int>(upload_blocks.size());
+
+    upload_blocks.clear();
+    result.upload_entries.clear();
+    result.upload_buffers.clear();
+}
+
+void RenderPipeline::pageBlocks(Frame& frame,const std::vector<BlockIndex>& blocks,PageResult& result,bool fallbackToAncestor){
+    prepareBlocks(frame,blocks,result,fallbackToAncestor);
+    uploadBlocks(frame,result);
+}
+
+void RenderPipeline::releaseBlocks(PageResult& result){
+    auto& page_table = gpu_resource.getPageTable();
+    for(const auto& item:result.items){
+        page_table.release(item.second);
+    }
+    result.items.clear();
+    result.unavailable.clear();
+}
+
+SliceRenderPipeline::SliceRenderPipeline(VolumeBlockTree& volumeBlockTree,BlockVolumeManager& blockVolumeManager,
+                                         GPUResource& gpuResource,SliceRenderer* sliceRenderer)
+:RenderPipeline(volumeBlockTree,blockVolumeManager,gpuResource,sliceRenderer),slice_renderer(sliceRenderer)
+{
+
+}
+
+FramebufferView SliceRenderPipeline::render(const SliceExt& slice,SliceRenderer::RenderType type){
+    Frame frame;
+    frame.slice = slice;
+    frame.render_type = type;
+    return runFrame(frame);
+}
+
+void SliceRenderPipeline::prepareFrame(Frame& frame){
+    auto start = Clock::now();
+    SliceSlab view_slab{};
+    SliceHelper::ExtractSliceSlabFromSliceExt(frame.slice,view_slab,volume.getVoxel());
+    frame.intersect_blocks = volume_block_tree.computeIntersectBlock(view_slab,frame.slice.lod);
+    frame.timings.intersect_block_count = static_cast<int>(frame.intersect_blocks.size());
+    frame.timings.cull = ElapsedMS(start);
+
+    prepareBlocks(frame,frame.intersect_blocks,frame.page_result,true);
+}
+
+uint64_t SliceRenderPipeline::drawFrame(Frame& frame){
+    auto& page_result = frame.page_result;
+    uploadBlocks(frame,page_result);
+
+    auto start = Clock::now();
+    slice_renderer->updatePageTable(page_result.items,page_result.unavailable);
+    slice_renderer->render(frame.slice,frame.render_type);
+    //拷贝在GPU上执行时释放页表项
+    auto readback = slice_renderer->submitReadback();
+    releaseBlocks(page_result);
+    frame.timings.render = ElapsedMS(start);
+    return readback;
+}
+
+SliceRenderer* SliceRenderPipeline::getRenderer() const{
+    return slice_renderer;
+}
+
+VolumeRenderPipeline::VolumeRenderPipeline(VolumeBlockTree& volumeBlockTree,BlockVolumeManager& blockVolumeManager,
+                                           GPUResource& gpuResource,VolumeRenderer* volumeRenderer)
+:RenderPipeline(volumeBlockTree,blockVolumeManager,gpuResource,volumeRenderer),volume_renderer(volumeRenderer),
+  volume_renderer_ext(dynamic_cast<VolumeRendererExt*>(volumeRenderer))
+{
+
+}
+
+void VolumeRenderPipeline::setTransferFunction(const TransferFunctionExt1D& tf){
+    transfer_function = tf;
+    has_transfer_function = true;
+    volume_renderer->setTransferFunction(tf);
+}
+
+bool VolumeRenderPipeline::isAborted() const{
+    return aborted;
+}
+
+VolumeRenderer* VolumeRenderPipeline::getRenderer() const{
+    return volume_renderer;
+}
+
+FramebufferView VolumeRenderPipeline::render(const VolumeRendererCamera& camera,const std::function<bool()>& shouldAbort){
+    Frame frame;
+    frame.camera = camera;
+    frame.should_abort = shouldAbort;
+    auto colors = runFrame(frame);
+    aborted = frame.aborted;
+    return colors;
+}
+
+void VolumeRenderPipeline::prepareFrame(Frame& frame){
+    auto start = Clock::now();
+    const auto& camera = frame.camera;
+    auto view_matrix = GeometryHelper::ExtractViewMatrixFromCamera(camera);
+    auto proj_matrix = GeometryHelper::ExtractProjMatrixFromCamera(camera);
+    FrustumExt view_frustum{};
+    GeometryHelper::ExtractViewFrustumPlanesFromMatrix(proj_matrix * view_matrix,view_frustum);
+    //返回的块已经按照优先级排序
+    //renderPass的着色器把不在页表中的块当作还没有加载 剔除的块需要在页表中标记为空 光线才会跳过
+    //旧的渲染器本来就跳过缺失的块
+    if(has_transfer_function){
+        frame.intersect_blocks = volume_block_tree.computeIntersectBlock(view_frustum,camera.lod_dist,camera.position,
+                                                                         transfer_function,frame.empty_blocks);
+    }
+    else{
+        frame.intersect_blocks = volume_block_tree.computeIntersectBlock(view_frustum,camera.lod_dist,camera.position);
+    }
+    frame.timings.intersect_block_count = static_cast<int>(frame.intersect_blocks.size());
+    frame.timings.cull = ElapsedMS(start);
+    LOG_INFO("volume render intersect block count: {}",frame.intersect_blocks.size());
+
+    //renderPass按批申请页表项 在drawFrame中进行
+    //旧的渲染器不支持祖先块代替 缺失的块直接跳过
+    if(!volume_renderer_ext){
+        prepareBlocks(frame,frame.intersect_blocks,frame.page_result,false);
+    }
+}
+
+uint64_t VolumeRenderPipeline::drawFrame(Frame& frame){
+    if(volume_renderer_ext){
+        renderPasses(frame);
+        return volume_renderer_ext->submitReadback();
+    }
+    auto& page_result = frame.page_result;
+    uploadBlocks(frame,page_result);
+
+    auto start = Clock::now();
+    volume_renderer->updatePageTable(page_result.items);
+    volume_renderer->render(frame.camera);
+    auto readback = volume_renderer->submitReadback();
+    releaseBlocks(page_result);
+    frame.timings.render = ElapsedMS(start);
+    return readback;
+}
+
+void VolumeRenderPipeline::renderPasses(Frame& frame){
+    const auto& camera = frame.camera;
+    const auto& intersectBlocks = frame.intersect_blocks;
+    if(intersectBlocks.empty()){
+        volume_renderer_ext->updatePageTable({},{},frame.empty_blocks);
+        volume_renderer_ext->renderPass(camera,true);
+        return;
+    }
+    //空块不需要加载 但是仍然参与BFS 否则被空块隔开的块不会按照由近及远的顺序渲染
+    std::unordered_set<BlockIndex> empty_blocks(frame.empty_blocks.begin(),frame.empty_blocks.end());
+    std::unordered_map<int,std::unordered_set<BlockIndex>> lod_intersect_blocks;
+    std::set<int> lods;
+    auto addIntersectBlock = [&](const BlockIndex& block){
+        assert(block.w >= 0);
+        lod_intersect_blocks[block.w].insert(block);
+        lods.insert(block.w);
+    };
+    for(const auto& block:intersectBlocks){
+        addIntersectBlock(block);
+    }
+    for(const auto& block:frame.empty_blocks){
+        addIntersectBlock(block);
+    }
+    std::queue<int> lods_q;
+    for(auto lod:lods){
+        lods_q.push(lod);
+    }
+    auto& page_table = gpu_resource.getPageTable();
+    std::set<BlockIndex> next_lod_working_blocks;
+    bool newFrame = true;
+    int min_lod = lods_q.front();
+    while(!lods_q.empty()){
+        int cur_lod = lods_q.front();
+        lods_q.pop();
+        int next_lod = lods_q.empty() ? -1 : lods_q.front();
+
+        auto& cur_lod_intersect_blocks = lod_intersect_blocks[cur_lod];
+        std::queue<BlockIndex> cur_working_blocks;
+        auto computeStartBlock = [&](){
+            float min_dist = std::numeric_limits<float>::max();
+            BlockIndex start_block;
+            for(const auto& b:cur_lod_intersect_blocks){
+                auto dist = VolumeHelper::ComputeDistanceToBlockCenter(volume,b,camera.position);
+                if(min_dist > dist){
+                    min_dist = dist;
+                    start_block = b;
+                }
+            }
+            assert(start_block.isValid());
+            cur_working_blocks.push(start_block);
+        };
+        if(cur_lod == min_lod && VolumeHelper::VolumeSpacePositionInsideVolume(volume,camera.position)){
+            cur_working_blocks.push(VolumeHelper::GetBlockIndexByVolumeSpacePosition(volume,camera.position,cur_lod));
+        }
+        else if(cur_lod == min_lod || next_lod_working_blocks.empty()){
+            computeStartBlock();
+        }
+        else{
+            for(const auto& b:next_lod_working_blocks){
+                cur_working_blocks.push(b);
+            }
+            next_lod_working_blocks.clear();
+        }
+
+        while(!cur_lod_intersect_blocks.empty()){
+            if(cur_working_blocks.empty()){
+                computeStartBlock();
+            }
+            std::vector<BlockIndex> working_blocks;
+            std::vector<BlockIndex> paging_blocks;
+            while(!cur_working_blocks.empty()){
+                cur_lod_intersect_blocks.erase(cur_working_blocks.front());
+                working_blocks.emplace_back(cur_working_blocks.front());
+                if(empty_blocks.count(cur_working_blocks.front()) == 0){
+                    paging_blocks.emplace_back(cur_working_blocks.front());
+                }
+                cur_working_blocks.pop();
+            }
+
+            //每一批不超过页表的可用数量 最后不足一批的块也要渲染
+            size_t batch_begin = 0;
+            while(batch_begin < paging_blocks.size()){
+                int batch_count = page_table.getAvailableCount();
+                if(batch_count == 0){
+                    throw std::runtime_error("page table not release correct");
+                }
+                size_t batch_end = (std::min)(paging_blocks.size(),batch_begin + batch_count);
+                std::vector<BlockIndex> batch_blocks(paging_blocks.begin() + batch_begin,paging_blocks.begin() + batch_end);
+                batch_begin = batch_end;
+                VolumeHelper::SortBlocksByOrder(batch_blocks,intersectBlocks);
+
+                PageResult page_result;
+                pageBlocks(frame,batch_blocks,page_result,true);
+
+                auto start = Clock::now();
+                volume_renderer_ext->updatePageTable(page_result.items,page_result.unavailable,frame.empty_blocks);
+                bool finished = volume_renderer_ext->renderPass(camera,newFrame);
+                newFrame = false;
+                releaseBlocks(page_result);
+                frame.timings.render += ElapsedMS(start);
+                if(finished && (next_lod != -1 || !cur_lod_intersect_blocks.empty() || batch_begin < paging_blocks.size())){
+                    //1.ray terminate early because of alpha > 0.99
+                    //2.view frustum space is bigger than ray cast space
+                    LOG_ERROR("renderPass return true but render is not finished!");
+                }
+                if(frame.should_abort && frame.should_abort()){
+                    LOG_INFO("abort render pass at lod {}",cur_lod);
+                    frame.aborted = true;
+                    frame.complete = false;
+                    return;
+                }
+            }
+
+            //下一批是这一批的邻居块 自身也加入以免漏掉下一个lod的块
+            std::set<BlockIndex> next_working_blocks;
+            for(const auto& block:working_blocks){
+                std::vector<BlockIndex> neighbor_blocks;
+                VolumeHelper::GetVolumeNeighborBlocks(volume,block,neighbor_blocks);
+                neighbor_blocks.emplace_back(block);
+                for(const auto& b:neighbor_blocks){
+                    if(cur_lod_intersect_blocks.count(b) == 1){
+                        next_working_blocks.insert(b);
+                    }
+                    if(next_lod == -1) continue;
+                    auto next_lod_b = VolumeHelper::GetLodBlockIndex(b,next_lod);
+                    if(lod_intersect_blocks[next_lod].count(next_lod_b) == 1){
+                        next_lod_working_blocks.insert(next_lod_b);
+                    }
+                }
+            }
+            for(const auto& b:next_working_blocks){
+                cur_working_blocks.push(b);
+            }
+        }
+        LOG_INFO("lod {} has finish renderPass",cur_lod);
+    }
+}
+
+MRAYNS_END
@@ -0,0 +1,234 @@
+//
+// Created by wyz on 2022/6/2.
+//
+#pragma once
+
+#include "BlockVolumeManager.hpp"
+#include "GPUResource.hpp"
+#include "VolumeBlockTree.hpp"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+MRAYNS_BEGIN
+
+/**
+ * 一帧的 求交->查询页表->加载->上传->渲染->读回 流程
+ * 一个pipeline对应一个渲染器 多个pipeline可以共用一个GPUResource 页表的并发由PageTable的acquireLock保证
+ * 同一个pipeline只能在一个线程中调用
+ */
+class RenderPipeline{
+  public:
+    using BlockIndex = Volume::BlockIndex;
+
+    enum Mode:int{
+        //帧内同步加载所有缺失的块 每一帧都是完整的
+        SYNC = 0,
+        //只上传已经在内存中的块 其余的块提交加载后由页表中的祖先块代替 之后的帧继续细化
+        ASYNC = 1,
+        //同ASYNC 但是在帧的截止时间之前等待缺失的块加载完成
+        DEADLINE = 2
+    };
+
+    /**
+     * @brief 最近一帧每个阶段的耗时 单位ms
+     * SYNC下解码和上传在同一批线程中交错进行 都计入upload
+     */
+    struct StageTimings{
+        double cull{0.0};
+        double page{0.0};
+        double load{0.0};
+        double upload{0.0};
+        double render{0.0};
+        double readback{0.0};
+        int intersect_block_count{0};
+        int upload_block_count{0};
+        int unavailable_block_count{0};
+        double total() const{
+            return cull + page + load + upload + render + readback;
+        }
+    };
+
+    virtual ~RenderPipeline() = default;
+
+    void setMode(Mode mode);
+
+    Mode getMode() const;
+
+    /**
+     * @brief DEADLINE模式下从帧开始求交算起的时间预算
+     */
+    void setDeadline(int ms);
+
+    /**
+     * @brief 最近一帧使用的块是否都已经上传 异步加载时为false 需要继续渲染同一个视图
+     */
+    bool isFrameComplete() const;
+
+    const StageTimings& getStageTimings() const;
+
+    /**
+     * @brief 块统计同时设置给求交 加载和渲染器 用于传输函数剔除和块内空区域跳过
+     */
+    void setBlockStatistics(std::shared_ptr<VolumeBlockStatistics> statistics);
+
+    /**
+     * @brief 打开离线生成的sidecar文件 见VolumeBlockStatistics::Load
+     * 为空或者与体数据不匹配时块在第一次完整解码后才有统计 之前不会被剔除
+     */
+    void setBlockStatistics(const std::string& sidecar);
+
+    const std::shared_ptr<VolumeBlockStatistics>& getBlockStatistics() const;
+
+  protected:
+    friend class FramePipelineExecutor;
+
+    RenderPipeline(VolumeBlockTree& volumeBlockTree,BlockVolumeManager& blockVolumeManager,GPUResource& gpuResource,
+                   Renderer* renderer);
+
+    //渲染期间持有读锁的页表项 渲染后由releaseBlocks释放
+    struct PageResult{
+        std::vector<Renderer::PageTableItem> items;
+        std::vector<BlockIndex> unavailable;
+        //已经申请到页表项等待上传的块 按照优先级排序 异步时对应的内存块已经加锁
+        std::vector<BlockIndex> upload_blocks;
+        std::unordered_map<BlockIndex,PageTable::EntryItem> upload_entries;
+        std::unordered_map<BlockIndex,void*> upload_buffers;
+    };
+
+    /**
+     * @brief 一帧的请求和各个阶段的中间结果 流水线执行时在线程之间传递
+     */
+    struct Frame{
+        SliceExt slice{};
+        SliceRenderer::RenderType render_type{SliceRenderer::MIP};
+        VolumeRendererCamera camera{};
+        std::function<bool()> should_abort;
+
+        std::vector<BlockIndex> intersect_blocks;
+        //被传输函数剔除的块 不加载 渲染器直接跳过
+        std::vector<BlockIndex> empty_blocks;
+        PageResult page_result;
+        StageTimings timings;
+        bool complete{true};
+        bool aborted{false};
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    void beginFrame(Frame& frame) const;
+
+    /**
+     * @brief 求交并申请页表项 不会使用渲染器 可以和前一帧的drawFrame同时执行
+     */
+    virtual void prepareFrame(Frame& frame) = 0;
+
+    /**
+     * @brief 上传 渲染 提交读回并释放页表项
+     * @return 读回的帧号 见Renderer::submitReadback
+     */
+    virtual uint64_t drawFrame(Frame& frame) = 0;
+
+    /**
+     * @brief 不渲染 只完成已经申请到页表项的上传并释放
+     */
+    void discardFrame(Frame& frame);
+
+    FramebufferView acquireFrame(Frame& frame,uint64_t readback);
+
+    //在当前线程中依次执行所有阶段
+    FramebufferView runFrame(Frame& frame);
+
+    /**
+     * @brief 查询页表 按照当前模式加载缺失的块并申请页表项 结果追加到result中 不能在渲染器中使用
+     * @param blocks 需要已经按照优先级排序 上传顺序与之相同
+     * @param fallbackToAncestor 不可用的块是否用页表中最近的祖先块代替
+     */
+    void prepareBlocks(Frame& frame,const std::vector<BlockIndex>& blocks,PageResult& result,bool fallbackToAncestor);
+
+    void uploadBlocks(Frame& frame,PageResult& result);
+
+    void pageBlocks(Frame& frame,const std::vector<BlockIndex>& blocks,PageResult& result,bool fallbackToAncestor);
+
+    void releaseBlocks(PageResult& result);
+
+    VolumeBlockTree& volume_block_tree;
+    BlockVolumeManager& block_volume_manager;
+    GPUResource& gpu_resource;
+    Renderer* renderer;
+    Volume volume;
+
+    std::shared_ptr<VolumeBlockStatistics> block_statistics;
+
+    Mode mode{SYNC};
+    int deadline_ms{33};
+    bool frame_complete{true};
+    StageTimings timings;
+};
+
+class SliceRenderPipeline: public RenderPipeline{
+  public:
+    SliceRenderPipeline(VolumeBlockTree& volumeBlockTree,BlockVolumeManager& blockVolumeManager,
+                        GPUResource& gpuResource,SliceRenderer* sliceRenderer);
+
+    /**
+     * @brief 只渲染slice.region部分 结果直接指向渲染器的读回缓冲
+     * 在之后第Renderer::ReadbackBufferCount次render之前有效
+     */
+    FramebufferView render(const SliceExt& slice,SliceRenderer::RenderType type);
+
+    SliceRenderer* getRenderer() const;
+
+  protected:
+    void prepareFrame(Frame& frame) override;
+
+    uint64_t drawFrame(Frame& frame) override;
+
+  private:
+    SliceRenderer* slice_renderer;
+};
+
+class VolumeRenderPipeline: public RenderPipeline{
+  public:
+    VolumeRenderPipeline(VolumeBlockTree& volumeBlockTree,BlockVolumeManager& blockVolumeManager,
+                         GPUResource& gpuResource,VolumeRenderer* volumeRenderer);
+
+    /**
+     * @brief 同时设置渲染器的传输函数 求交时剔除完全透明的块 剔除的块作为空块告诉渲染器
+     * 剔除依赖setBlockStatistics 没有sidecar时块在第一次完整解码后才能被剔除
+     */
+    void setTransferFunction(const TransferFunctionExt1D& tf);
+
+    /**
+     * @brief camera的lod_dist需要由调用者计算好 求交和渲染使用同一张表
+     * VolumeRendererExt按照lod由小到大 每个lod内从视点所在的块开始BFS 每一批不超过页表的可用数量 逐批renderPass
+     * 其它渲染器一次上传所有相交的块后render
+     * @param shouldAbort 每一批renderPass之后调用 返回true时中止这一帧 流水线执行时不会调用
+     */
+    FramebufferView render(const VolumeRendererCamera& camera,const std::function<bool()>& shouldAbort = nullptr);
+
+    /**
+     * @brief 最近一帧是否被shouldAbort中止 中止的帧不完整
+     */
+    bool isAborted() const;
+
+    VolumeRenderer* getRenderer() const;
+
+  protected:
+    void prepareFrame(Frame& frame) override;
+
+    uint64_t drawFrame(Frame& frame) override;
+
+  private:
+    void renderPasses(Frame& frame);
+
+    VolumeRenderer* volume_renderer;
+    VolumeRendererExt* volume_renderer_ext;
+    TransferFunctionExt1D transfer_function{};
+    bool has_transfer_function{false};
+    bool aborted{false};
+};
+
+MRAYNS_END
@@ -10,6 +10,8 @@
 #include "PageTable.hpp"
 MRAYNS_BEGIN
 
+class VolumeBlockStatistics;
+
 struct TransferFunction{
     using Point = std::pair<float,Vector4f>;
     std::vector<Point> points;
@@ -40,11 +42,47 @@ class Renderer{
 
     virtual const Framebuffer& getFrameBuffers() const = 0;
 
+    //同时在途的读回帧数 流水线执行时一帧在显示 一帧等待读回 一帧在渲染
+    static constexpr int ReadbackBufferCount = 3;
+    /**
+     * @brief 异步读回最近一次render的颜色结果 提交拷贝后立即返回帧号 0表示不支持
+     * 超过ReadbackBufferCount帧在途时会先等待最早的一帧
+     */
+    virtual uint64_t submitReadback(){ return 0; }
+    /**
+     * @brief 等待帧号对应的读回完成 返回映射内存中的结果 不做额外的拷贝
+     * 结果在之后第ReadbackBufferCount次submitReadback之前有效 frame为0时同步读回
+     */
+    virtual FramebufferView acquireReadback(uint64_t frame){
+        return FramebufferView(getFrameBuffers().getColors());
+    }
+
     //not necessary for slice render
     virtual void setTransferFunction(const TransferFunction&) {};
 
     using PageTableItem = std::pair<PageTable::EntryItem,PageTable::ValueItem>;
     virtual void updatePageTable(const std::vector<PageTableItem>&){}
+    /**
+     * @brief missedBlocks是需要但不在内存中的块 渲染器用items中最近的祖先块代替 在祖先块的lod上采样
+     * 不支持的渲染器忽略missedBlocks
+     */
+    virtual void updatePageTable(const std::vector<PageTableItem>& items,const std::vector<PageTable::ValueItem>& missedBlocks){
+        updatePageTable(items);
+    }
+    /**
+     * @brief emptyBlocks是在当前传输函数下完全透明而没有加载的块 光线直接跳过它们
+     * 不支持的渲染器忽略emptyBlocks 这样的渲染器不能使用剔除后的求交结果 除非缺失的块本来就会被跳过
+     */
+    virtual void updatePageTable(const std::vector<PageTableItem>& items,const std::vector<PageTable::ValueItem>& missedBlocks,
+                                 const std::vector<PageTable::ValueItem>& emptyBlocks){
+        updatePageTable(items,missedBlocks);
+    }
+
+    /**
+     * @brief 使用块内cell的统计信息和传输函数跳过空区域 不支持的渲染器可以忽略
+     * 没有统计信息的块按照全部占用处理
+     */
+    virtual void setBlockStatistics(std::shared_ptr<VolumeBlockStatistics>){}
 
 };
 
@@ -72,6 +110,8 @@ class SliceRenderer: public Renderer{
      * can perform a raycast render.
      * @note if choose caycast render type, called should set transfer function first,
      * and raycast is not suitable for slice with large depth because of fixed lod policy.
+     * @note 只绘制和读回slice.region部分 getFrameBuffers返回region大小的紧密排列的图像
+     * 图像的(0,0)对应region的(min_x,min_y)
      */
     virtual void render(const SliceExt& slice,RenderType type){}
 
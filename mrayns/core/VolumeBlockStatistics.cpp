@@ -0,0 +1,398 @@
+//
+// Created by wyz on 2022/5/29.
+//
+#include "VolumeBlockStatistics.hpp"
+#include "../algorithm/VolumeHelper.hpp"
+#include "../common/Logger.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#ifdef WINDOWS
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MRAYNS_BEGIN
+
+struct VolumeBlockStatistics::Impl{
+    static constexpr char Magic[8] = {'M','R','A','Y','S','T','A','\0'};
+    static constexpr uint32_t Version = 1;
+
+    //[Header][lod 0的统计表]...[lod max_lod的统计表] 每个lod按照 x y z 的顺序存储
+    struct Header{
+        char magic[8];
+        uint32_t version;
+        uint32_t histogram_bins;
+        int32_t block_length;
+        int32_t padding;
+        int32_t dim_x,dim_y,dim_z;
+        int32_t max_lod;
+        uint64_t entry_count;
+        uint64_t entry_offset;
+    };
+
+    Header header{};
+    std::vector<Vector3i> lod_block_dims;
+    std::vector<size_t> lod_base;
+    //create时使用owned 打开文件时指向映射的内存
+    std::vector<Statistics> owned;
+    Statistics* entries{nullptr};
+    std::unordered_map<BlockIndex,std::unique_ptr<CellRange>> cell_ranges;
+    mutable std::shared_mutex mtx;
+
+#ifdef WINDOWS
+    HANDLE file{INVALID_HANDLE_VALUE};
+    HANDLE mapping{nullptr};
+#else
+    int fd{-1};
+#endif
+    void* mapped{nullptr};
+    size_t mapped_size{0};
+
+    ~Impl(){
+        close();
+    }
+
+    void setup(const Volume& volume){
+        lod_block_dims.clear();
+        lod_base.clear();
+        size_t count = 0;
+        for(int lod = 0; lod <= header.max_lod; lod++){
+            auto dim = VolumeHelper::ComputeLodVolumeBlockDim(volume,lod);
+            lod_block_dims.emplace_back(dim);
+            lod_base.emplace_back(count);
+            count += static_cast<size_t>(dim.x) * dim.y * dim.z;
+        }
+        header.entry_count = count;
+    }
+
+    static Volume GetHeaderVolume(const Header& header){
+        Volume volume;
+        volume.block_length = header.block_length;
+        volume.padding = header.padding;
+        volume.volume_dim_x = header.dim_x;
+        volume.volume_dim_y = header.dim_y;
+        volume.volume_dim_z = header.dim_z;
+        volume.max_lod = header.max_lod;
+        return volume;
+    }
+
+    //越界返回-1
+    int64_t getEntryIndex(const BlockIndex& index) const{
+        if(!entries || index.w < 0 || index.w > header.max_lod) return -1;
+        const auto& dim = lod_block_dims[index.w];
+        if(index.x < 0 || index.y < 0 || index.z < 0 || index.x >= dim.x || index.y >= dim.y || index.z >= dim.z) return -1;
+        return static_cast<int64_t>(lod_base[index.w] + (static_cast<size_t>(index.z) * dim.y + index.y) * dim.x + index.x);
+    }
+
+    void create(const Volume& volume){
+        close();
+        std::memcpy(header.magic,Magic,sizeof(Magic));
+        header.version = Version;
+        header.histogram_bins = HistogramBins;
+        header.block_length = volume.getBlockLength();
+        header.padding = volume.getBlockPadding();
+        volume.getVolumeDim(header.dim_x,header.dim_y,header.dim_z);
+        header.max_lod = volume.getMaxLod();
+        header.entry_offset = sizeof(Header);
+        setup(volume);
+        owned.assign(header.entry_count,Statistics{});
+        entries = owned.data();
+    }
+
+    void open(const std::string& filename,const Volume& volume){
+        close();
+#ifdef WINDOWS
+        file = CreateFileA(filename.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,FILE_FLAG_RANDOM_ACCESS,nullptr);
+        if(file == INVALID_HANDLE_VALUE){
+            throw std::runtime_error("open block statistics file failed: " + filename);
+        }
+        LARGE_INTEGER size;
+        GetFileSizeEx(file,&size);
+        mapped_size = static_cast<size_t>(size.QuadPart);
+        mapping = CreateFileMappingA(file,nullptr,PAGE_WRITECOPY,0,0,nullptr);
+        if(!mapping){
+            throw std::runtime_error("create block statistics file mapping failed");
+        }
+        mapped = MapViewOfFile(mapping,FILE_MAP_COPY,0,0,0);
+#else
+        fd = ::open(filename.c_str(),O_RDONLY);
+        if(fd < 0){
+            throw std::runtime_error("open block statistics file failed: " + filename);
+        }
+        struct stat st{};
+        fstat(fd,&st);
+        mapped_size = static_cast<size_t>(st.st_size);
+        //写时复制 record只修改进程内的副本
+        mapped = mapped_size ? mmap(nullptr,mapped_size,PROT_READ | PROT_WRITE,MAP_PRIVATE,fd,0) : nullptr;
+        if(mapped == MAP_FAILED) mapped = nullptr;
+#endif
+        if(!mapped){
+            throw std::runtime_error("map block statistics file failed");
+        }
+        if(mapped_size < sizeof(Header)){
+            throw std::runtime_error("invalid block statistics file");
+        }
+        std::memcpy(&header,mapped,sizeof(Header));
+        if(std::memcmp(header.magic,Magic,sizeof(Magic)) != 0 || header.version != Version
+            || header.histogram_bins != HistogramBins){
+            throw std::runtime_error("not a supported block statistics file");
+        }
+        //其它数据的sidecar会错误的剔除块
+        int dim_x,dim_y,dim_z;
+        volume.getVolumeDim(dim_x,dim_y,dim_z);
+        if(header.block_length != volume.getBlockLength() || header.padding != volume.getBlockPadding()
+            || header.dim_x != dim_x || header.dim_y != dim_y || header.dim_z != dim_z
+            || header.max_lod != volume.getMaxLod()){
+            throw std::runtime_error("block statistics file does not match the volume: " + filename);
+        }
+        auto entry_count = header.entry_count;
+        setup(GetHeaderVolume(header));
+        if(entry_count != header.entry_count
+            || header.entry_offset + header.entry_count * sizeof(Statistics) > mapped_size){
+            throw std::runtime_error("block statistics file is incomplete");
+        }
+        entries = reinterpret_cast<Statistics*>(reinterpret_cast<uint8_t*>(mapped) + header.entry_offset);
+        LOG_INFO("open block statistics file {}, entry count {}",filename,header.entry_count);
+    }
+
+    void close(){
+        entries = nullptr;
+        owned.clear();
+        cell_ranges.clear();
+#ifdef WINDOWS
+        if(mapped) UnmapViewOfFile(mapped);
+        if(mapping) CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if(mapped) munmap(mapped,mapped_size);
+        if(fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        mapped = nullptr;
+        mapped_size = 0;
+    }
+};
+
+VolumeBlockStatistics::VolumeBlockStatistics()
+{
+    impl = std::make_unique<Impl>();
+}
+
+VolumeBlockStatistics::~VolumeBlockStatistics()
+{
+}
+
+void VolumeBlockStatistics::create(const Volume &volume)
+{
+    std::unique_lock<std::shared_mutex> lk(impl->mtx);
+    impl->create(volume);
+}
+
+void VolumeBlockStatistics::open(const std::string &filename,const Volume &volume)
+{
+    std::unique_lock<std::shared_mutex> lk(impl->mtx);
+    try{
+        impl->open(filename,volume);
+    }
+    catch(...){
+        impl->close();
+        throw;
+    }
+}
+
+std::shared_ptr<VolumeBlockStatistics> VolumeBlockStatistics::Load(const Volume &volume,const std::string &filename)
+{
+    auto statistics = std::make_shared<VolumeBlockStatistics>();
+    if(!filename.empty()){
+        try{
+            statistics->open(filename,volume);
+            return statistics;
+        }
+        catch(const std::exception& err){
+            LOG_ERROR("{}, record block statistics after decoding instead",err.what());
+        }
+    }
+    statistics->create(volume);
+    return statistics;
+}
+
+void VolumeBlockStatistics::save(const std::string &filename) const
+{
+    std::shared_lock<std::shared_mutex> lk(impl->mtx);
+    if(!impl->entries){
+        throw std::runtime_error("save empty block statistics");
+    }
+    std::ofstream out(filename,std::ios::binary);
+    if(!out.is_open()){
+        throw std::runtime_error("open block statistics file failed: " + filename);
+    }
+    out.write(reinterpret_cast<const char*>(&impl->header),sizeof(Impl::Header));
+    out.write(reinterpret_cast<const char*>(impl->entries),impl->header.entry_count * sizeof(Statistics));
+    out.close();
+    if(!out){
+        throw std::runtime_error("write block statistics file failed: " + filename);
+    }
+}
+
+bool VolumeBlockStatistics::isValid() const
+{
+    std::shared_lock<std::shared_mutex> lk(impl->mtx);
+    return impl->entries != nullptr;
+}
+
+bool VolumeBlockStatistics::query(const BlockIndex &blockIndex,Statistics &statistics) const
+{
+    std::shared_lock<std::shared_mutex> lk(impl->mtx);
+    auto i = impl->getEntryIndex(blockIndex);
+    if(i < 0 || !impl->entries[i].valid) return false;
+    statistics = impl->entries[i];
+    return true;
+}
+
+void VolumeBlockStatistics::record(const BlockIndex &blockIndex,const Statistics &statistics)
+{
+    std::unique_lock<std::shared_mutex> lk(impl->mtx);
+    auto i = impl->getEntryIndex(blockIndex);
+    if(i < 0) return;
+    impl->entries[i] = statistics;
+    impl->entries[i].valid = 1;
+}
+
+bool VolumeBlockStatistics::hasCellRange(const BlockIndex &blockIndex) const
+{
+    std::shared_lock<std::shared_mutex> lk(impl->mtx);
+    return impl->cell_ranges.find(blockIndex) != impl->cell_ranges.end();
+}
+
+bool VolumeBlockStatistics::queryCellRange(const BlockIndex &blockIndex,CellRange &cellRange) const
+{
+    std::shared_lock<std::shared_mutex> lk(impl->mtx);
+    auto it = impl->cell_ranges.find(blockIndex);
+    if(it == impl->cell_ranges.end()) return false;
+    cellRange = *it->second;
+    return true;
+}
+
+void VolumeBlockStatistics::recordCellRange(const BlockIndex &blockIndex,const CellRange &cellRange)
+{
+    std::unique_lock<std::shared_mutex> lk(impl->mtx);
+    if(impl->getEntryIndex(blockIndex) < 0) return;
+    auto& range = impl->cell_ranges[blockIndex];
+    if(!range) range = std::make_unique<CellRange>();
+    *range = cellRange;
+}
+
+VolumeBlockStatistics::Statistics VolumeBlockStatistics::Compute(const Volume &volume,const void *blockData)
+{
+    if(volume.getVoxelType() != Volume::UINT8){
+        throw std::runtime_error("block statistics only support uint8 volume");
+    }
+    const int block_length = volume.getBlockLength();
+    const int padding = volume.getBlockPadding();
+    const size_t block_size = volume.getBlockSize();
+    auto data = reinterpret_cast<const uint8_t*>(blockData);
+
+    Statistics statistics;
+    auto range = std::minmax_element(data,data + block_size);
+    statistics.min_value = *range.first;
+    statistics.max_value = *range.second;
+
+    //先统计256个值的个数 再合并到直方图的区间
+    uint64_t counts[256]{};
+    for(int z = padding; z < block_length - padding; z++){
+        for(int y = padding; y < block_length - padding; y++){
+            auto row = data + (static_cast<size_t>(z) * block_length + y) * block_length;
+            for(int x = padding; x < block_length - padding; x++){
+                counts[row[x]]++;
+            }
+        }
+    }
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t bins[HistogramBins]{};
+    for(int v = 0; v < 256; v++){
+        total += counts[v];
+        sum += counts[v] * v;
+        bins[v * HistogramBins / 256] += counts[v];
+    }
+    if(total > 0){
+        statistics.mean_value = static_cast<float>(static_cast<double>(sum) / total);
+        for(int i = 0; i < HistogramBins; i++){
+            statistics.histogram[i] = static_cast<uint16_t>(bins[i] * 65535 / total);
+        }
+    }
+    statistics.valid = 1;
+    return statistics;
+}
+
+void VolumeBlockStatistics::GetCellVoxelRange(const Volume &volume,int cell,int &begin,int &end)
+{
+    const int block_length = volume.getBlockLength();
+    const int padding = volume.getBlockPadding();
+    const int nopad = volume.getBlockLengthWithoutPadding();
+    //cell覆盖[cell*nopad/N,(cell+1)*nopad/N) 三线性插值还会用到两侧各一个体素
+    begin = (std::max)(cell * nopad / CellsPerAxis + padding - 1,0);
+    end = (std::min)(((cell + 1) * nopad + CellsPerAxis - 1) / CellsPerAxis + padding + 1,block_length);
+}
+
+void VolumeBlockStatistics::ComputeCellRange(const Volume &volume,const void *blockData,CellRange &cellRange)
+{
+    if(volume.getVoxelType() != Volume::UINT8){
+        throw std::runtime_error("block statistics only support uint8 volume");
+    }
+    constexpr int N = CellsPerAxis;
+    const int block_length = volume.getBlockLength();
+    auto data = reinterpret_cast<const uint8_t*>(blockData);
+    int begin[N],end[N];
+    for(int c = 0; c < N; c++){
+        GetCellVoxelRange(volume,c,begin[c],end[c]);
+    }
+    //先求每一行在x方向上每个cell的范围 再合并y方向得到每个z平面的结果 最后合并z方向
+    std::vector<uint8_t> row_min(static_cast<size_t>(block_length) * N),row_max(row_min.size());
+    std::vector<uint8_t> slice_min(static_cast<size_t>(block_length) * N * N),slice_max(slice_min.size());
+    for(int z = begin[0]; z < end[N - 1]; z++){
+        for(int y = begin[0]; y < end[N - 1]; y++){
+            auto row = data + (static_cast<size_t>(z) * block_length + y) * block_length;
+            for(int cx = 0; cx < N; cx++){
+                auto range = std::minmax_element(row + begin[cx],row + end[cx]);
+                row_min[y * N + cx] = *range.first;
+                row_max[y * N + cx] = *range.second;
+            }
+        }
+        for(int cy = 0; cy < N; cy++){
+            for(int cx = 0; cx < N; cx++){
+                uint8_t lo = 255,hi = 0;
+                for(int y = begin[cy]; y < end[cy]; y++){
+                    lo = (std::min)(lo,row_min[y * N + cx]);
+                    hi = (std::max)(hi,row_max[y * N + cx]);
+                }
+                slice_min[(static_cast<size_t>(z) * N + cy) * N + cx] = lo;
+                slice_max[(static_cast<size_t>(z) * N + cy) * N + cx] = hi;
+            }
+        }
+    }
+    for(int cz = 0; cz < N; cz++){
+        for(int i = 0; i < N * N; i++){
+            uint8_t lo = 255,hi = 0;
+            for(int z = begin[cz]; z < end[cz]; z++){
+                lo = (std::min)(lo,slice_min[static_cast<size_t>(z) * N * N + i]);
+                hi = (std::max)(hi,slice_max[static_cast<size_t>(z) * N * N + i]);
+            }
+            cellRange.min_value[cz * N * N + i] = lo;
+            cellRange.max_value[cz * N * N + i] = hi;
+        }
+    }
+}
+
+MRAYNS_END
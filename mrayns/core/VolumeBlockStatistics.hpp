@@ -0,0 +1,103 @@
+//
+// Created by wyz on 2022/5/29.
+//
+#pragma once
+
+#include "Volume.hpp"
+#include <memory>
+#include <string>
+
+MRAYNS_BEGIN
+
+/**
+ * @brief 每个lod的每个块的统计信息 不需要解码体数据就可以用于空块跳过和传输函数剔除
+ * 可以离线生成后保存为sidecar文件 打开时直接内存映射 也可以在块解码后再逐个记录
+ * min max是整个带padding的块的 保证包含了采样时可能取到的值 mean和直方图只统计不含padding的部分
+ * 目前只支持uint8的体数据
+ */
+class VolumeBlockStatistics{
+  public:
+    using BlockIndex = Volume::BlockIndex;
+    static constexpr int HistogramBins = 16;
+
+    struct Statistics{
+        float min_value{0.f};
+        float max_value{0.f};
+        float mean_value{0.f};
+        //每个区间内体素所占的比例 归一化到[0,65535]
+        uint16_t histogram[HistogramBins]{};
+        uint32_t valid{0};
+    };
+
+    //块内不含padding的部分在每个轴上均分为CellsPerAxis个cell 用于块内的空区域跳过
+    static constexpr int CellsPerAxis = 16;
+    static constexpr int CellCount = CellsPerAxis * CellsPerAxis * CellsPerAxis;
+
+    /**
+     * @brief 每个cell的体素范围向外扩展一个体素 包含三线性插值时可能取到的所有体素
+     * cell按照 x y z 的顺序存储
+     */
+    struct CellRange{
+        uint8_t min_value[CellCount];
+        uint8_t max_value[CellCount];
+    };
+
+    VolumeBlockStatistics();
+
+    ~VolumeBlockStatistics();
+
+    /**
+     * @brief 创建空的统计表 之后由record填充
+     */
+    void create(const Volume& volume);
+
+    /**
+     * @brief 内存映射sidecar文件 映射是写时复制的 之后的record不会修改文件 需要save才能保存
+     * 文件头中的体数据大小 块大小 padding和max_lod必须与volume相同 否则抛出异常
+     */
+    void open(const std::string& filename,const Volume& volume);
+
+    /**
+     * @brief 打开离线生成的sidecar文件 文件名为空或者打开失败时创建空表
+     * 空表中的块在第一次完整解码后才有统计信息
+     */
+    static std::shared_ptr<VolumeBlockStatistics> Load(const Volume& volume,const std::string& filename);
+
+    void save(const std::string& filename) const;
+
+    bool isValid() const;
+
+    /**
+     * @return 块还没有统计信息或者超出范围时返回false
+     */
+    bool query(const BlockIndex& blockIndex,Statistics& statistics) const;
+
+    void record(const BlockIndex& blockIndex,const Statistics& statistics);
+
+    /**
+     * @brief cell的统计只保存在内存中 不会写入sidecar文件 每个块占用2*CellCount字节
+     */
+    bool hasCellRange(const BlockIndex& blockIndex) const;
+
+    bool queryCellRange(const BlockIndex& blockIndex,CellRange& cellRange) const;
+
+    void recordCellRange(const BlockIndex& blockIndex,const CellRange& cellRange);
+
+    /**
+     * @brief 计算一个解码后的带padding的块的统计信息
+     */
+    static Statistics Compute(const Volume& volume,const void* blockData);
+
+    /**
+     * @brief 一个轴上cell的体素范围[begin,end) 是带padding的块内的坐标
+     */
+    static void GetCellVoxelRange(const Volume& volume,int cell,int& begin,int& end);
+
+    static void ComputeCellRange(const Volume& volume,const void* blockData,CellRange& cellRange);
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+MRAYNS_END
@@ -4,9 +4,11 @@
 #include "VolumeBlockTree.hpp"
 #include <stdexcept>
 #include "../algorithm/GeometryHelper.hpp"
+#include "../algorithm/ColorMapping.hpp"
 #include "../common/Logger.hpp"
 #include <queue>
 #include <unordered_set>
+#include <algorithm>
 #include "../utils/Timer.hpp"
 MRAYNS_BEGIN
 
@@ -22,6 +24,7 @@ class VolumeBlockTreeImpl{
 
 
     using BlockIndex = VolumeBlockTree::BlockIndex;
+    using PriorityBlock = VolumeBlockTree::PriorityBlock;
 
     void buildTree(const Volume& volume);
 
@@ -33,7 +36,9 @@ class VolumeBlockTreeImpl{
     std::vector<BlockIndex> computeIntersectBlock(T&& t,int level);
 
     template<typename T>
-    std::vector<BlockIndex> computeIntersectBlock(T&& t, const VolumeRendererLodDist&,const Vector3f& viewPos);
+    std::vector<PriorityBlock> computeIntersectBlockWithPriority(T&& t, const VolumeRendererLodDist&,const Vector3f& viewPos);
+
+    std::vector<PriorityBlock> computeIntersectBlockWithPriority(const SliceSlab& slab,int level);
 
   private:
     class OctTree{
@@ -216,15 +221,37 @@ const Volume &VolumeBlockTreeImpl::getVolume() const
     return volume;
 }
 
+//到视点的最近距离 视点在块内时为0 面积用块的包围球张角近似
+static VolumeBlockTree::PriorityBlock ComputeBlockPriority(const BoundBox& box,const Vector3f& viewPos){
+    Vector3f nearest = clamp(viewPos,box.min_p,box.max_p);
+    float radius = length(box.max_p - box.min_p) * 0.5f;
+    float center_dist = length((box.max_p + box.min_p) * 0.5f - viewPos);
+    float area = radius * radius / (std::max)(center_dist * center_dist,radius * radius);
+    return {{},length(viewPos - nearest),area};
+}
+//切片空间中块到切片中心的距离 面积为块在切片上投影的矩形面积
+static VolumeBlockTree::PriorityBlock ComputeBlockPriority(const BoundBox& box,const SliceSlab& slab){
+    Vector3f box_half = (box.max_p - box.min_p) * 0.5f;
+    Vector3f t = (box.max_p + box.min_p) * 0.5f - slab.center;
+    auto radius = [&](const Vector3f& axis){
+        return box_half.x * std::abs(axis.x) + box_half.y * std::abs(axis.y) + box_half.z * std::abs(axis.z);
+    };
+    float rx = radius(slab.x_dir);
+    float ry = radius(slab.y_dir);
+    float dx = (std::max)(std::abs(dot(t,slab.x_dir)) - rx,0.f);
+    float dy = (std::max)(std::abs(dot(t,slab.y_dir)) - ry,0.f);
+    return {{},std::sqrt(dx * dx + dy * dy),4.f * rx * ry};
+}
+
 //按照普通的算法 首先计算lod0相交的块 然后根据lod-dist策略进行淘汰更换得到lod更大的块
 //这样子会很慢 因为当视锥体很大时候 lod0相交的块十分多 时间可能需要十几ms的代价
 //另一种策略是 从最大的lod这一层开始 如果当前层的块相交 那么求得视点与该块的最近距离所mapping的lod 对该块的子节点递归求交直到lod小于刚求的最小lod
 
 template <typename ViewSpace>
-std::vector<Volume::BlockIndex> VolumeBlockTreeImpl::computeIntersectBlock(ViewSpace&& viewSpace,const VolumeRendererLodDist &lodDist,const Vector3f& viewPos)
+std::vector<VolumeBlockTree::PriorityBlock> VolumeBlockTreeImpl::computeIntersectBlockWithPriority(ViewSpace&& viewSpace,const VolumeRendererLodDist &lodDist,const Vector3f& viewPos)
 {
     START_TIMER
-    std::vector<BlockIndex> intersect_blocks;
+    std::vector<PriorityBlock> intersect_blocks;
 
     std::function<int(const BoundBox&)> lodComputer = [&](const BoundBox& box)->int{
         auto block_center = (box.max_p + box.min_p) * 0.5f;
@@ -275,8 +302,11 @@ std::vector<Volume::BlockIndex> VolumeBlockTreeImpl::computeIntersectBlock(ViewS
 
     intersect_blocks.reserve(res.size());
     for(auto b:res){
-        intersect_blocks.emplace_back(b->index);
+        auto priority = ComputeBlockPriority(b->box,viewPos);
+        priority.index = b->index;
+        intersect_blocks.emplace_back(priority);
     }
+    std::sort(intersect_blocks.begin(),intersect_blocks.end());
     LOG_INFO("intersect block count {} with lod-dist",intersect_blocks.size());
     STOP_TIMER("compute intersect blocks with lod-dist");
     return intersect_blocks;
@@ -308,6 +338,32 @@ std::vector<VolumeBlockTreeImpl::BlockIndex> VolumeBlockTreeImpl::computeInterse
     return intersect_blocks;
 }
 
+std::vector<VolumeBlockTree::PriorityBlock> VolumeBlockTreeImpl::computeIntersectBlockWithPriority(const SliceSlab &slab, int level)
+{
+    std::vector<PriorityBlock> intersect_blocks;
+    std::queue<OctTree::OctNode*> q;
+    q.push(oct_tree.root);
+    while(!q.empty()){
+        auto p = q.front();
+        q.pop();
+        if(!p) continue;
+        if(GeometryHelper::GetBoxVisibility(slab,p->box) != BoxVisibility::Invisible){
+            if(p->level == level){
+                auto priority = ComputeBlockPriority(p->box,slab);
+                priority.index = p->index;
+                intersect_blocks.emplace_back(priority);
+            }
+            else if(p->level > level){
+                for(int i = 0;i<8;i++){
+                    q.push(p->kids[i]);
+                }
+            }
+        }
+    }
+    std::sort(intersect_blocks.begin(),intersect_blocks.end());
+    return intersect_blocks;
+}
+
 void VolumeBlockTreeImpl::buildTree()
 {
 
@@ -337,6 +393,22 @@ std::vector<Volume::BlockIndex> VolumeBlockTree::computeIntersectBlock(const Fru
 {
     return impl->computeIntersectBlock(frustum,level);
 }
+static std::vector<Volume::BlockIndex> StripPriority(const std::vector<VolumeBlockTree::PriorityBlock>& blocks){
+    std::vector<Volume::BlockIndex> ret;
+    ret.reserve(blocks.size());
+    for(const auto& b:blocks){
+        ret.emplace_back(b.index);
+    }
+    return ret;
+}
+std::vector<Volume::BlockIndex> VolumeBlockTree::computeIntersectBlock(const SliceSlab &slab,int level)
+{
+    return StripPriority(impl->computeIntersectBlockWithPriority(slab,level));
+}
+std::vector<VolumeBlockTree::PriorityBlock> VolumeBlockTree::computeIntersectBlockWithPriority(const SliceSlab &slab,int level)
+{
+    return impl->computeIntersectBlockWithPriority(slab,level);
+}
 std::vector<Volume::BlockIndex> VolumeBlockTree::computeIntersectBlock(const BoundBox &box,int level)
 {
     return impl->computeIntersectBlock(box,level);
@@ -347,7 +419,45 @@ VolumeBlockTree::VolumeBlockTree()
 }
 std::vector<Volume::BlockIndex> VolumeBlockTree::computeIntersectBlock(const FrustumExt &frustum, const VolumeRendererLodDist& lodDist,const Vector3f& viewPos)
 {
-    return impl->computeIntersectBlock(frustum,lodDist,viewPos);
+    return StripPriority(impl->computeIntersectBlockWithPriority(frustum,lodDist,viewPos));
+}
+std::vector<VolumeBlockTree::PriorityBlock> VolumeBlockTree::computeIntersectBlockWithPriority(const FrustumExt &frustum, const VolumeRendererLodDist& lodDist,const Vector3f& viewPos)
+{
+    return impl->computeIntersectBlockWithPriority(frustum,lodDist,viewPos);
+}
+std::vector<Volume::BlockIndex> VolumeBlockTree::computeIntersectBlock(const FrustumExt &frustum,const VolumeRendererLodDist &lodDist,const Vector3f &viewPos,
+                                                                       const TransferFunctionExt1D &tf,std::vector<BlockIndex> &transparentBlocks)
+{
+    return StripPriority(computeIntersectBlockWithPriority(frustum,lodDist,viewPos,tf,transparentBlocks));
+}
+std::vector<VolumeBlockTree::PriorityBlock> VolumeBlockTree::computeIntersectBlockWithPriority(const FrustumExt &frustum,const VolumeRendererLodDist &lodDist,const Vector3f &viewPos,
+                                                                                              const TransferFunctionExt1D &tf,
+                                                                                              std::vector<BlockIndex> &transparentBlocks)
+{
+    transparentBlocks.clear();
+    auto blocks = impl->computeIntersectBlockWithPriority(frustum,lodDist,viewPos);
+    if(!block_statistics) return blocks;
+    TransferFunctionOpacityTable opacity_table;
+    opacity_table.build(tf);
+    VolumeBlockStatistics::Statistics statistics;
+    //stable_partition保持两部分各自的优先级顺序
+    auto it = std::stable_partition(blocks.begin(),blocks.end(),[&](const PriorityBlock& b){
+        return !block_statistics->query(b.index,statistics) || !opacity_table.isTransparent(statistics.min_value,statistics.max_value);
+    });
+    for(auto p = it; p != blocks.end(); ++p){
+        transparentBlocks.emplace_back(p->index);
+    }
+    LOG_INFO("cull {} transparent blocks with transfer function",transparentBlocks.size());
+    blocks.erase(it,blocks.end());
+    return blocks;
+}
+void VolumeBlockTree::setBlockStatistics(std::shared_ptr<VolumeBlockStatistics> statistics)
+{
+    block_statistics = std::move(statistics);
+}
+bool VolumeBlockTree::queryBlockStatistics(const BlockIndex &blockIndex,VolumeBlockStatistics::Statistics &statistics) const
+{
+    return block_statistics && block_statistics->query(blockIndex,statistics);
 }
 
 MRAYNS_END
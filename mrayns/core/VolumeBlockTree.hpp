@@ -4,6 +4,7 @@
 #pragma once
 
 #include "Volume.hpp"
+#include "VolumeBlockStatistics.hpp"
 #include <vector>
 #include <memory>
 #include "../geometry/Frustum.hpp"
@@ -11,12 +12,27 @@
 MRAYNS_BEGIN
 
 class VolumeBlockTreeImpl;
+struct TransferFunctionExt1D;
 class VolumeBlockTree{
   public:
     VolumeBlockTree() ;
     ~VolumeBlockTree();
     using BlockIndex = Volume::BlockIndex;
 
+    /**
+     * 带优先级的相交块 越靠前越应该先加载和上传
+     * 按照到视点(切片则是到切片中心)的最近距离由近及远 距离相同时投影面积大的优先
+     */
+    struct PriorityBlock{
+        BlockIndex index;
+        float dist;
+        float area;
+        bool operator<(const PriorityBlock& other) const{
+            if(dist != other.dist) return dist < other.dist;
+            return area > other.area;
+        }
+    };
+
     void buildTree(const Volume& volume);
 
     void clearTree();
@@ -25,16 +41,50 @@ class VolumeBlockTree{
 
     std::vector<BlockIndex> computeIntersectBlock(const FrustumExt& frustum,int level = 0);
 
+    /**
+     * 返回的块已经按照优先级排序
+     */
     std::vector<BlockIndex> computeIntersectBlock(const FrustumExt& frustum,const VolumeRendererLodDist&,const Vector3f& viewPos);
 
+    std::vector<PriorityBlock> computeIntersectBlockWithPriority(const FrustumExt& frustum,const VolumeRendererLodDist&,const Vector3f& viewPos);
+
+    /**
+     * 同上 块的值域经过传输函数后完全透明的块会被剔除 没有统计信息的块保留
+     * 剔除的块按照优先级放入transparentBlocks 渲染器需要知道它们是空的 否则会当作还没有加载
+     * 要在第一次访问时就减少加载的块 需要打开离线生成的sidecar 见VolumeBlockStatistics::Load
+     * 只有BlockVolumeManager在解码后记录的统计时 块在第一次完整解码之后才会被剔除
+     */
+    std::vector<BlockIndex> computeIntersectBlock(const FrustumExt& frustum,const VolumeRendererLodDist&,const Vector3f& viewPos,
+                                                  const TransferFunctionExt1D& tf,std::vector<BlockIndex>& transparentBlocks);
+
+    std::vector<PriorityBlock> computeIntersectBlockWithPriority(const FrustumExt& frustum,const VolumeRendererLodDist&,const Vector3f& viewPos,
+                                                                 const TransferFunctionExt1D& tf,std::vector<BlockIndex>& transparentBlocks);
+
+    /**
+     * 切片的精确求交 只返回切片像素真正会采样到的块 并且已经按照优先级排序
+     */
+    std::vector<BlockIndex> computeIntersectBlock(const SliceSlab& slab,int level = 0);
+
+    std::vector<PriorityBlock> computeIntersectBlockWithPriority(const SliceSlab& slab,int level = 0);
+
     /**
      * 切片可以是特殊的BoundBox
      */
     std::vector<BlockIndex> computeIntersectBlock(const BoundBox& box,int level = 0);
 
+    /**
+     * 设置块的统计信息 可以和BlockVolumeManager共用一个 sidecar中没有的块由它在解码后记录
+     */
+    void setBlockStatistics(std::shared_ptr<VolumeBlockStatistics> statistics);
+
+    /**
+     * @return 没有设置统计信息或者块还没有统计信息时返回false
+     */
+    bool queryBlockStatistics(const BlockIndex& blockIndex,VolumeBlockStatistics::Statistics& statistics) const;
 
   private:
     std::unique_ptr<VolumeBlockTreeImpl> impl;
+    std::shared_ptr<VolumeBlockStatistics> block_statistics;
 };
 
 MRAYNS_END
\ No newline at end of file
@@ -3,11 +3,17 @@
 //
 #pragma once
 #include "../PageTable.hpp"
+#include "../../algorithm/VolumeHelper.hpp"
+#include "../../common/Logger.hpp"
+#include <cstring>
 #include <stdexcept>
+#include <unordered_map>
+#include <vector>
 MRAYNS_BEGIN
 namespace internal
 {
 
+//只用于VulkanVolumeRenderer 其它渲染器使用PageDirectory
 struct MappingTable
 {
     static constexpr int HashTableSize = 1024; // the same in the shader
@@ -68,5 +74,203 @@ struct MappingTable
     };
 };
 
+/**
+ * 直接索引的页目录 替代MappingTable 着色器中的查询是O(1)的
+ * GPU缓冲的布局为[entries][directory] 和着色器中的PageTable相同
+ * directory为每个lod的每个块对应一个常驻块编号 不在显存中为InvalidID 已知完全透明的块为EmptyID
+ * entries为常驻块编号对应的texture entry 常驻块编号也用于索引其它按块存储的数据 比如占用位图
+ * update时只写入和上一次不同的项
+ */
+struct PageDirectory
+{
+    static constexpr uint32_t InvalidID = 0xffffffffu;
+    //着色器直接跳过这个块 而不是当作还没有加载
+    static constexpr uint32_t EmptyID = 0xfffffffeu;
+    static constexpr uint32_t MaxResidentCount = 1u << 15; // the same in the shader
+    static constexpr size_t MaxDirectorySize = size_t(1) << 21;
+    static constexpr int MaxLod = 12;
+    //directory中的值高8位为替代块相对于原块的lod差 低24位为常驻块编号
+    static constexpr uint32_t FallbackLodShift = 24;
+    static constexpr size_t BufferSize = (MaxResidentCount + MaxDirectorySize) * sizeof(uint32_t);
+
+    //上传到着色器的VolumeInfo中 每个lod的块数和在directory中的起始位置
+    struct LodInfo{
+        uint32_t dim_x{0},dim_y{0},dim_z{0};
+        uint32_t base{0};
+    };
+    using EntryItem = PageTable::EntryItem;
+    using ValueItem = PageTable::ValueItem;
+
+    LodInfo lods[MaxLod];
+
+    //texture entry的x y z各9位 w为5位
+    static uint32_t PackEntry(const EntryItem& entry){
+        assert(entry.x < 512 && entry.y < 512 && entry.z < 512 && entry.w < 32);
+        return static_cast<uint32_t>(entry.x) | (static_cast<uint32_t>(entry.y) << 9)
+               | (static_cast<uint32_t>(entry.z) << 18) | (static_cast<uint32_t>(entry.w) << 27);
+    }
+
+    /**
+     * @brief 重新计算每个lod的布局并清空 mapped不为空时同时清空GPU缓冲
+     */
+    void reset(const Volume& volume,void* mapped){
+        size_t count = 0;
+        for(int lod = 0; lod < MaxLod; lod++){
+            lods[lod] = LodInfo{};
+            if(lod > volume.getMaxLod()) continue;
+            auto dim = VolumeHelper::ComputeLodVolumeBlockDim(volume,lod);
+            lods[lod] = LodInfo{static_cast<uint32_t>(dim.x),static_cast<uint32_t>(dim.y),
+                                static_cast<uint32_t>(dim.z),static_cast<uint32_t>(count)};
+            count += static_cast<size_t>(dim.x) * dim.y * dim.z;
+        }
+        if(count > MaxDirectorySize){
+            throw std::runtime_error("volume block count exceeds page directory size");
+        }
+        residents.clear();
+        fallbacks.clear();
+        resident_blocks.assign(MaxResidentCount,ValueItem{});
+        free_ids.clear();
+        for(uint32_t id = MaxResidentCount; id > 0; id--){
+            free_ids.emplace_back(id - 1);
+        }
+        if(mapped){
+            std::memset(mapped,0xff,BufferSize);
+        }
+    }
+
+    //超出范围返回-1
+    int64_t getDirectoryIndex(const ValueItem& block) const{
+        if(block.w < 0 || block.w >= MaxLod) return -1;
+        const auto& lod = lods[block.w];
+        const int64_t dim_x = lod.dim_x,dim_y = lod.dim_y,dim_z = lod.dim_z;
+        if(block.x < 0 || block.y < 0 || block.z < 0
+            || block.x >= dim_x || block.y >= dim_y || block.z >= dim_z) return -1;
+        return lod.base + (block.z * dim_y + block.y) * dim_x + block.x;
+    }
+
+    /**
+     * @param items 当前所有的常驻块
+     * @param added 新分配的常驻块编号
+     */
+    void update(const std::vector<std::pair<EntryItem,ValueItem>>& items,void* mapped,std::vector<uint32_t>& added){
+        update(items,{},mapped,added);
+    }
+
+    /**
+     * @param missed 需要但不在items中的块 directory中指向最近的常驻祖先块 着色器在祖先块的lod上采样
+     */
+    void update(const std::vector<std::pair<EntryItem,ValueItem>>& items,const std::vector<ValueItem>& missed,
+                void* mapped,std::vector<uint32_t>& added){
+        update(items,missed,{},mapped,added);
+    }
+
+    /**
+     * @param empty 被传输函数剔除的块 directory中写入EmptyID 和missed一样只在这一次update中有效
+     */
+    void update(const std::vector<std::pair<EntryItem,ValueItem>>& items,const std::vector<ValueItem>& missed,
+                const std::vector<ValueItem>& empty,void* mapped,std::vector<uint32_t>& added){
+        added.clear();
+        auto entries = reinterpret_cast<uint32_t*>(mapped);
+        auto directory = entries + MaxResidentCount;
+        generation++;
+        for(const auto& item:items){
+            auto index = getDirectoryIndex(item.second);
+            if(index < 0) continue;
+            auto packed = PackEntry(item.first);
+            auto it = residents.find(item.second);
+            if(it != residents.end()){
+                auto& resident = it->second;
+                resident.generation = generation;
+                if(resident.packed != packed){
+                    resident.packed = packed;
+                    entries[resident.id] = packed;
+                }
+                continue;
+            }
+            if(free_ids.empty()){
+                LOG_ERROR("page directory resident count exceeds {}",MaxResidentCount);
+                continue;
+            }
+            auto id = free_ids.back();
+            free_ids.pop_back();
+            fallbacks.erase(item.second);
+            residents[item.second] = Resident{id,packed,generation};
+            resident_blocks[id] = item.second;
+            entries[id] = packed;
+            directory[index] = id;
+            added.emplace_back(id);
+        }
+        for(auto it = residents.begin(); it != residents.end();){
+            if(it->second.generation == generation){
+                ++it;
+                continue;
+            }
+            directory[getDirectoryIndex(it->first)] = InvalidID;
+            entries[it->second.id] = InvalidID;
+            resident_blocks[it->second.id] = ValueItem{};
+            free_ids.emplace_back(it->second.id);
+            it = residents.erase(it);
+        }
+        for(const auto& block:missed){
+            auto index = getDirectoryIndex(block);
+            if(index < 0 || residents.count(block)) continue;
+            uint32_t value = InvalidID;
+            for(int lod = block.w + 1; lod < MaxLod; lod++){
+                auto ancestor = VolumeHelper::GetLodBlockIndex(block,lod);
+                auto it = residents.find(ancestor);
+                if(it != residents.end()){
+                    value = it->second.id | (static_cast<uint32_t>(lod - block.w) << FallbackLodShift);
+                    break;
+                }
+            }
+            if(value == InvalidID) continue;
+            setFallback(block,value,directory + index);
+        }
+        for(const auto& block:empty){
+            auto index = getDirectoryIndex(block);
+            if(index < 0 || residents.count(block)) continue;
+            setFallback(block,EmptyID,directory + index);
+        }
+        for(auto it = fallbacks.begin(); it != fallbacks.end();){
+            if(it->second.generation == generation){
+                ++it;
+                continue;
+            }
+            directory[getDirectoryIndex(it->first)] = InvalidID;
+            it = fallbacks.erase(it);
+        }
+    }
+
+    //空闲的编号返回无效的块
+    const ValueItem& getResidentBlock(uint32_t id) const{
+        return resident_blocks[id];
+    }
+
+  private:
+    void setFallback(const ValueItem& block,uint32_t value,uint32_t* directoryEntry){
+        auto& fallback = fallbacks[block];
+        fallback.generation = generation;
+        if(fallback.value != value){
+            fallback.value = value;
+            *directoryEntry = value;
+        }
+    }
+
+    struct Resident{
+        uint32_t id;
+        uint32_t packed;
+        uint64_t generation;
+    };
+    struct Fallback{
+        uint32_t value{InvalidID};
+        uint64_t generation{0};
+    };
+    std::unordered_map<ValueItem,Resident> residents;
+    std::unordered_map<ValueItem,Fallback> fallbacks;
+    std::vector<ValueItem> resident_blocks;
+    std::vector<uint32_t> free_ids;
+    uint64_t generation{0};
+};
+
 }
 MRAYNS_END
\ No newline at end of file
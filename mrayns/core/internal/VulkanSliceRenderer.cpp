@@ -43,16 +43,23 @@ struct SliceRendererVulkanPrivateResourceWrapper{
     FramebufferAttachment colorAttachment;
 
     VkCommandBuffer drawCommand;
-    VkCommandBuffer resultCopyCommand;
 
-    struct{
+    //每个读回缓冲有自己的拷贝命令和fence 上一帧的拷贝可以在下一帧绘制时仍然在途
+    struct ReadbackBuffer{
         VkBuffer buffer;
 #ifdef DEBUG_WINDOW
         VkDeviceMemory mem;
 #else
         VmaAllocation allocation;
 #endif
-    }result_color;
+        void* mapped_ptr{nullptr};
+        VkCommandBuffer copyCommand;
+        VkFence fence{VK_NULL_HANDLE};
+        uint64_t frame{0};
+        int width{0};
+        int height{0};
+    };
+    ReadbackBuffer readback[Renderer::ReadbackBufferCount];
 
     struct{
         VkImage image;
@@ -71,7 +78,18 @@ struct SliceRendererVulkanPrivateResourceWrapper{
     };
     UBO volumeInfoUBO;
     UBO renderInfoUBO;
-    UBO pageTableUBO;
+
+    struct SSBO{
+        VkBuffer buffer;
+#ifdef DEBUG_WINDOW
+        VkDeviceMemory mem;
+#else
+        VmaAllocation allocation;
+#endif
+        void* mapped_ptr;
+        size_t size;
+    };
+    SSBO pageTableSSBO;
 
     VmaAllocator allocator;//for mapping table buffer
 
@@ -79,7 +97,7 @@ struct SliceRendererVulkanPrivateResourceWrapper{
 
 struct VulkanSliceRenderer::Impl{
     std::unique_ptr<SliceRendererVulkanPrivateResourceWrapper> renderer_vk_res;
-    SliceRendererVulkanSharedResourceWrapper* shared_renderer_vk_res;
+    SliceRendererVulkanSharedResourceWrapper* shared_renderer_vk_res = nullptr;
     VulkanNodeSharedResourceWrapper* node_vk_res;
     Framebuffer render_result;
     Volume volume;
@@ -96,11 +114,15 @@ struct VulkanSliceRenderer::Impl{
         float voxel;
         uint32_t padding3 = 4;
         Vector4f inv_texture_shape[GPUResource::DefaultMaxGPUTextureCount] = {Vector4f{0.f}};
+        PageDirectory::LodInfo lod_page_directory[PageDirectory::MaxLod];
     } volume_info;
-    void* result_color_mapped_ptr = nullptr;
+    FencePool fence_pool;
+    uint64_t readback_frame_count{0};
+    //当前命令缓冲录制时的region 初始为无效
+    Rect recorded_region{-1,-1,-1,-1};
 
-    using HashTable = ::mrayns::internal::MappingTable::HashTable;
-    HashTable page_table;
+    PageDirectory page_directory;
+    std::vector<uint32_t> added_residents;
 
     struct RenderInfo{
         Vector3f origin; uint32_t padding0 = 1;
@@ -114,55 +136,87 @@ struct VulkanSliceRenderer::Impl{
 
     const Framebuffer& getFrameRenderResult(){
 //        START_TIMER
+        auto view = acquireReadback(submitReadback());
+        if(view.isValid()){
+            render_result.getColors().reshape(view.width,view.height);
+            ::memcpy(render_result.getColors().data(),view.data(),view.size());
+        }
+//        STOP_TIMER("get render result")
+        return render_result;
+    }
+
+    uint64_t submitReadback(){
+        uint64_t frame = ++readback_frame_count;
+        auto& rb = renderer_vk_res->readback[frame % Renderer::ReadbackBufferCount];
+        //最早的一帧还没有被取走时会覆盖它
+        waitReadback(rb);
+        rb.fence = fence_pool.acquire();
+        rb.frame = frame;
+        rb.width = recorded_region.max_x - recorded_region.min_x + 1;
+        rb.height = recorded_region.max_y - recorded_region.min_y + 1;
+
         VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
         submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &renderer_vk_res->resultCopyCommand;
-        VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
-        VkFence fence;
+        submitInfo.pCommandBuffers = &rb.copyCommand;
         {
             std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            VK_EXPR(vkCreateFence(shared_renderer_vk_res->shared_device, &fenceInfo, nullptr, &fence));
-            VK_EXPR(vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue,1,&submitInfo,fence));
+            VK_EXPR(vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue,1,&submitInfo,rb.fence));
         }
+        return frame;
+    }
 
-        VK_EXPR(vkWaitForFences(shared_renderer_vk_res->shared_device,1,&fence,VK_TRUE,UINT64_MAX));
-        {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            vkDestroyFence(shared_renderer_vk_res->shared_device, fence, nullptr);
+    FramebufferView acquireReadback(uint64_t frame){
+        if(frame == 0){
+            return FramebufferView(getFrameRenderResult().getColors());
         }
-
-        {
-//            START_TIMER
-            ::memcpy(render_result.getColors().data(), result_color_mapped_ptr, render_result.getColors().size());
-//            STOP_TIMER("render result copy")
+        auto& rb = renderer_vk_res->readback[frame % Renderer::ReadbackBufferCount];
+        if(rb.frame != frame){
+            LOG_ERROR("readback frame {} has been overwritten",frame);
+            return {};
         }
+        waitReadback(rb);
+        return {reinterpret_cast<const RGBA*>(rb.mapped_ptr),rb.width,rb.height};
+    }
 
-//        STOP_TIMER("get render result")
-        return render_result;
+    void waitReadback(SliceRendererVulkanPrivateResourceWrapper::ReadbackBuffer& rb){
+        if(rb.fence == VK_NULL_HANDLE) return;
+        VK_EXPR(vkWaitForFences(shared_renderer_vk_res->shared_device,1,&rb.fence,VK_TRUE,UINT64_MAX));
+        fence_pool.release(rb.fence);
+        rb.fence = VK_NULL_HANDLE;
+#ifndef DEBUG_WINDOW
+        //HOST_ACCESS_RANDOM可能分配到非coherent的内存
+        VK_EXPR(vmaInvalidateAllocation(renderer_vk_res->allocator,rb.allocation,0,VK_WHOLE_SIZE));
+#endif
     }
 
     void render(const SliceExt& slice, RenderType type){
-        //todo viewport
 //        START_TIMER
         updateRenderParamsUBO(slice,type);
 
+        //只绘制和读回region部分 结果的原点是region的min
+        Rect region = slice.region;
+        region.min_x = (std::max)(region.min_x,0);
+        region.min_y = (std::max)(region.min_y,0);
+        region.max_x = (std::min)(region.max_x,(std::min)(slice.n_pixels_w,(int)SliceRenderer::MaxSliceW) - 1);
+        region.max_y = (std::min)(region.max_y,(std::min)(slice.n_pixels_h,(int)SliceRenderer::MaxSliceH) - 1);
+        if(region.max_x < region.min_x || region.max_y < region.min_y){
+            LOG_ERROR("invalid slice region");
+            return;
+        }
+        if(region.min_x != recorded_region.min_x || region.min_y != recorded_region.min_y
+           || region.max_x != recorded_region.max_x || region.max_y != recorded_region.max_y){
+            recordCommands(region);
+        }
+        int region_w = region.max_x - region.min_x + 1;
+        int region_h = region.max_y - region.min_y + 1;
+        render_result.getColors().reshape(region_w,region_h);
+        render_result.getDepths().reshape(region_w,region_h);
+
         //submit draw commands to queue
         VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &renderer_vk_res->drawCommand;
-        VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
-        VkFence fence;
-        {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            VK_EXPR(vkCreateFence(shared_renderer_vk_res->shared_device, &fenceInfo, nullptr, &fence));
-            VK_EXPR(vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue,1,&submitInfo,fence));
-        }
-
-        VK_EXPR(vkWaitForFences(shared_renderer_vk_res->shared_device,1,&fence,VK_TRUE,UINT64_MAX));
-        {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            vkDestroyFence(shared_renderer_vk_res->shared_device, fence, nullptr);
-        }
+        submitAndWait(fence_pool,shared_renderer_vk_res->shared_graphics_queue,shared_renderer_vk_res->pool_mtx,submitInfo);
 //        STOP_TIMER("vulkan render")
 
     }
@@ -177,7 +231,11 @@ struct VulkanSliceRenderer::Impl{
 
     }
     void destroy(){
-
+        if(!shared_renderer_vk_res) return;
+        for(auto& rb:renderer_vk_res->readback){
+            waitReadback(rb);
+        }
+        fence_pool.destroy();
     }
     void setTransferFunctionExt1D(const TransferFunctionExt1D& tf){
         const float* data = tf.tf;
@@ -263,6 +321,9 @@ struct VulkanSliceRenderer::Impl{
 
         volume_info.voxel = std::min({volume_info.volume_space.x, volume_info.volume_space.y, volume_info.volume_space.z});
 
+        //页目录的布局由体数据决定 之前的常驻块全部失效
+        page_directory.reset(volume,renderer_vk_res->pageTableSSBO.mapped_ptr);
+        std::copy(std::begin(page_directory.lods),std::end(page_directory.lods),volume_info.lod_page_directory);
 
         //upload
         uploadVolumeInfoUBO();
@@ -314,32 +375,15 @@ struct VulkanSliceRenderer::Impl{
         vmaUnmapMemory(renderer_vk_res->allocator,renderer_vk_res->renderInfoUBO.allocation);
 #endif
     }
-    void updatePageTable(const std::vector<PageTableItem>& items){
-        page_table.clear();
-        for(const auto& item:items){
-            page_table.append({item.second,item.first});
-        }
-
-        uploadPageTable();
-    }
-    void uploadPageTable(){
-        void* data;
-#ifdef DEBUG_WINDOW
-        vkMapMemory(shared_renderer_vk_res->shared_device,renderer_vk_res->pageTableUBO.mem,0,sizeof(HashTable),0,&data);
-#else
-        VK_EXPR(vmaMapMemory(renderer_vk_res->allocator,renderer_vk_res->pageTableUBO.allocation,&data));
-#endif
-        memcpy(data,&page_table,sizeof(page_table));
-#ifdef DEBUG_WINDOW
-        vkUnmapMemory(shared_renderer_vk_res->shared_device,renderer_vk_res->pageTableUBO.mem);
-#else
-        vmaUnmapMemory(renderer_vk_res->allocator,renderer_vk_res->pageTableUBO.allocation);
-#endif
+    //只写入改变的项 render每次提交后都会等待完成 不会和着色器的读取冲突
+    void updatePageTable(const std::vector<PageTableItem>& items,const std::vector<PageTable::ValueItem>& missed){
+        page_directory.update(items,missed,renderer_vk_res->pageTableSSBO.mapped_ptr,added_residents);
     }
     void initResources(SliceRendererVulkanSharedResourceWrapper* render_vk_shared_res,
                        VulkanNodeSharedResourceWrapper* node_vk_res){
         this->shared_renderer_vk_res = render_vk_shared_res;
         this->node_vk_res = node_vk_res;
+        fence_pool.init(render_vk_shared_res->shared_device);
 
         auto physical_device = node_vk_res->physicalDevice;
         assert(physical_device);
@@ -480,11 +524,22 @@ struct VulkanSliceRenderer::Impl{
             VK_EXPR(vmaCreateBuffer(renderer_vk_res->allocator,&bufferInfo,&allocInfo,&renderer_vk_res->volumeInfoUBO.buffer,&renderer_vk_res->volumeInfoUBO.allocation,nullptr));
 #endif
 
-            bufferInfo.size = sizeof(HashTable);
+            bufferInfo.size = PageDirectory::BufferSize;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 #ifdef DEBUG_WINDOW
 #else
-            VK_EXPR(vmaCreateBuffer(renderer_vk_res->allocator,&bufferInfo,&allocInfo,&renderer_vk_res->pageTableUBO.buffer,&renderer_vk_res->pageTableUBO.allocation,nullptr));
+            {
+                VmaAllocationCreateInfo ssboAllocInfo{};
+                ssboAllocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+                ssboAllocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+                VmaAllocationInfo info{};
+                VK_EXPR(vmaCreateBuffer(renderer_vk_res->allocator,&bufferInfo,&ssboAllocInfo,&renderer_vk_res->pageTableSSBO.buffer,&renderer_vk_res->pageTableSSBO.allocation,&info));
+                renderer_vk_res->pageTableSSBO.mapped_ptr = info.pMappedData;
+                renderer_vk_res->pageTableSSBO.size = bufferInfo.size;
+                memset(renderer_vk_res->pageTableSSBO.mapped_ptr,0xff,bufferInfo.size);
+            }
 #endif
+            bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 #ifdef DEBUG_WINDOW
             bufferInfo.size = sizeof(RenderInfo);
 #else
@@ -518,9 +573,9 @@ struct VulkanSliceRenderer::Impl{
             volumeBufferInfo.range = sizeof(VolumeInfo);
 
             VkDescriptorBufferInfo pageTableBufferInfo{};
-            pageTableBufferInfo.buffer = renderer_vk_res->pageTableUBO.buffer;
+            pageTableBufferInfo.buffer = renderer_vk_res->pageTableSSBO.buffer;
             pageTableBufferInfo.offset = 0;
-            pageTableBufferInfo.range = sizeof(page_table);
+            pageTableBufferInfo.range = renderer_vk_res->pageTableSSBO.size;
 
             VkDescriptorBufferInfo renderBufferInfo{};
             renderBufferInfo.buffer = renderer_vk_res->renderInfoUBO.buffer;
@@ -557,7 +612,7 @@ struct VulkanSliceRenderer::Impl{
             descriptorWrites[3].dstSet = renderer_vk_res->descriptorSet;
             descriptorWrites[3].dstBinding = 3;
             descriptorWrites[3].dstArrayElement = 0;
-            descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
             descriptorWrites[3].descriptorCount = 1;
             descriptorWrites[3].pBufferInfo = &pageTableBufferInfo;
 
@@ -573,23 +628,70 @@ struct VulkanSliceRenderer::Impl{
 
         }
 
-        //create draw command buffer and record
+        //create result color
+        {
+            render_result = Framebuffer(width,height);
+        }
+        //result download 按照最大的大小创建 每次只拷贝region
+        for(auto& rb:renderer_vk_res->readback){
+            VkBufferCreateInfo bufferCreateInfo{VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+            bufferCreateInfo.size = render_result.getColors().size();
+            bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            VmaAllocationCreateInfo allocInfo{};
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            VmaAllocationInfo info{};
+#ifdef DEBUG_WINDOW
+            createBuffer(node_vk_res->physicalDevice,node_vk_res->device,bufferCreateInfo.size,VK_BUFFER_USAGE_TRANSFER_DST_BIT,VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         rb.buffer,rb.mem);
+            vkMapMemory(render_vk_shared_res->shared_device,rb.mem,0,render_result.getColors().size(),0,&rb.mapped_ptr);
+#else
+            vmaCreateBuffer(renderer_vk_res->allocator,&bufferCreateInfo,&allocInfo,&rb.buffer,&rb.allocation,&info);
+            rb.mapped_ptr = info.pMappedData;
+#endif
+        }
+        //create draw and result copy command buffer and record
+        recordCommands(Rect{0,0,width - 1,height - 1});
+    }
+    /**
+     * @brief 绘制和结果拷贝只覆盖region 结果紧密排列 region变化时才重新录制
+     * scissor是动态的 viewport仍然是整个framebuffer 与shader中的像素坐标一致
+     */
+    void recordCommands(const Rect& region){
+        auto device = shared_renderer_vk_res->shared_device;
+        constexpr int N = Renderer::ReadbackBufferCount;
+        //在途的拷贝命令不能被释放 已经提交的帧按照原来的region读回
+        for(auto& rb:renderer_vk_res->readback){
+            waitReadback(rb);
+        }
+        std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
+        VkCommandBuffer cmds[N + 1];
+        if(recorded_region.min_x >= 0){
+            cmds[0] = renderer_vk_res->drawCommand;
+            for(int i = 0; i < N; i++) cmds[i + 1] = renderer_vk_res->readback[i].copyCommand;
+            vkFreeCommandBuffers(device,shared_renderer_vk_res->shared_graphics_command_pool,N + 1,cmds);
+        }
+        VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocateInfo.commandPool = shared_renderer_vk_res->shared_graphics_command_pool;
+        allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocateInfo.commandBufferCount = N + 1;
+        VK_EXPR(vkAllocateCommandBuffers(device,&allocateInfo,cmds));
+        renderer_vk_res->drawCommand = cmds[0];
+        for(int i = 0; i < N; i++) renderer_vk_res->readback[i].copyCommand = cmds[i + 1];
+
+        VkRect2D area{};
+        area.offset = {region.min_x,region.min_y};
+        area.extent = {static_cast<uint32_t>(region.max_x - region.min_x + 1),
+                       static_cast<uint32_t>(region.max_y - region.min_y + 1)};
+        //draw
         {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            VkCommandBufferAllocateInfo allocateInfo{};
-            allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocateInfo.commandPool = shared_renderer_vk_res->shared_graphics_command_pool;
-            allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocateInfo.commandBufferCount = 1;
-            VK_EXPR(vkAllocateCommandBuffers(shared_renderer_vk_res->shared_device,
-                                             &allocateInfo,&renderer_vk_res->drawCommand));
             VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
             VK_EXPR(vkBeginCommandBuffer(renderer_vk_res->drawCommand,&beginInfo));
             VkRenderPassBeginInfo renderPassInfo{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
             renderPassInfo.renderPass = shared_renderer_vk_res->renderPass;
             renderPassInfo.framebuffer = renderer_vk_res->framebuffer;
-            renderPassInfo.renderArea = {0,0};
-            renderPassInfo.renderArea.extent = {(uint32_t)width,(uint32_t)height};
+            renderPassInfo.renderArea = area;
 
             std::array<VkClearValue,2> clearValues{};
             clearValues[0].color = {0.f,0.f,0.f,0.f};
@@ -604,55 +706,27 @@ struct VulkanSliceRenderer::Impl{
             vkCmdBindPipeline(cmd,VK_PIPELINE_BIND_POINT_GRAPHICS,shared_renderer_vk_res->pipeline);
             vkCmdBindDescriptorSets(cmd,VK_PIPELINE_BIND_POINT_GRAPHICS,shared_renderer_vk_res->pipelineLayout,
                                     0,1,&renderer_vk_res->descriptorSet,0,nullptr);
+            vkCmdSetScissor(cmd,0,1,&area);
             vkCmdDraw(cmd,6,1,0,0);
 
             vkCmdEndRenderPass(cmd);
             VK_EXPR(vkEndCommandBuffer(cmd));
         }
-        //create result color
-        {
-            render_result = Framebuffer(width,height);
-        }
-        //result download
-        {
-            VkBufferCreateInfo bufferCreateInfo{VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
-            bufferCreateInfo.size = render_result.getColors().size();
-            bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-            bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            VmaAllocationCreateInfo allocInfo{};
-            allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
-            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
-            VmaAllocationInfo info{};
-#ifdef DEBUG_WINDOW
-            createBuffer(node_vk_res->physicalDevice,node_vk_res->device,bufferCreateInfo.size,VK_BUFFER_USAGE_TRANSFER_DST_BIT,VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                         renderer_vk_res->result_color.buffer,renderer_vk_res->result_color.mem);
-#else
-            vmaCreateBuffer(renderer_vk_res->allocator,&bufferCreateInfo,&allocInfo,&renderer_vk_res->result_color.buffer,&renderer_vk_res->result_color.allocation,&info);
-#endif
-
-            VkCommandBufferAllocateInfo cmdBufAllocInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
-            cmdBufAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            cmdBufAllocInfo.commandBufferCount = 1;
-            cmdBufAllocInfo.commandPool = render_vk_shared_res->shared_graphics_command_pool;
-            vkAllocateCommandBuffers(device,&cmdBufAllocInfo,&renderer_vk_res->resultCopyCommand);
+        //result copy 之后的绘制和拷贝之间的依赖由render pass的external dependency保证
+        for(auto& rb:renderer_vk_res->readback){
             VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-            VK_EXPR(vkBeginCommandBuffer(renderer_vk_res->resultCopyCommand,&beginInfo));
+            VK_EXPR(vkBeginCommandBuffer(rb.copyCommand,&beginInfo));
             VkBufferImageCopy bufImgCopy{};
             bufImgCopy.bufferOffset = 0;
-            bufImgCopy.bufferRowLength = render_result.getColors().width();
-            bufImgCopy.bufferImageHeight = render_result.getColors().height();
-            bufImgCopy.imageOffset = {0,0,0};
-            bufImgCopy.imageExtent = {(uint32_t)width,(uint32_t)height,1};
+            bufImgCopy.bufferRowLength = area.extent.width;
+            bufImgCopy.bufferImageHeight = area.extent.height;
+            bufImgCopy.imageOffset = {area.offset.x,area.offset.y,0};
+            bufImgCopy.imageExtent = {area.extent.width,area.extent.height,1};
             bufImgCopy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT,0,0,1};
-            vkCmdCopyImageToBuffer(renderer_vk_res->resultCopyCommand,renderer_vk_res->colorAttachment.image,VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,renderer_vk_res->result_color.buffer,1,&bufImgCopy);
-            VK_EXPR(vkEndCommandBuffer(renderer_vk_res->resultCopyCommand));
-#ifdef DEBUG_WINDOW
-            vkMapMemory(render_vk_shared_res->shared_device,renderer_vk_res->result_color.mem,0,render_result.getColors().size(),0,&result_color_mapped_ptr);
-#else
-//            vmaMapMemory(renderer_vk_res->allocator,renderer_vk_res->result_color.allocation,&result_color_mapped_ptr);
-            result_color_mapped_ptr = info.pMappedData;
-#endif
+            vkCmdCopyImageToBuffer(rb.copyCommand,renderer_vk_res->colorAttachment.image,VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,rb.buffer,1,&bufImgCopy);
+            VK_EXPR(vkEndCommandBuffer(rb.copyCommand));
         }
+        recorded_region = region;
     }
     VkCommandBuffer beginSingleTimeCommand(){
         assert(shared_renderer_vk_res);
@@ -676,17 +750,18 @@ struct VulkanSliceRenderer::Impl{
     }
     void endSingleTimeCommand(VkCommandBuffer commandBuffer){
         assert(shared_renderer_vk_res);
-        std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-        vkEndCommandBuffer(commandBuffer);
-
+        {
+            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
+            vkEndCommandBuffer(commandBuffer);
+        }
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &commandBuffer;
 
-        vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue,1,&submitInfo,VK_NULL_HANDLE);
-        vkQueueWaitIdle(shared_renderer_vk_res->shared_graphics_queue);
+        submitAndWait(fence_pool,shared_renderer_vk_res->shared_graphics_queue,shared_renderer_vk_res->pool_mtx,submitInfo);
 
+        std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
         vkFreeCommandBuffers(shared_renderer_vk_res->shared_device,
                              shared_renderer_vk_res->shared_graphics_command_pool,
                              1,&commandBuffer);
@@ -851,7 +926,7 @@ static void CreateVulkanSliceRendererSharedResources(
         VkDescriptorSetLayoutBinding pageTableBinding{};
         pageTableBinding.binding = 3;
         pageTableBinding.descriptorCount = 1;
-        pageTableBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        pageTableBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
         pageTableBinding.pImmutableSamplers = nullptr;
         pageTableBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
@@ -969,6 +1044,12 @@ static void CreateVulkanSliceRendererSharedResources(
 
         VK_EXPR(vkCreatePipelineLayout(device,&pipelineLayoutInfo,nullptr,&renderer_vk_res->pipelineLayout));
 
+        //region变化时只需要重新录制命令 不用重建管线
+        VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicState{VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
+        dynamicState.dynamicStateCount = 1;
+        dynamicState.pDynamicStates = dynamicStates;
+
         VkGraphicsPipelineCreateInfo pipelineInfo{};
         pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
         pipelineInfo.stageCount = 2;
@@ -980,6 +1061,7 @@ static void CreateVulkanSliceRendererSharedResources(
         pipelineInfo.pMultisampleState = &multisampling;
         pipelineInfo.pDepthStencilState = &depthStencil;
         pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
         pipelineInfo.layout = renderer_vk_res->pipelineLayout;
         pipelineInfo.renderPass = renderer_vk_res->renderPass;
         pipelineInfo.subpass = 0;
@@ -991,11 +1073,13 @@ static void CreateVulkanSliceRendererSharedResources(
     }
     //create descriptor pool
     {
-        std::array<VkDescriptorPoolSize,2> poolSize{};
+        std::array<VkDescriptorPoolSize,3> poolSize{};
         poolSize[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
         poolSize[0].descriptorCount = max_renderer_num * (5+1);
         poolSize[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         poolSize[1].descriptorCount = max_renderer_num * (2+1);
+        poolSize[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSize[2].descriptorCount = max_renderer_num * (1+1);
 
         VkDescriptorPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -1016,6 +1100,14 @@ const Framebuffer &VulkanSliceRenderer::getFrameBuffers() const
 {
     return impl->getFrameRenderResult();
 }
+uint64_t VulkanSliceRenderer::submitReadback()
+{
+    return impl->submitReadback();
+}
+FramebufferView VulkanSliceRenderer::acquireReadback(uint64_t frame)
+{
+    return impl->acquireReadback(frame);
+}
 void VulkanSliceRenderer::render(const Slice &slice)
 {
     float step = impl->volume_info.voxel * SliceHelper::SliceStepVoxelRatio;
@@ -1066,7 +1158,12 @@ void VulkanSliceRenderer::setTransferFunction(const TransferFunction& tf)
 }
 void VulkanSliceRenderer::updatePageTable(const std::vector<PageTableItem> &items)
 {
-    impl->updatePageTable(items);
+    impl->updatePageTable(items,{});
+}
+void VulkanSliceRenderer::updatePageTable(const std::vector<PageTableItem> &items,
+                                          const std::vector<PageTable::ValueItem> &missedBlocks)
+{
+    impl->updatePageTable(items,missedBlocks);
 }
 
 }
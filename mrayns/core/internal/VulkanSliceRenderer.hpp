@@ -14,10 +14,13 @@ class VulkanSliceRenderer:public SliceRenderer{
     void setVolume(const Volume&) override;
     Type getRendererType() const override;
     const Framebuffer& getFrameBuffers() const override;
+    uint64_t submitReadback() override;
+    FramebufferView acquireReadback(uint64_t frame) override;
     void render(const Slice&) override;
     void render(const SliceExt& slice,RenderType type) override;
     void setTransferFunction(const TransferFunction&) override;
     void updatePageTable(const std::vector<PageTableItem>&) override;
+    void updatePageTable(const std::vector<PageTableItem>&,const std::vector<PageTable::ValueItem>&) override;
 
     static VulkanSliceRenderer* Create(VulkanNodeSharedResourceWrapper*);
 
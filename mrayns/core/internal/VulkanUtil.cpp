@@ -330,6 +330,53 @@ struct VulkanInstance::Impl{
 };
 
 
+void FencePool::init(VkDevice device)
+{
+    this->device = device;
+}
+
+VkFence FencePool::acquire()
+{
+    assert(device);
+    if(!free_fences.empty()){
+        auto fence = free_fences.back();
+        free_fences.pop_back();
+        return fence;
+    }
+    VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    VkFence fence;
+    VK_EXPR(vkCreateFence(device,&fenceInfo,nullptr,&fence));
+    fences.push_back(fence);
+    return fence;
+}
+
+void FencePool::release(VkFence fence)
+{
+    if(fence == VK_NULL_HANDLE) return;
+    VK_EXPR(vkResetFences(device,1,&fence));
+    free_fences.push_back(fence);
+}
+
+void FencePool::destroy()
+{
+    for(auto fence:fences){
+        vkDestroyFence(device,fence,nullptr);
+    }
+    fences.clear();
+    free_fences.clear();
+}
+
+void submitAndWait(FencePool& fencePool,VkQueue queue,std::mutex& queueMutex,const VkSubmitInfo& submitInfo)
+{
+    auto fence = fencePool.acquire();
+    {
+        std::lock_guard<std::mutex> lk(queueMutex);
+        VK_EXPR(vkQueueSubmit(queue,1,&submitInfo,fence));
+    }
+    VK_EXPR(vkWaitForFences(fencePool.getDevice(),1,&fence,VK_TRUE,UINT64_MAX));
+    fencePool.release(fence);
+}
+
 VulkanInstance &VulkanInstance::getInstance()
 {
     static VulkanInstance vk_instance;
@@ -152,6 +152,37 @@ std::vector<char> readShaderFile(const std::string& filename);
 
 VkShaderModule createShaderModule(VkDevice device,const std::vector<char>& code);
 
+/**
+ * @brief 可复用的fence 每个Renderer持有一个 避免每次提交都创建和销毁fence
+ * 不是线程安全的 和Renderer一样只在一个线程中使用
+ */
+class FencePool{
+  public:
+    void init(VkDevice device);
+
+    //返回未触发状态的fence
+    VkFence acquire();
+
+    //fence必须已经触发或者没有被提交过
+    void release(VkFence fence);
+
+    void destroy();
+
+    VkDevice getDevice() const{ return device; }
+
+  private:
+    VkDevice device{VK_NULL_HANDLE};
+    std::vector<VkFence> free_fences;
+    std::vector<VkFence> fences;
+};
+
+/**
+ * @brief 提交到同一个GPU上renderer共享的队列 只等待这次提交完成
+ * 不使用vkQueueWaitIdle 其它renderer的提交可以同时在GPU上执行
+ * @param queueMutex 保护共享队列的锁 只在提交时持有 等待时不持有
+ */
+void submitAndWait(FencePool& fencePool,VkQueue queue,std::mutex& queueMutex,const VkSubmitInfo& submitInfo);
+
 using Vertex = ::mrayns::Vertex;
 
 VkVertexInputBindingDescription getVertexBindingDescription();
@@ -158,7 +158,7 @@ struct VolumeRendererVulkanPrivateResourceWrapper{
 //renderer是被单线程调用的 所以不需要考虑加锁
 struct VulkanVolumeRenderer::Impl{
     std::unique_ptr<VolumeRendererVulkanPrivateResourceWrapper> renderer_vk_res;
-    VolumeRendererVulkanSharedResourceWrapper* shared_renderer_vk_res;
+    VolumeRendererVulkanSharedResourceWrapper* shared_renderer_vk_res = nullptr;
     VulkanNodeSharedResourceWrapper* node_vk_res;
     Framebuffer render_result;
     Volume volume;
@@ -182,6 +182,7 @@ struct VulkanVolumeRenderer::Impl{
         Vector4f inv_texture_shape[GPUResource::DefaultMaxGPUTextureCount] = {Vector4f{0.f}};
     } volume_info;
     void* result_color_mapped_ptr = nullptr;
+    FencePool fence_pool;
     /**
      * everytime after setting new volume should re-create it
      * everytime setting page table should memset zero first
@@ -349,18 +350,7 @@ struct VulkanVolumeRenderer::Impl{
         VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &renderer_vk_res->drawCommand;
-        VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
-        VkFence fence;
-        {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            VK_EXPR(vkCreateFence(shared_renderer_vk_res->shared_device, &fenceInfo, nullptr, &fence));
-            VK_EXPR(vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue,1,&submitInfo,fence));
-        }
-        VK_EXPR(vkWaitForFences(shared_renderer_vk_res->shared_device,1,&fence,VK_TRUE,UINT64_MAX));
-        {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            vkDestroyFence(shared_renderer_vk_res->shared_device, fence, nullptr);
-        }
+        submitAndWait(fence_pool,shared_renderer_vk_res->shared_graphics_queue,shared_renderer_vk_res->pool_mtx,submitInfo);
         STOP_TIMER("vulkan render")
 
 #ifdef DEBUG_WINDOW
@@ -427,18 +417,7 @@ struct VulkanVolumeRenderer::Impl{
         VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &renderer_vk_res->resultCopyCommand;
-        VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
-        VkFence fence;
-        {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            VK_EXPR(vkCreateFence(shared_renderer_vk_res->shared_device, &fenceInfo, nullptr, &fence));
-            VK_EXPR(vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue, 1, &submitInfo, fence));
-        }
-        VK_EXPR(vkWaitForFences(shared_renderer_vk_res->shared_device,1,&fence,VK_TRUE,UINT64_MAX));
-        {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            vkDestroyFence(shared_renderer_vk_res->shared_device, fence, nullptr);
-        }
+        submitAndWait(fence_pool,shared_renderer_vk_res->shared_graphics_queue,shared_renderer_vk_res->pool_mtx,submitInfo);
 
         ::memcpy(render_result.getColors().data(),result_color_mapped_ptr,render_result.getColors().size());
 
@@ -449,7 +428,7 @@ struct VulkanVolumeRenderer::Impl{
     }
 
     void destroy(){
-
+        fence_pool.destroy();
     }
     //todo check if volume is same as prev
     void setVolume(const Volume& volume){
@@ -731,17 +710,18 @@ struct VulkanVolumeRenderer::Impl{
     }
     void endSingleTimeCommand(VkCommandBuffer commandBuffer){
         assert(shared_renderer_vk_res);
-        std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-        vkEndCommandBuffer(commandBuffer);
-
+        {
+            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
+            vkEndCommandBuffer(commandBuffer);
+        }
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &commandBuffer;
 
-        vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue,1,&submitInfo,VK_NULL_HANDLE);
-        vkQueueWaitIdle(shared_renderer_vk_res->shared_graphics_queue);
+        submitAndWait(fence_pool,shared_renderer_vk_res->shared_graphics_queue,shared_renderer_vk_res->pool_mtx,submitInfo);
 
+        std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
         vkFreeCommandBuffers(shared_renderer_vk_res->shared_device,
                              shared_renderer_vk_res->shared_graphics_command_pool,
                              1,&commandBuffer);
@@ -798,6 +778,7 @@ struct VulkanVolumeRenderer::Impl{
 
         this->shared_renderer_vk_res = render_vk_shared_res;
         this->node_vk_res = node_vk_res;
+        fence_pool.init(render_vk_shared_res->shared_device);
 
         auto physical_device = node_vk_res->physicalDevice;
         assert(physical_device);
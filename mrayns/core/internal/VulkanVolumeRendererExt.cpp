@@ -4,9 +4,11 @@
 #include "VulkanVolumeRendererExt.hpp"
 #include "../../common/Logger.hpp"
 #include "../../algorithm/ColorMapping.hpp"
+#include "../../algorithm/OccupancyHelper.hpp"
 #include "../../geometry/Mesh.hpp"
 #include "../../utils/Timer.hpp"
 #include "../GPUResource.hpp"
+#include "../VolumeBlockStatistics.hpp"
 #include <array>
 #include "../../Config.hpp"
 #include "../../algorithm/GeometryHelper.hpp"
@@ -55,14 +57,20 @@ struct VolumeRendererExtVulkanPrivateResourceWrapper{
 
     FramebufferAttachment colorAttachment;
 
-    struct{
+    //每个读回缓冲有自己的拷贝命令和fence 上一帧的拷贝可以在下一帧绘制时仍然在途
+    struct ReadbackBuffer{
         VkBuffer buffer;
 #ifdef DEBUG_WINDOW
         VkDeviceMemory mem;
 #else
         VmaAllocation allocation;
 #endif
-    }result_color;
+        void* mapped_ptr{nullptr};
+        VkCommandBuffer copyCommand;
+        VkFence fence{VK_NULL_HANDLE};
+        uint64_t frame{0};
+    };
+    ReadbackBuffer readback[Renderer::ReadbackBufferCount];
 
     struct{
         VkImage image;
@@ -98,16 +106,18 @@ struct VolumeRendererExtVulkanPrivateResourceWrapper{
 
     SSBO renderPassTagSSBO;
 
+    //每个常驻块的占用位图 按照页目录中的常驻块编号索引
+    SSBO occupancySSBO;
+
     VkFramebuffer firstFramebuffer;
     VkFramebuffer secondFramebuffer;
 
     VkCommandBuffer firstDrawCommand;
     VkCommandBuffer secondDrawCommand;
-    VkCommandBuffer resultCopyCommand;
 
     VmaAllocator allocator;
 
-    UBO pageTableUBO;
+    SSBO pageTableSSBO;
 
     struct{
         VkBuffer vertexBuffer;
@@ -127,7 +137,7 @@ struct VolumeRendererExtVulkanPrivateResourceWrapper{
 
 struct VulkanVolumeRendererExt::Impl{
     std::unique_ptr<VolumeRendererExtVulkanPrivateResourceWrapper> renderer_vk_res;
-    VolumeRendererExtVulkanSharedResourceWrapper* shared_renderer_vk_res;
+    VolumeRendererExtVulkanSharedResourceWrapper* shared_renderer_vk_res = nullptr;
     VulkanNodeSharedResourceWrapper* node_vk_res;
     Framebuffer render_result;
     Volume volume;
@@ -152,10 +162,18 @@ struct VulkanVolumeRendererExt::Impl{
         float voxel;
         uint32_t padding3 = 4;
         Vector4f inv_texture_shape[GPUResource::DefaultMaxGPUTextureCount] = {Vector4f{0.f}};
+        PageDirectory::LodInfo lod_page_directory[PageDirectory::MaxLod];
     } volume_info;
-    void* result_color_mapped_ptr = nullptr;
-    using HashTable = ::mrayns::internal::MappingTable::HashTable;
-    HashTable page_table;
+    FencePool fence_pool;
+    uint64_t readback_frame_count{0};
+    PageDirectory page_directory;
+    std::vector<uint32_t> added_residents;
+    std::shared_ptr<VolumeBlockStatistics> block_statistics;
+    TransferFunctionOpacityTable opacity_table;
+    bool opacity_table_valid = false;
+    //occupancy_exact[id]表示常驻块id的占用位图已经按照统计信息计算 否则为全部占用
+    std::vector<uint8_t> occupancy_exact;
+    std::unique_ptr<VolumeBlockStatistics::CellRange> cell_range;
     struct RenderInfo{
         Vector3f view_pos;
         float ray_dist;
@@ -312,7 +330,11 @@ struct VulkanVolumeRendererExt::Impl{
         destroy();
     }
     void destroy(){
-
+        if(!shared_renderer_vk_res) return;
+        for(auto& rb:renderer_vk_res->readback){
+            waitReadback(rb);
+        }
+        fence_pool.destroy();
     }
     void setVolume(const Volume& volume){
         if(!volume.isValid()){
@@ -383,20 +405,49 @@ struct VulkanVolumeRendererExt::Impl{
 #endif
         LOG_INFO("successfully upload transfer function");
     }
-    void updatePageTable(const std::vector<PageTableItem>& items){
-        page_table.clear();
-        for(const auto& item:items){
-            page_table.append({item.second,item.first});
+    //直接写入映射的内存 renderPass每次提交后都会等待完成 不会和着色器的读取冲突
+    void updatePageTable(const std::vector<PageTableItem>& items,const std::vector<PageTable::ValueItem>& missed,
+                         const std::vector<PageTable::ValueItem>& empty){
+        page_directory.update(items,missed,empty,renderer_vk_res->pageTableSSBO.mapped_ptr,added_residents);
+        for(auto id:added_residents){
+            occupancy_exact[id] = 0;
+        }
+        updateOccupancyGrid();
+    }
+    void setBlockStatistics(std::shared_ptr<VolumeBlockStatistics> statistics){
+        block_statistics = std::move(statistics);
+        resetOccupancyGrid();
+    }
+    void setOpacityTable(const TransferFunctionExt1D& tf){
+        opacity_table.build(tf);
+        opacity_table_valid = true;
+        resetOccupancyGrid();
+    }
+    void resetOccupancyGrid(){
+        std::fill(occupancy_exact.begin(),occupancy_exact.end(),0);
+        updateOccupancyGrid();
+    }
+    void updateOccupancyGrid(){
+        auto occupancy = reinterpret_cast<OccupancyHelper::Occupancy*>(renderer_vk_res->occupancySSBO.mapped_ptr);
+        if(!occupancy) return;
+        for(uint32_t id = 0; id < PageDirectory::MaxResidentCount; id++){
+            if(occupancy_exact[id]) continue;
+            const auto& block = page_directory.getResidentBlock(id);
+            if(!block.isValid()) continue;
+            if(opacity_table_valid && block_statistics && block_statistics->queryCellRange(block,*cell_range)){
+                OccupancyHelper::ComputeOccupancy(*cell_range,opacity_table,occupancy[id]);
+                occupancy_exact[id] = 1;
+            }
+            else{
+                //统计信息可能稍后才会记录 下次更新时重新计算
+                OccupancyHelper::FillOccupancy(occupancy[id],true);
+            }
         }
-
-        uploadPageTable();
     }
     bool renderPass(const VolumeRendererCamera& camera,bool newFrame){
         //
         memset(renderer_vk_res->renderPassTagSSBO.mapped_ptr,0,renderer_vk_res->renderPassTagSSBO.size);
         //submit draw command
-        VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
-        VkFence fence;
         VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
         submitInfo.commandBufferCount = 1;
         if(newFrame){
@@ -407,16 +458,7 @@ struct VulkanVolumeRendererExt::Impl{
             submitInfo.pCommandBuffers = &renderer_vk_res->secondDrawCommand;
         }
 
-        {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            VK_EXPR(vkCreateFence(shared_renderer_vk_res->shared_device, &fenceInfo, nullptr, &fence));
-            VK_EXPR(vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue,1,&submitInfo,fence));
-        }
-        VK_EXPR(vkWaitForFences(shared_renderer_vk_res->shared_device,1,&fence,VK_TRUE,UINT64_MAX));
-        {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            vkDestroyFence(shared_renderer_vk_res->shared_device, fence, nullptr);
-        }
+        submitAndWait(fence_pool,shared_renderer_vk_res->shared_graphics_queue,shared_renderer_vk_res->pool_mtx,submitInfo);
 #ifdef DEBUG_WINDOW
         debug.submit(shared_renderer_vk_res->shared_graphics_queue);
 #endif
@@ -429,26 +471,53 @@ struct VulkanVolumeRendererExt::Impl{
         return tag == 0;
     }
     const Framebuffer& getFrameRenderResult(){
-        transitionImageLayout(renderer_vk_res->colorAttachment.image,renderer_vk_res->colorAttachment.format,VK_IMAGE_LAYOUT_GENERAL,VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        auto view = acquireReadback(submitReadback());
+        if(view.isValid()){
+            ::memcpy(render_result.getColors().data(),view.data(),view.size());
+        }
+        return render_result;
+    }
+
+    uint64_t submitReadback(){
+        uint64_t frame = ++readback_frame_count;
+        auto& rb = renderer_vk_res->readback[frame % Renderer::ReadbackBufferCount];
+        //最早的一帧还没有被取走时会覆盖它
+        waitReadback(rb);
+        rb.fence = fence_pool.acquire();
+        rb.frame = frame;
+
         VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
         submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &renderer_vk_res->resultCopyCommand;
-        VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
-        VkFence fence;
-        {
-            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            VK_EXPR(vkCreateFence(shared_renderer_vk_res->shared_device, &fenceInfo, nullptr, &fence));
-            VK_EXPR(vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue, 1, &submitInfo, fence));
-        }
-        VK_EXPR(vkWaitForFences(shared_renderer_vk_res->shared_device,1,&fence,VK_TRUE,UINT64_MAX));
+        submitInfo.pCommandBuffers = &rb.copyCommand;
         {
             std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-            vkDestroyFence(shared_renderer_vk_res->shared_device, fence, nullptr);
+            VK_EXPR(vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue,1,&submitInfo,rb.fence));
         }
+        return frame;
+    }
 
-        ::memcpy(render_result.getColors().data(),result_color_mapped_ptr,render_result.getColors().size());
+    FramebufferView acquireReadback(uint64_t frame){
+        if(frame == 0){
+            return FramebufferView(getFrameRenderResult().getColors());
+        }
+        auto& rb = renderer_vk_res->readback[frame % Renderer::ReadbackBufferCount];
+        if(rb.frame != frame){
+            LOG_ERROR("readback frame {} has been overwritten",frame);
+            return {};
+        }
+        waitReadback(rb);
+        return {reinterpret_cast<const RGBA*>(rb.mapped_ptr),render_result.getColors().width(),render_result.getColors().height()};
+    }
 
-        return render_result;
+    void waitReadback(VolumeRendererExtVulkanPrivateResourceWrapper::ReadbackBuffer& rb){
+        if(rb.fence == VK_NULL_HANDLE) return;
+        VK_EXPR(vkWaitForFences(shared_renderer_vk_res->shared_device,1,&rb.fence,VK_TRUE,UINT64_MAX));
+        fence_pool.release(rb.fence);
+        rb.fence = VK_NULL_HANDLE;
+#ifndef DEBUG_WINDOW
+        //HOST_ACCESS_RANDOM可能分配到非coherent的内存
+        VK_EXPR(vmaInvalidateAllocation(renderer_vk_res->allocator,rb.allocation,0,VK_WHOLE_SIZE));
+#endif
     }
 
     void updateRenderParamsUBO(const VolumeRendererCamera& camera){
@@ -544,6 +613,11 @@ struct VulkanVolumeRendererExt::Impl{
 
         volume_info.voxel = std::min({volume_info.volume_space.x, volume_info.volume_space.y, volume_info.volume_space.z});
 
+        //页目录的布局由体数据决定 之前的常驻块全部失效
+        page_directory.reset(volume,renderer_vk_res->pageTableSSBO.mapped_ptr);
+        std::copy(std::begin(page_directory.lods),std::end(page_directory.lods),volume_info.lod_page_directory);
+        resetOccupancyGrid();
+
         //upload
         uploadVolumeInfoUBO();
     }
@@ -661,20 +735,6 @@ struct VulkanVolumeRendererExt::Impl{
 
 //        vmaDestroyBuffer(renderer_vk_res->allocator,stagingBuffer,allocation);
     }
-    void uploadPageTable(){
-        void* data;
-#ifdef DEBUG_WINDOW
-        vkMapMemory(shared_renderer_vk_res->shared_device,renderer_vk_res->pageTableUBO.mem,0,sizeof(HashTable),0,&data);
-#else
-        VK_EXPR(vmaMapMemory(renderer_vk_res->allocator,renderer_vk_res->pageTableUBO.allocation,&data));
-#endif
-        memcpy(data,&page_table,sizeof(page_table));
-#ifdef DEBUG_WINDOW
-        vkUnmapMemory(shared_renderer_vk_res->shared_device,renderer_vk_res->pageTableUBO.mem);
-#else
-        vmaUnmapMemory(renderer_vk_res->allocator,renderer_vk_res->pageTableUBO.allocation);
-#endif
-    }
 
     VkCommandBuffer beginSingleTimeCommand(){
         assert(shared_renderer_vk_res);
@@ -698,17 +758,18 @@ struct VulkanVolumeRendererExt::Impl{
     }
     void endSingleTimeCommand(VkCommandBuffer commandBuffer){
         assert(shared_renderer_vk_res);
-        std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
-        vkEndCommandBuffer(commandBuffer);
-
+        {
+            std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
+            vkEndCommandBuffer(commandBuffer);
+        }
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &commandBuffer;
 
-        vkQueueSubmit(shared_renderer_vk_res->shared_graphics_queue,1,&submitInfo,VK_NULL_HANDLE);
-        vkQueueWaitIdle(shared_renderer_vk_res->shared_graphics_queue);
+        submitAndWait(fence_pool,shared_renderer_vk_res->shared_graphics_queue,shared_renderer_vk_res->pool_mtx,submitInfo);
 
+        std::lock_guard<std::mutex> lk(shared_renderer_vk_res->pool_mtx);
         vkFreeCommandBuffers(shared_renderer_vk_res->shared_device,
                              shared_renderer_vk_res->shared_graphics_command_pool,
                              1,&commandBuffer);
@@ -774,6 +835,7 @@ struct VulkanVolumeRendererExt::Impl{
 
         this->shared_renderer_vk_res = render_vk_shared_res;
         this->node_vk_res = node_vk_res;
+        fence_pool.init(render_vk_shared_res->shared_device);
 
         auto physical_device = node_vk_res->physicalDevice;
         assert(physical_device);
@@ -974,13 +1036,6 @@ struct VulkanVolumeRendererExt::Impl{
                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,renderer_vk_res->renderInfoUBO.buffer,renderer_vk_res->renderInfoUBO.mem);
 #else
             VK_EXPR(vmaCreateBuffer(renderer_vk_res->allocator,&bufferInfo,&allocInfo,&renderer_vk_res->renderInfoUBO.buffer,&renderer_vk_res->renderInfoUBO.allocation,nullptr));
-#endif
-            bufferInfo.size = sizeof(page_table);
-#ifdef DEBUG_WINDOW
-            internal::createBuffer(node_vk_res->physicalDevice,node_vk_res->device,bufferInfo.size,VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,renderer_vk_res->pageTableUBO.buffer,renderer_vk_res->pageTableUBO.mem);
-#else
-            VK_EXPR(vmaCreateBuffer(renderer_vk_res->allocator,&bufferInfo,&allocInfo,&renderer_vk_res->pageTableUBO.buffer,&renderer_vk_res->pageTableUBO.allocation,nullptr));
 #endif
             bufferInfo.size = sizeof(RenderPassTag);
             bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
@@ -995,6 +1050,34 @@ struct VulkanVolumeRendererExt::Impl{
             renderer_vk_res->renderPassTagSSBO.mapped_ptr = info.pMappedData;
 #endif
             renderer_vk_res->renderPassTagSSBO.size = bufferInfo.size;
+
+            bufferInfo.size = PageDirectory::BufferSize;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+#ifdef DEBUG_WINDOW
+            internal::createBuffer(node_vk_res->physicalDevice,node_vk_res->device,bufferInfo.size,VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,renderer_vk_res->pageTableSSBO.buffer,renderer_vk_res->pageTableSSBO.mem);
+            vkMapMemory(render_vk_shared_res->shared_device,renderer_vk_res->pageTableSSBO.mem,0,bufferInfo.size,0,&renderer_vk_res->pageTableSSBO.mapped_ptr);
+#else
+            VK_EXPR(vmaCreateBuffer(renderer_vk_res->allocator,&bufferInfo,&allocInfo,&renderer_vk_res->pageTableSSBO.buffer,&renderer_vk_res->pageTableSSBO.allocation,&info));
+            renderer_vk_res->pageTableSSBO.mapped_ptr = info.pMappedData;
+#endif
+            renderer_vk_res->pageTableSSBO.size = bufferInfo.size;
+            memset(renderer_vk_res->pageTableSSBO.mapped_ptr,0xff,bufferInfo.size);
+
+            bufferInfo.size = sizeof(OccupancyHelper::Occupancy) * PageDirectory::MaxResidentCount;
+#ifdef DEBUG_WINDOW
+            internal::createBuffer(node_vk_res->physicalDevice,node_vk_res->device,bufferInfo.size,VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,renderer_vk_res->occupancySSBO.buffer,renderer_vk_res->occupancySSBO.mem);
+            vkMapMemory(render_vk_shared_res->shared_device,renderer_vk_res->occupancySSBO.mem,0,bufferInfo.size,0,&renderer_vk_res->occupancySSBO.mapped_ptr);
+#else
+            VK_EXPR(vmaCreateBuffer(renderer_vk_res->allocator,&bufferInfo,&allocInfo,&renderer_vk_res->occupancySSBO.buffer,&renderer_vk_res->occupancySSBO.allocation,&info));
+            renderer_vk_res->occupancySSBO.mapped_ptr = info.pMappedData;
+#endif
+            renderer_vk_res->occupancySSBO.size = bufferInfo.size;
+            //没有统计信息时不跳过任何cell
+            memset(renderer_vk_res->occupancySSBO.mapped_ptr,0xff,bufferInfo.size);
+            occupancy_exact.assign(PageDirectory::MaxResidentCount,0);
+            cell_range = std::make_unique<VolumeBlockStatistics::CellRange>();
         }
         //create descriptor sets
         {
@@ -1083,16 +1166,21 @@ struct VulkanVolumeRendererExt::Impl{
                 volumeBufferInfo.range = sizeof(VolumeInfo);
 
                 VkDescriptorBufferInfo pageTableBufferInfo{};
-                pageTableBufferInfo.buffer = renderer_vk_res->pageTableUBO.buffer;
+                pageTableBufferInfo.buffer = renderer_vk_res->pageTableSSBO.buffer;
                 pageTableBufferInfo.offset = 0;
-                pageTableBufferInfo.range = sizeof(page_table);
+                pageTableBufferInfo.range = renderer_vk_res->pageTableSSBO.size;
 
                 VkDescriptorBufferInfo renderBufferInfo{};
                 renderBufferInfo.buffer = renderer_vk_res->renderInfoUBO.buffer;
                 renderBufferInfo.offset = 0;
                 renderBufferInfo.range = sizeof(RenderInfo);
 
-                std::array<VkWriteDescriptorSet,9> descriptorWrites{};
+                VkDescriptorBufferInfo occupancyBufferInfo{};
+                occupancyBufferInfo.buffer = renderer_vk_res->occupancySSBO.buffer;
+                occupancyBufferInfo.offset = 0;
+                occupancyBufferInfo.range = renderer_vk_res->occupancySSBO.size;
+
+                std::array<VkWriteDescriptorSet,10> descriptorWrites{};
                 descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
                 descriptorWrites[0].dstSet = renderer_vk_res->descriptorSet.raycast;
                 descriptorWrites[0].dstBinding = 0;
@@ -1153,7 +1241,7 @@ struct VulkanVolumeRendererExt::Impl{
                 descriptorWrites[7].dstSet = renderer_vk_res->descriptorSet.raycast;
                 descriptorWrites[7].dstBinding = 7;
                 descriptorWrites[7].dstArrayElement = 0;
-                descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
                 descriptorWrites[7].descriptorCount = 1;
                 descriptorWrites[7].pBufferInfo = &pageTableBufferInfo;
 
@@ -1165,6 +1253,14 @@ struct VulkanVolumeRendererExt::Impl{
                 descriptorWrites[8].descriptorCount = 1;
                 descriptorWrites[8].pBufferInfo = &renderBufferInfo;
 
+                descriptorWrites[9].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[9].dstSet = renderer_vk_res->descriptorSet.raycast;
+                descriptorWrites[9].dstBinding = 9;
+                descriptorWrites[9].dstArrayElement = 0;
+                descriptorWrites[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                descriptorWrites[9].descriptorCount = 1;
+                descriptorWrites[9].pBufferInfo = &occupancyBufferInfo;
+
                 vkUpdateDescriptorSets(device,descriptorWrites.size(),descriptorWrites.data(),0,nullptr);
             }
         }
@@ -1273,7 +1369,8 @@ struct VulkanVolumeRendererExt::Impl{
             }
         }
         //result download
-        {
+        //颜色附件在绘制之后是GENERAL 拷贝前后在同一个命令缓冲中转换布局 不需要额外的提交和等待
+        for(auto& rb:renderer_vk_res->readback){
             VkBufferCreateInfo bufferCreateInfo{VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
             bufferCreateInfo.size = render_result.getColors().size();
             bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
@@ -1281,20 +1378,36 @@ struct VulkanVolumeRendererExt::Impl{
             VmaAllocationCreateInfo allocInfo{};
             allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
             allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            VmaAllocationInfo info{};
 #ifdef DEBUG_WINDOW
             createBuffer(node_vk_res->physicalDevice,node_vk_res->device,bufferCreateInfo.size,VK_BUFFER_USAGE_TRANSFER_DST_BIT,VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                         renderer_vk_res->result_color.buffer,renderer_vk_res->result_color.mem);
+                         rb.buffer,rb.mem);
+            vkMapMemory(render_vk_shared_res->shared_device,rb.mem,0,render_result.getColors().size(),0,&rb.mapped_ptr);
 #else
-            vmaCreateBuffer(renderer_vk_res->allocator,&bufferCreateInfo,&allocInfo,&renderer_vk_res->result_color.buffer,&renderer_vk_res->result_color.allocation,nullptr);
+            vmaCreateBuffer(renderer_vk_res->allocator,&bufferCreateInfo,&allocInfo,&rb.buffer,&rb.allocation,&info);
+            rb.mapped_ptr = info.pMappedData;
 #endif
 
             VkCommandBufferAllocateInfo cmdBufAllocInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
             cmdBufAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
             cmdBufAllocInfo.commandBufferCount = 1;
             cmdBufAllocInfo.commandPool = render_vk_shared_res->shared_graphics_command_pool;
-            vkAllocateCommandBuffers(device,&cmdBufAllocInfo,&renderer_vk_res->resultCopyCommand);
+            vkAllocateCommandBuffers(device,&cmdBufAllocInfo,&rb.copyCommand);
             VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-            VK_EXPR(vkBeginCommandBuffer(renderer_vk_res->resultCopyCommand,&beginInfo));
+            VK_EXPR(vkBeginCommandBuffer(rb.copyCommand,&beginInfo));
+
+            VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = renderer_vk_res->colorAttachment.image;
+            barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1};
+            barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(rb.copyCommand,VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0,0,nullptr,0,nullptr,1,&barrier);
+
             VkBufferImageCopy bufImgCopy{};
             bufImgCopy.bufferOffset = 0;
             bufImgCopy.bufferRowLength = render_result.getColors().width();
@@ -1302,13 +1415,16 @@ struct VulkanVolumeRendererExt::Impl{
             bufImgCopy.imageOffset = {0,0,0};
             bufImgCopy.imageExtent = {(uint32_t)width,(uint32_t)height,1};
             bufImgCopy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT,0,0,1};
-            vkCmdCopyImageToBuffer(renderer_vk_res->resultCopyCommand,renderer_vk_res->colorAttachment.image,VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,renderer_vk_res->result_color.buffer,1,&bufImgCopy);
-            VK_EXPR(vkEndCommandBuffer(renderer_vk_res->resultCopyCommand));
-#ifdef DEBUG_WINDOW
-            vkMapMemory(render_vk_shared_res->shared_device,renderer_vk_res->result_color.mem,0,render_result.getColors().size(),0,&result_color_mapped_ptr);
-#else
-            vmaMapMemory(renderer_vk_res->allocator,renderer_vk_res->result_color.allocation,&result_color_mapped_ptr);
-#endif
+            vkCmdCopyImageToBuffer(rb.copyCommand,renderer_vk_res->colorAttachment.image,VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,rb.buffer,1,&bufImgCopy);
+
+            //恢复为GENERAL 之后的pass可以继续在这一帧上绘制
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            vkCmdPipelineBarrier(rb.copyCommand,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                 0,0,nullptr,0,nullptr,1,&barrier);
+            VK_EXPR(vkEndCommandBuffer(rb.copyCommand));
         }
     }
 };
@@ -1543,7 +1659,7 @@ static void CreateVulkanVolumeRendererExtSharedResources(
             VkDescriptorSetLayoutBinding pageTableBinding{};
             pageTableBinding.binding = 7;
             pageTableBinding.descriptorCount = 1;
-            pageTableBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            pageTableBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
             pageTableBinding.pImmutableSamplers = nullptr;
             pageTableBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
@@ -1554,14 +1670,21 @@ static void CreateVulkanVolumeRendererExtSharedResources(
             renderParamsBinding.pImmutableSamplers = nullptr;
             renderParamsBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-            VkDescriptorSetLayoutBinding bindings[9] = {rayEntryBinding,     rayExitBinding,
+            VkDescriptorSetLayoutBinding occupancyBinding{};
+            occupancyBinding.binding = 9;
+            occupancyBinding.descriptorCount = 1;
+            occupancyBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            occupancyBinding.pImmutableSamplers = nullptr;
+            occupancyBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+            VkDescriptorSetLayoutBinding bindings[10] = {rayEntryBinding,     rayExitBinding,
                                                         interColorBinding, renderPassTagBinding,
                                                         tfBinding,
                                                         cachedVolumeBinding, volumeInfoBinding, pageTableBinding,
-                                                        renderParamsBinding};
+                                                        renderParamsBinding, occupancyBinding};
             VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
             layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-            layoutCreateInfo.bindingCount = 9;
+            layoutCreateInfo.bindingCount = 10;
             layoutCreateInfo.pBindings = bindings;
             VK_EXPR(vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &renderer_vk_res->rayCastLayout));
         }
@@ -1821,13 +1944,13 @@ static void CreateVulkanVolumeRendererExtSharedResources(
     {
         std::array<VkDescriptorPoolSize,4> poolSize{};
         poolSize[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSize[0].descriptorCount = max_renderer_num * (5+1);
+        poolSize[0].descriptorCount = max_renderer_num * (4+1);
         poolSize[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
         poolSize[1].descriptorCount = max_renderer_num * (3+1);
         poolSize[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         poolSize[2].descriptorCount = max_renderer_num * (2+1);
         poolSize[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        poolSize[3].descriptorCount = max_renderer_num * (1 + 1);
+        poolSize[3].descriptorCount = max_renderer_num * (3 + 1);
 
         VkDescriptorPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -1872,19 +1995,44 @@ const Framebuffer &VulkanVolumeRendererExt::getFrameBuffers() const
 {
     return impl->getFrameRenderResult();
 }
+uint64_t VulkanVolumeRendererExt::submitReadback()
+{
+    return impl->submitReadback();
+}
+FramebufferView VulkanVolumeRendererExt::acquireReadback(uint64_t frame)
+{
+    return impl->acquireReadback(frame);
+}
 void VulkanVolumeRendererExt::updatePageTable(const std::vector<PageTableItem> &items)
 {
-    impl->updatePageTable(items);
+    impl->updatePageTable(items,{},{});
+}
+void VulkanVolumeRendererExt::updatePageTable(const std::vector<PageTableItem> &items,
+                                              const std::vector<PageTable::ValueItem> &missedBlocks)
+{
+    impl->updatePageTable(items,missedBlocks,{});
+}
+void VulkanVolumeRendererExt::updatePageTable(const std::vector<PageTableItem> &items,
+                                              const std::vector<PageTable::ValueItem> &missedBlocks,
+                                              const std::vector<PageTable::ValueItem> &emptyBlocks)
+{
+    impl->updatePageTable(items,missedBlocks,emptyBlocks);
 }
 void VulkanVolumeRendererExt::setTransferFunction(const TransferFunction &tf)
 {
     TransferFunctionExt1D tf_ext1d{tf};
     ::mrayns::ComputeTransferFunction1DExt(tf_ext1d);
     impl->setTransferFunction1D(tf_ext1d.tf,tf_ext1d.TFDim,sizeof(tf_ext1d.tf)/sizeof(float));
+    impl->setOpacityTable(tf_ext1d);
 }
 void VulkanVolumeRendererExt::setTransferFunction(const TransferFunctionExt1D &tf)
 {
     impl->setTransferFunction1D(tf.tf,tf.TFDim,sizeof(tf.tf)/sizeof(float));
+    impl->setOpacityTable(tf);
+}
+void VulkanVolumeRendererExt::setBlockStatistics(std::shared_ptr<VolumeBlockStatistics> statistics)
+{
+    impl->setBlockStatistics(std::move(statistics));
 }
 void VulkanVolumeRendererExt::render(const VolumeRendererCamera &camera)
 {
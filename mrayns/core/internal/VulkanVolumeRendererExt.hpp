@@ -14,9 +14,15 @@ class VulkanVolumeRendererExt:public VolumeRendererExt{
     void setVolume(const Volume&) override;
     Type getRendererType() const override;
     const Framebuffer& getFrameBuffers() const override;
+    uint64_t submitReadback() override;
+    FramebufferView acquireReadback(uint64_t frame) override;
     void updatePageTable(const std::vector<PageTableItem>&) override;
+    void updatePageTable(const std::vector<PageTableItem>&,const std::vector<PageTable::ValueItem>&) override;
+    void updatePageTable(const std::vector<PageTableItem>&,const std::vector<PageTable::ValueItem>&,
+                         const std::vector<PageTable::ValueItem>&) override;
     void setTransferFunction(const TransferFunction&) override;
     void setTransferFunction(const TransferFunctionExt1D&) override;
+    void setBlockStatistics(std::shared_ptr<VolumeBlockStatistics>) override;
     void render(const VolumeRendererCamera&) override;
     bool renderPass(const VolumeRendererCamera&,bool) override;
     static VulkanVolumeRendererExt* Create(VulkanNodeSharedResourceWrapper*);
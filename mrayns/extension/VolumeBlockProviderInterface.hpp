@@ -5,7 +5,9 @@
 #include "../core/HostNode.hpp"
 #include "../core/Volume.hpp"
 #include "plugin/PluginDefine.hpp"
+#include "../common/Parrallel.hpp"
 #include <functional>
+#include <vector>
 MRAYNS_BEGIN
 /**
  * @brief
@@ -32,6 +34,46 @@ class IVolumeBlockProviderInterface{
 
     virtual void getVolumeBlock(void* dst,BlockIndex blockIndex,std::function<int(HostNode*)> gpu_selector){}
 
+    /**
+     * @brief Only make sure z-planes in [z0,z1) of the block (with padding) are valid in dst,
+     * other planes may be left untouched. Provider can stop decoding early for axis-aligned slice.
+     * Default implementation decodes the whole block.
+     */
+    virtual void getVolumeBlockRange(void* dst,BlockIndex blockIndex,int z0,int z1){
+        getVolumeBlock(dst,blockIndex);
+    }
+
+    struct BlockRequest{
+        BlockIndex index;
+        void* dst{nullptr};
+        float priority{0.f};//smaller is more urgent
+    };
+    //called once for each request when it finished, may be called concurrently from worker threads
+    using BlockCompletion = std::function<void(const BlockRequest&,bool)>;
+
+    /**
+     * @brief Batch version of getVolumeBlock, return until all requests finished.
+     * Providers can override it to reorder io and share decoders between blocks.
+     * Default implementation calls getVolumeBlock in priority order with a few worker threads.
+     */
+    virtual void getVolumeBlocks(const std::vector<BlockRequest>& requests,const BlockCompletion& onComplete){
+        auto sorted = requests;
+        std::stable_sort(sorted.begin(),sorted.end(),[](const BlockRequest& a,const BlockRequest& b){
+            return a.priority < b.priority;
+        });
+        int worker_count = (std::min)(static_cast<int>(sorted.size()),actual_worker_count(0));
+        parallel_foreach(sorted,[&](int,const BlockRequest& request){
+            bool ok = true;
+            try{
+                getVolumeBlock(request.dst,request.index);
+            }
+            catch(...){
+                ok = false;
+            }
+            if(onComplete) onComplete(request,ok);
+        },worker_count);
+    }
+
 };
 
 DECLARE_PLUGIN_MODULE_ID(IVolumeBlockProviderInterface,"mrayns.core.block-provider")
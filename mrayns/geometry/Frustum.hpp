@@ -84,4 +84,18 @@ struct FrustumExt: public Frustum{
     Vector3f frustum_corners[8];
 };
 
+/**
+ * 切片真正采样到的区域 是一个有向包围盒(OBB)
+ * 三个轴互相正交且已归一化 half_depth为0时退化为矩形
+ */
+struct SliceSlab{
+    Vector3f center;
+    Vector3f x_dir;
+    Vector3f y_dir;
+    Vector3f normal;
+    float half_w;
+    float half_h;
+    float half_depth;
+};
+
 MRAYNS_END
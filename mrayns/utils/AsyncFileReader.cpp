@@ -0,0 +1,390 @@
+//
+// Created by wyz on 2022/5/25.
+//
+#include "AsyncFileReader.hpp"
+#include "../common/Logger.hpp"
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#ifdef WINDOWS
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef MRAYNS_HAS_IO_URING
+#include <liburing.h>
+#endif
+#endif
+
+MRAYNS_BEGIN
+
+struct AsyncFileReader::Impl{
+    //合并后单次读取的上限
+    static constexpr size_t MaxMergeBytes = size_t(16) << 20;
+    static constexpr size_t MaxMergeCount = 64;
+
+    //文件中连续的若干个请求 一次读取
+    struct Batch{
+        uint64_t offset{0};
+        size_t size{0};
+        std::vector<Request> requests;
+#ifndef WINDOWS
+        std::vector<iovec> iov;
+#endif
+    };
+
+    int queue_depth;
+    int thread_count;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::condition_variable done_cv;
+    //按文件偏移排序 读取时从上一次的位置向后取 到末尾后回到开头
+    std::multimap<uint64_t,std::unique_ptr<Batch>> pending;
+    uint64_t head{0};
+    size_t outstanding{0};
+    int in_flight{0};
+    bool stop{false};
+    std::vector<std::thread> workers;
+
+#ifdef WINDOWS
+    HANDLE file{INVALID_HANDLE_VALUE};
+#else
+    int fd{-1};
+#endif
+#ifdef MRAYNS_HAS_IO_URING
+    io_uring ring{};
+    bool use_uring{false};
+    //已经提交给io_uring还没有回收的读取 io_uring出错时用于通知调用者
+    std::unordered_set<Batch*> uring_batches;
+#endif
+
+    Impl(int queueDepth,int threadCount)
+    :queue_depth((std::max)(queueDepth,1)),thread_count((std::max)(threadCount,1))
+    {}
+
+    bool isOpen() const{
+#ifdef WINDOWS
+        return file != INVALID_HANDLE_VALUE;
+#else
+        return fd >= 0;
+#endif
+    }
+
+    void open(const std::string& filename,bool direct){
+        close();
+#ifdef WINDOWS
+        DWORD flags = FILE_FLAG_RANDOM_ACCESS | (direct ? FILE_FLAG_NO_BUFFERING : 0);
+        file = CreateFileA(filename.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,flags,nullptr);
+#else
+        int flags = O_RDONLY;
+#ifdef O_DIRECT
+        if(direct) flags |= O_DIRECT;
+#endif
+        fd = ::open(filename.c_str(),flags);
+#endif
+        if(!isOpen()){
+            throw std::runtime_error("AsyncFileReader open file failed: " + filename);
+        }
+        stop = false;
+#ifdef MRAYNS_HAS_IO_URING
+        use_uring = io_uring_queue_init(queue_depth,&ring,0) == 0;
+        if(use_uring){
+            workers.emplace_back([this](){ uringLoop(); });
+            return;
+        }
+        LOG_ERROR("io_uring init failed, fall back to thread pool");
+#endif
+        for(int i = 0; i < thread_count; i++){
+            workers.emplace_back([this](){ workerLoop(); });
+        }
+    }
+
+    void close(){
+        if(!isOpen()) return;
+        wait();
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            stop = true;
+        }
+        cv.notify_all();
+        for(auto& worker:workers){
+            worker.join();
+        }
+        workers.clear();
+#ifdef MRAYNS_HAS_IO_URING
+        if(use_uring){
+            io_uring_queue_exit(&ring);
+            use_uring = false;
+        }
+#endif
+#ifdef WINDOWS
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+#else
+        ::close(fd);
+        fd = -1;
+#endif
+    }
+
+    bool isAsync() const{
+#ifdef MRAYNS_HAS_IO_URING
+        return use_uring;
+#else
+        return false;
+#endif
+    }
+
+    void submit(std::vector<Request> requests){
+        if(requests.empty()) return;
+        if(!isOpen()){
+            throw std::runtime_error("AsyncFileReader submit before open");
+        }
+        std::sort(requests.begin(),requests.end(),[](const Request& a,const Request& b){
+            return a.offset < b.offset;
+        });
+        std::vector<std::unique_ptr<Batch>> batches;
+        for(auto& request:requests){
+            Batch* last = batches.empty() ? nullptr : batches.back().get();
+            if(last && last->offset + last->size == request.offset && last->size + request.size <= MaxMergeBytes
+                && last->requests.size() < MaxMergeCount){
+                last->size += request.size;
+                last->requests.emplace_back(std::move(request));
+                continue;
+            }
+            batches.emplace_back(std::make_unique<Batch>());
+            batches.back()->offset = request.offset;
+            batches.back()->size = request.size;
+            batches.back()->requests.emplace_back(std::move(request));
+        }
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            outstanding += requests.size();
+            for(auto& batch:batches){
+                auto offset = batch->offset;
+                pending.emplace(offset,std::move(batch));
+            }
+        }
+        cv.notify_all();
+    }
+
+    void wait(){
+        std::unique_lock<std::mutex> lk(mtx);
+        done_cv.wait(lk,[this](){ return outstanding == 0; });
+    }
+
+    //must hold mtx
+    std::unique_ptr<Batch> popBatch(){
+        auto it = pending.lower_bound(head);
+        if(it == pending.end()) it = pending.begin();
+        auto batch = std::move(it->second);
+        pending.erase(it);
+        head = batch->offset + batch->size;
+        return batch;
+    }
+
+    void complete(Batch& batch,bool ok){
+        for(auto& request:batch.requests){
+            if(request.on_complete) request.on_complete(ok);
+        }
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            outstanding -= batch.requests.size();
+        }
+        done_cv.notify_all();
+    }
+
+    //阻塞读取一段连续的范围 读取不完整时继续读剩余的部分
+    bool readRange(void* dst,uint64_t offset,size_t size){
+        auto p = reinterpret_cast<uint8_t*>(dst);
+        while(size > 0){
+#ifdef WINDOWS
+            DWORD n = static_cast<DWORD>((std::min)(size,size_t(1) << 30));
+            OVERLAPPED ov{};
+            ov.Offset = static_cast<DWORD>(offset);
+            ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD read = 0;
+            if(!ReadFile(file,p,n,&read,&ov) || read == 0) return false;
+#else
+            auto read = pread(fd,p,size,static_cast<off_t>(offset));
+            if(read < 0 && errno == EINTR) continue;
+            if(read <= 0) return false;
+#endif
+            p += read;
+            offset += read;
+            size -= read;
+        }
+        return true;
+    }
+
+    //从batch中第done个字节开始逐个请求读完
+    bool readRemain(Batch& batch,size_t done){
+        uint64_t offset = batch.offset;
+        for(auto& request:batch.requests){
+            if(done < request.size){
+                if(!readRange(reinterpret_cast<uint8_t*>(request.dst) + done,offset + done,request.size - done)){
+                    return false;
+                }
+                done = 0;
+            }
+            else{
+                done -= request.size;
+            }
+            offset += request.size;
+        }
+        return true;
+    }
+
+#ifndef WINDOWS
+    void prepareIov(Batch& batch){
+        batch.iov.resize(batch.requests.size());
+        for(size_t i = 0; i < batch.requests.size(); i++){
+            batch.iov[i].iov_base = batch.requests[i].dst;
+            batch.iov[i].iov_len = batch.requests[i].size;
+        }
+    }
+#endif
+
+    void workerLoop(){
+        while(true){
+            std::unique_ptr<Batch> batch;
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                cv.wait(lk,[this](){ return stop || !pending.empty(); });
+                if(pending.empty()) return;
+                batch = popBatch();
+            }
+            bool ok;
+#ifdef WINDOWS
+            ok = readRemain(*batch,0);
+#else
+            prepareIov(*batch);
+            ssize_t read;
+            do{
+                read = preadv(fd,batch->iov.data(),static_cast<int>(batch->iov.size()),static_cast<off_t>(batch->offset));
+            }while(read < 0 && errno == EINTR);
+            ok = read >= 0 && (static_cast<size_t>(read) == batch->size || readRemain(*batch,static_cast<size_t>(read)));
+#endif
+            complete(*batch,ok);
+        }
+    }
+
+#ifdef MRAYNS_HAS_IO_URING
+    /**
+     * 一个线程负责提交和回收 保持最多queue_depth个读取在设备上
+     * 没有读取在进行时在cv上等待新的请求 否则阻塞在完成队列上
+     */
+    void uringLoop(){
+        while(true){
+            std::vector<Batch*> batches;
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                cv.wait(lk,[this](){ return stop || !pending.empty() || in_flight > 0; });
+                if(stop && pending.empty() && in_flight == 0) return;
+                while(in_flight < queue_depth && !pending.empty()){
+                    batches.emplace_back(popBatch().release());
+                    uring_batches.insert(batches.back());
+                    in_flight++;
+                }
+            }
+            for(auto batch:batches){
+                prepareIov(*batch);
+                auto sqe = io_uring_get_sqe(&ring);
+                assert(sqe);
+                io_uring_prep_readv(sqe,fd,batch->iov.data(),static_cast<unsigned>(batch->iov.size()),batch->offset);
+                io_uring_sqe_set_data(sqe,batch);
+            }
+            if(!batches.empty()){
+                io_uring_submit(&ring);
+            }
+            io_uring_cqe* cqe = nullptr;
+            int ret = io_uring_wait_cqe(&ring,&cqe);
+            if(ret == -EINTR) continue;
+            if(ret < 0){
+                LOG_ERROR("io_uring wait cqe failed: {}, fall back to thread pool",-ret);
+                uringFailed();
+                return;
+            }
+            //一次取出所有已经完成的
+            do{
+                std::unique_ptr<Batch> batch(reinterpret_cast<Batch*>(io_uring_cqe_get_data(cqe)));
+                int res = cqe->res;
+                io_uring_cqe_seen(&ring,cqe);
+                bool ok = res >= 0 && (static_cast<size_t>(res) == batch->size || readRemain(*batch,static_cast<size_t>(res)));
+                {
+                    std::lock_guard<std::mutex> lk(mtx);
+                    uring_batches.erase(batch.get());
+                    in_flight--;
+                }
+                complete(*batch,ok);
+            }while(io_uring_peek_cqe(&ring,&cqe) == 0);
+        }
+    }
+
+    /**
+     * 在io线程上不能抛出异常 否则std::terminate并且调用者永远等不到完成
+     * 没有回收的读取按失败完成 排队的请求交给线程池
+     * 先启动线程池再完成失败的读取 保证close等到outstanding为0时workers不再改变
+     */
+    void uringFailed(){
+        std::vector<std::unique_ptr<Batch>> failed;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            for(auto batch:uring_batches){
+                failed.emplace_back(batch);
+            }
+            uring_batches.clear();
+            in_flight = 0;
+            for(int i = 0; i < thread_count; i++){
+                workers.emplace_back([this](){ workerLoop(); });
+            }
+        }
+        for(auto& batch:failed){
+            complete(*batch,false);
+        }
+    }
+#endif
+};
+
+AsyncFileReader::AsyncFileReader(int queueDepth,int threadCount)
+{
+    impl = std::make_unique<Impl>(queueDepth,threadCount);
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+    impl->close();
+}
+
+void AsyncFileReader::open(const std::string &filename,bool direct)
+{
+    impl->open(filename,direct);
+}
+
+void AsyncFileReader::close()
+{
+    impl->close();
+}
+
+bool AsyncFileReader::isAsync() const
+{
+    return impl->isAsync();
+}
+
+void AsyncFileReader::submit(std::vector<Request> requests)
+{
+    impl->submit(std::move(requests));
+}
+
+void AsyncFileReader::wait()
+{
+    impl->wait();
+}
+
+MRAYNS_END
@@ -0,0 +1,51 @@
+//
+// Created by wyz on 2022/5/25.
+//
+#pragma once
+
+#include "../common/Define.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+MRAYNS_BEGIN
+
+/**
+ * @brief Read many byte ranges of one file asynchronously.
+ * Use io_uring on linux when built with liburing (MRAYNS_HAS_IO_URING), otherwise a few threads with blocking reads.
+ * Pending ranges are served in file offset order like an elevator, adjacent ranges are merged into one vectored read.
+ * For direct io, offset size and dst of each request should be aligned to the device block size.
+ */
+class AsyncFileReader{
+  public:
+    struct Request{
+        uint64_t offset{0};
+        size_t size{0};
+        void* dst{nullptr};
+        //called from io thread when the range is read or failed
+        std::function<void(bool)> on_complete;
+    };
+
+    explicit AsyncFileReader(int queueDepth = 64,int threadCount = 4);
+
+    ~AsyncFileReader();
+
+    void open(const std::string& filename,bool direct);
+
+    void close();
+
+    bool isAsync() const;
+
+    void submit(std::vector<Request> requests);
+
+    //wait until all submitted requests completed
+    void wait();
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+MRAYNS_END
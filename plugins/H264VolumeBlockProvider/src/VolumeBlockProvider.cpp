@@ -2,8 +2,15 @@
 // Created by wyz on 2022/2/24.
 //
 #include "VolumeBlockProvider.hpp"
-#include "algorithm/GPUTaskScheduleHelper.hpp"
 #include "common/LRU.hpp"
+#include "common/Logger.hpp"
+#include "common/Parrallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <limits>
+#include <thread>
 extern "C"
 {
 #include <libavcodec/avcodec.h>
@@ -15,15 +22,26 @@ MRAYNS_BEGIN
 struct H264VolumeBlockProvider::Impl{
 
     Impl(){
-        packet_cache = std::make_unique<PacketCacheType>(PacketCacheNum);
+        packet_cache = std::make_unique<PacketCacheType>(std::numeric_limits<size_t>::max());
+        createDecoderPool(std::thread::hardware_concurrency());
     }
-    static constexpr int PacketCacheNum = 1024;
+    //缓存按字节数限制 而不是块的个数
+    static constexpr size_t DefaultPacketCacheBytes = size_t(2) << 30;
+    //每个lod文件打开多个Reader 不同块的读取可以并行
+    static constexpr int ReaderCountPerLod = 4;
     using PacketType = std::vector<std::vector<uint8_t>>;
-    using PacketCacheType = LRUCache<BlockIndex,PacketType>;
+    //缓存中的packet是不可变的 命中时只增加引用计数 不再拷贝
+    using PacketPtr = std::shared_ptr<const PacketType>;
+    using PacketCacheType = LRUCache<BlockIndex,PacketPtr>;
     class PacketReader{
         int min_lod{0},max_lod{0};
         Volume volume;
-        std::unordered_map<int,std::unique_ptr<Reader>> lod_readers;
+        struct LodReader{
+            std::mutex mtx;
+            std::unique_ptr<Reader> reader;
+        };
+        std::unordered_map<int,std::vector<std::unique_ptr<LodReader>>> lod_readers;
+        std::atomic<size_t> next_reader{0};
       public:
         void open(const std::string& filename){
             if(filename.empty()) return;
@@ -32,12 +50,16 @@ struct H264VolumeBlockProvider::Impl{
             min_lod = lod_file.get_min_lod();
             max_lod = lod_file.get_max_lod();
             for(int i =min_lod;i<=max_lod;i++){
-                lod_readers[i] = std::make_unique<Reader>(lod_file.get_lod_file_path(i).c_str());
-                lod_readers[i]->read_header();
+                auto& readers = lod_readers[i];
+                for(int j = 0; j < ReaderCountPerLod; j++){
+                    readers.emplace_back(std::make_unique<LodReader>());
+                    readers.back()->reader = std::make_unique<Reader>(lod_file.get_lod_file_path(i).c_str());
+                    readers.back()->reader->read_header();
+                }
             }
 
             sv::Header header{};
-            lod_readers[min_lod]->read_header(header);
+            lod_readers[min_lod].front()->reader->read_header(header);
             volume.padding = header.padding;
             volume.block_length = std::pow(2,header.log_block_length);
             volume.name = "mouse";
@@ -53,10 +75,24 @@ struct H264VolumeBlockProvider::Impl{
             assert(volume.isValid());
 
         }
+        //Reader内部是文件流 每个Reader同一时间只能被一个线程使用 优先选空闲的Reader
+        //packet在lod文件中的偏移只有sv::Reader知道 所以这里是同步读取 不能交给AsyncFileReader合并和排序
         void readPacket(BlockIndex index,PacketType& packets){
             int lod = index.w;
             assert(lod>=min_lod && lod<=max_lod);
-            lod_readers.at(lod)->read_packet({uint32_t(index.x),uint32_t(index.y),uint32_t(index.z)},packets);
+            auto& readers = lod_readers.at(lod);
+            size_t start = next_reader++;
+            for(size_t i = 0; i < readers.size(); i++){
+                auto& r = readers[(start + i) % readers.size()];
+                std::unique_lock<std::mutex> lk(r->mtx,std::try_to_lock);
+                if(lk.owns_lock()){
+                    r->reader->read_packet({uint32_t(index.x),uint32_t(index.y),uint32_t(index.z)},packets);
+                    return;
+                }
+            }
+            auto& r = readers[start % readers.size()];
+            std::lock_guard<std::mutex> lk(r->mtx);
+            r->reader->read_packet({uint32_t(index.x),uint32_t(index.y),uint32_t(index.z)},packets);
         }
         Volume getVolume(){
             return volume;
@@ -64,22 +100,71 @@ struct H264VolumeBlockProvider::Impl{
     };
     std::unique_ptr<PacketReader> packet_reader;
     std::unique_ptr<PacketCacheType> packet_cache;
+    size_t packet_cache_bytes{0};
+    size_t max_packet_cache_bytes{DefaultPacketCacheBytes};
+    //正在从磁盘读取的块 同一个块的并发请求只读一次
+    std::unordered_map<BlockIndex,std::shared_future<PacketPtr>> loading_packets;
     std::mutex cache_mtx;
     void openPacketReader(const std::string& filename){
         packet_reader = std::make_unique<PacketReader>();
         packet_reader->open(filename);
     }
-    void readPacket(BlockIndex index,PacketType& packets){
-        std::lock_guard<std::mutex> lk(cache_mtx);
-        auto p = packet_cache->get_value_ptr(index);
-        if(p){
-            packets = *p;
-            return ;
+    static size_t GetPacketBytes(const PacketType& packets){
+        size_t bytes = 0;
+        for(auto& packet:packets){
+            bytes += packet.size();
         }
-        packet_reader->readPacket(index,packets);
-
+        return bytes;
+    }
+    //must hold cache_mtx
+    void insertPacketCache(const BlockIndex& index,const PacketPtr& packets){
         packet_cache->emplace_back(index,packets);
-
+        packet_cache_bytes += GetPacketBytes(*packets);
+        while(packet_cache_bytes > max_packet_cache_bytes && packet_cache->get_size() > 1){
+            packet_cache_bytes -= GetPacketBytes(*packet_cache->get_back().second);
+            packet_cache->pop_back();
+        }
+    }
+    /**
+     * 缓存命中时只在锁内取出引用 磁盘读取在锁外进行 不会阻塞其它解码线程
+     */
+    PacketPtr readPacket(BlockIndex index){
+        std::shared_ptr<std::promise<PacketPtr>> promise;
+        {
+            std::unique_lock<std::mutex> lk(cache_mtx);
+            auto p = packet_cache->get_value_ptr(index);
+            if(p){
+                return *p;
+            }
+            auto it = loading_packets.find(index);
+            if(it != loading_packets.end()){
+                auto future = it->second;
+                lk.unlock();
+                return future.get();
+            }
+            promise = std::make_shared<std::promise<PacketPtr>>();
+            loading_packets[index] = promise->get_future().share();
+        }
+        try{
+            auto packets = std::make_shared<PacketType>();
+            packet_reader->readPacket(index,*packets);
+            PacketPtr ret = std::move(packets);
+            {
+                std::lock_guard<std::mutex> lk(cache_mtx);
+                insertPacketCache(index,ret);
+                loading_packets.erase(index);
+            }
+            promise->set_value(ret);
+            return ret;
+        }
+        catch(...){
+            {
+                std::lock_guard<std::mutex> lk(cache_mtx);
+                loading_packets.erase(index);
+            }
+            promise->set_exception(std::current_exception());
+            throw;
+        }
     }
     Volume getVolume(){
         return packet_reader->getVolume();
@@ -104,13 +189,127 @@ struct H264VolumeBlockProvider::Impl{
 //            worker->uncompress(reinterpret_cast<uint8_t*>(ptr),size,packets);
 //        }
 //    };
-    struct Decoder{
-        size_t decode(AVCodecContext* c,AVFrame* frame,AVPacket* pkt,uint8_t* buf){
-            int ret = avcodec_send_packet(c,pkt);
+    /**
+     * 预先打开的HEVC解码上下文 解码完一个块后flush再复用 避免每个块都重新创建和打开解码器
+     */
+    struct DecoderContext{
+        AVCodecContext* c{nullptr};
+        AVFrame* frame{nullptr};
+        AVPacket* pkt{nullptr};
+        int thread_count{1};
+
+        //当前块的输出内存 get_buffer2把每一帧的亮度平面直接分配在块内对应的z平面上 解码后不需要再拷贝
+        uint8_t* out_data{nullptr};
+        size_t out_len{0};
+        int out_frames{0};
+        //帧的输出顺序与packet顺序不一致时(B帧重排)无法按pts定位 关闭后退化为逐行拷贝
+        bool direct_output{true};
+        std::mutex claim_mtx;
+        std::vector<char> claimed;
+
+        struct FrameReordered{};
+        //部分解码时输出的帧与packet不是一一对应 例如B帧重排或者CRA之后丢弃的RASL帧
+        struct RangeMismatch{};
+        //部分解码时每一帧的pts必须等于它的z平面 否则写入的平面会错位
+        bool check_range{false};
+
+        explicit DecoderContext(int threadCount)
+        :thread_count(threadCount)
+        {
+            auto codec = avcodec_find_decoder(AV_CODEC_ID_HEVC);
+            if(!codec){
+                throw std::runtime_error("can't find hevc decoder");
+            }
+            c = avcodec_alloc_context3(codec);
+            assert(c);
+            c->thread_count = thread_count;
+            c->delay = 0;
+            c->opaque = this;
+            c->get_buffer2 = GetBuffer2;
+#if FF_API_THREAD_SAFE_CALLBACKS
+            c->thread_safe_callbacks = 1;
+#endif
+            if(avcodec_open2(c,codec,nullptr) < 0){
+                avcodec_free_context(&c);
+                throw std::runtime_error("open hevc decoder failed");
+            }
+            frame = av_frame_alloc();
+            assert(frame);
+            pkt = av_packet_alloc();
+            assert(pkt);
+        }
+        ~DecoderContext(){
+            avcodec_free_context(&c);
+            av_frame_free(&frame);
+            av_packet_free(&pkt);
+        }
+        DecoderContext(const DecoderContext&) = delete;
+        DecoderContext& operator=(const DecoderContext&) = delete;
+
+        static bool IsPlanar8Bit(int format){
+            switch(format){
+            case AV_PIX_FMT_GRAY8:
+            case AV_PIX_FMT_YUV420P:
+            case AV_PIX_FMT_YUV422P:
+            case AV_PIX_FMT_YUV444P:
+            case AV_PIX_FMT_YUVJ420P:
+            case AV_PIX_FMT_YUVJ422P:
+            case AV_PIX_FMT_YUVJ444P:
+                return true;
+            default:
+                return false;
+            }
+        }
+        static void NoFree(void*,uint8_t*){}
+
+        //色度平面仍使用默认的缓冲池 只替换亮度平面 无法映射时保留默认缓冲 输出时拷贝
+        static int GetBuffer2(AVCodecContext* c,AVFrame* frame,int flags){
+            int ret = avcodec_default_get_buffer2(c,frame,flags);
+            if(ret < 0) return ret;
+            reinterpret_cast<DecoderContext*>(c->opaque)->mapToOutput(frame);
+            return 0;
+        }
+        /**
+         * 只有块内的平面满足默认缓冲的所有要求时才映射 否则解码器可能写到平面之外 即相邻的缓存块中
+         * 对齐后的宽高必须不变 行宽和平面的起始地址都要满足linesize的对齐
+         */
+        void mapToOutput(AVFrame* f){
+            if(!direct_output || !out_data || f->pts == AV_NOPTS_VALUE || !IsPlanar8Bit(f->format)) return;
+            if(!f->buf[0]) return;
+            int aligned_w = f->width, aligned_h = f->height;
+            int linesize_align[AV_NUM_DATA_POINTERS];
+            avcodec_align_dimensions2(c,&aligned_w,&aligned_h,linesize_align);
+            if(aligned_w != f->width || aligned_h != f->height) return;
+            if(linesize_align[0] <= 0 || f->width % linesize_align[0] != 0) return;
+            //默认缓冲的亮度平面与其它平面共用一个buffer时不能单独替换
+            auto luma = f->buf[0];
+            for(int i = 1; i < AV_NUM_DATA_POINTERS && f->data[i]; i++){
+                if(f->data[i] >= luma->data && f->data[i] < luma->data + luma->size) return;
+            }
+            size_t plane = static_cast<size_t>(f->width) * f->height;
+            int64_t index = f->pts;
+            if(index < 0 || static_cast<size_t>(index + 1) * plane > out_len) return;
+            uint8_t* dst = out_data + index * plane;
+            if(reinterpret_cast<uintptr_t>(dst) % linesize_align[0] != 0) return;
+            {
+                std::lock_guard<std::mutex> lk(claim_mtx);
+                if(claimed.size() <= static_cast<size_t>(index)) claimed.resize(index + 1,0);
+                if(claimed[index]) return;
+                claimed[index] = 1;
+            }
+            auto buf = av_buffer_create(dst,plane,NoFree,nullptr,0);
+            if(!buf) return;
+            av_buffer_unref(&f->buf[0]);
+            f->buf[0] = buf;
+            f->data[0] = buf->data;
+            f->linesize[0] = f->width;
+        }
+
+        void decode(AVPacket* packet){
+            int ret = avcodec_send_packet(c,packet);
             if(ret < 0){
                 throw std::runtime_error("error sending a packet for decoding");
             }
-            size_t frame_pos = 0;
             while(ret >= 0){
                 ret = avcodec_receive_frame(c,frame);
                 if(ret == AVERROR(EAGAIN) || ret ==AVERROR_EOF)
@@ -118,63 +317,234 @@ struct H264VolumeBlockProvider::Impl{
                 else if(ret < 0){
                     throw std::runtime_error("error during decoding");
                 }
-                memcpy(buf + frame_pos,frame->data[0],frame->linesize[0]*frame->height);
-                frame_pos += frame->linesize[0] * frame->height;
+                if(check_range && frame->pts != out_frames){
+                    throw RangeMismatch{};
+                }
+                size_t width = frame->width;
+                size_t plane = width * frame->height;
+                if(static_cast<size_t>(out_frames + 1) * plane > out_len){
+                    throw std::runtime_error("decode result out of buffer range");
+                }
+                uint8_t* target = out_data + out_frames * plane;
+                if(frame->data[0] == target){
+                    //已经直接解码到目标位置
+                }
+                else if(frame->data[0] >= out_data && frame->data[0] < out_data + out_len){
+                    throw FrameReordered{};
+                }
+                else{
+                    //linesize可能大于width 需要逐行拷贝
+                    for(int y = 0; y < frame->height; y++){
+                        memcpy(target + y * width,frame->data[0] + y * frame->linesize[0],width);
+                    }
+                }
+                out_frames++;
             }
-            return frame_pos;
         }
 
-        void uncompress(void* data,size_t len,std::vector<std::vector<uint8_t>>& packets){
-            auto codec = avcodec_find_decoder(AV_CODEC_ID_HEVC);
-            assert(codec);
-//        auto parser = av_parser_init(codec->id);
-//        assert(parser);
+        /**
+         * packet按照顺序以下标作为pts 输出第first个packet开始的帧
+         * 检测到帧重排时关闭直接输出并重新解码
+         * checkRange时输出的帧必须与[first,last)的packet一一对应 否则抛出RangeMismatch
+         */
+        void decodeFrames(uint8_t* data,size_t len,const PacketType& packets,int first,int last,bool checkRange = false){
+            while(true){
+                out_data = data;
+                out_len = len;
+                out_frames = first;
+                check_range = checkRange;
+                claimed.clear();
+                try{
+                    for(int i = first; i < last; i++){
+                        pkt->data = const_cast<uint8_t*>(packets[i].data());
+                        pkt->size = packets[i].size();
+                        pkt->pts = i;
+                        decode(pkt);
+                    }
+                    decode(nullptr);
+                    if(check_range && out_frames != last){
+                        throw RangeMismatch{};
+                    }
+                }
+                catch(const FrameReordered&){
+                    LOG_INFO("hevc frames are reordered, disable direct output");
+                    endOutput();
+                    direct_output = false;
+                    continue;
+                }
+                catch(...){
+                    endOutput();
+                    throw;
+                }
+                //drain后解码器处于EOF状态 flush之后才能解码下一个块
+                endOutput();
+                return;
+            }
+        }
+        void endOutput(){
+            avcodec_flush_buffers(c);
+            av_frame_unref(frame);
+            out_data = nullptr;
+            out_len = 0;
+            check_range = false;
+        }
 
-            auto c = avcodec_alloc_context3(codec);
-            c->thread_count = 6;
-            c->delay = 0;
-            assert(c);
-            int ret = avcodec_open2(c,codec,nullptr);
-            assert(ret >= 0);
-            auto frame = av_frame_alloc();
-            assert(frame);
-            auto pkt = av_packet_alloc();
-            assert(pkt);
-            uint8_t* p = (uint8*)data;
-            size_t offset = 0;
-
-            for(auto& packet:packets){
-                pkt->data = packet.data();
-                pkt->size = packet.size();
-                offset += decode(c,frame,pkt,p+offset);
-                if(offset > len){
-                    throw std::runtime_error("decode result out of buffer range");
+        void uncompress(void* data,size_t len,const PacketType& packets){
+            decodeFrames(reinterpret_cast<uint8_t*>(data),len,packets,0,static_cast<int>(packets.size()));
+        }
+
+        //annex-b格式 跳过参数集 由第一个VCL NAL的类型判断是否为IRAP帧
+        static bool IsKeyPacket(const std::vector<uint8_t>& packet){
+            for(size_t i = 0; i + 3 < packet.size(); i++){
+                if(packet[i] == 0 && packet[i + 1] == 0 && packet[i + 2] == 1){
+                    int nal_type = (packet[i + 3] >> 1) & 0x3f;
+                    if(nal_type < 32){
+                        return nal_type >= 16 && nal_type <= 23;
+                    }
+                    i += 2;
                 }
             }
-            decode(c,frame,nullptr,p+offset);
+            return false;
+        }
 
-            avcodec_free_context(&c);
-            av_frame_free(&frame);
-            av_packet_free(&pkt);
+        /**
+         * 一个packet对应块的一个z平面 从z0之前最近的关键帧开始解码 得到z1之前的所有帧后停止
+         * 只有输出顺序和解码顺序相同时才能这样做 B帧重排时z1之前的帧可能依赖之后的packet
+         * CRA之后的RASL帧会被丢弃 按顺序计数的平面会错位
+         * 所以每一帧按照pts(即packet的下标)校验 不一致时退化为完整解码
+         */
+        void uncompressRange(void* data,size_t len,const PacketType& packets,int frameCount,int z0,int z1){
+            if(frameCount <= 0 || packets.size() != static_cast<size_t>(frameCount)){
+                uncompress(data,len,packets);
+                return;
+            }
+            z1 = (std::min)(z1,frameCount);
+            int key = (std::max)((std::min)(z0,z1 - 1),0);
+            while(key > 0 && !IsKeyPacket(packets[key])) key--;
+
+            try{
+                decodeFrames(reinterpret_cast<uint8_t*>(data),len,packets,key,z1,true);
+            }
+            catch(const RangeMismatch&){
+                LOG_INFO("hevc frames are not in packet order, decode the whole block");
+                uncompress(data,len,packets);
+            }
         }
     };
 
-//    std::vector<Worker> workers;
-    std::unique_ptr<Decoder[]> decoders{nullptr};
-    int worker_count{0};
+    /**
+     * 解码在CPU上进行 上下文的数量与核心数相同
+     * 同时解码的块较少时 使用多线程的上下文降低单个块的延迟
+     * 同时解码的块较多时 每个块单线程解码 以块级并行为主 吞吐量随核心数线性增长
+     */
+    class DecoderPool{
+      public:
+        explicit DecoderPool(int coreCount)
+        :core_count((std::max)(coreCount,1))
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            for(int i = 0; i < core_count; i++){
+                idle_contexts[1].emplace_back(createContext(1));
+            }
+            if(core_count > 1){
+                int n = getThreadCount(1);
+                idle_contexts[n].emplace_back(createContext(n));
+            }
+        }
+
+        void uncompress(void* data,size_t len,const PacketType& packets){
+            run([&](DecoderContext* ctx){
+                ctx->uncompress(data,len,packets);
+            });
+        }
 
-    void createDecoders(int n){
-        worker_count = n;
-        decoders = std::make_unique<Decoder[]>(n);
-//        for(int i = 0;i<n;i++){
-//            decoders[i].create(i);
-//        }
-    }
-    void decode(int GPUIndex,void* ptr,size_t size,PacketType& packets){
-        if(GPUIndex>=worker_count){
-            throw std::runtime_error("GPU index out of range");
+        void uncompressRange(void* data,size_t len,const PacketType& packets,int frameCount,int z0,int z1){
+            run([&](DecoderContext* ctx){
+                ctx->uncompressRange(data,len,packets,frameCount,z0,z1);
+            });
         }
-        decoders[GPUIndex].uncompress(ptr,size,packets);
+
+      private:
+        template <typename F>
+        void run(F&& f){
+            int in_flight = ++decoding_count;
+            auto ctx = acquire(getThreadCount(in_flight));
+            try{
+                f(ctx);
+            }
+            catch(...){
+                release(ctx);
+                --decoding_count;
+                throw;
+            }
+            release(ctx);
+            --decoding_count;
+        }
+        //每个块分到的线程数 取不超过core_count / in_flight的2的幂 便于上下文按线程数复用
+        int getThreadCount(int inFlight) const{
+            int n = core_count / (std::max)(inFlight,1);
+            int t = 1;
+            while(t * 2 <= n) t *= 2;
+            return t;
+        }
+        DecoderContext* createContext(int threadCount){
+            contexts.emplace_back(std::make_unique<DecoderContext>(threadCount));
+            return contexts.back().get();
+        }
+        DecoderContext* acquire(int threadCount){
+            std::unique_lock<std::mutex> lk(mtx);
+            auto& bucket = idle_contexts[threadCount];
+            if(!bucket.empty()){
+                auto ctx = bucket.back();
+                bucket.pop_back();
+                return ctx;
+            }
+            //上下文总数达到上限时 等待并借用任意一个空闲的上下文
+            if(contexts.size() >= static_cast<size_t>(core_count) * 2){
+                cv.wait(lk,[this](){
+                    for(auto& it:idle_contexts){
+                        if(!it.second.empty()) return true;
+                    }
+                    return false;
+                });
+                for(auto& it:idle_contexts){
+                    if(!it.second.empty()){
+                        auto ctx = it.second.back();
+                        it.second.pop_back();
+                        return ctx;
+                    }
+                }
+            }
+            return createContext(threadCount);
+        }
+        void release(DecoderContext* ctx){
+            {
+                std::lock_guard<std::mutex> lk(mtx);
+                idle_contexts[ctx->thread_count].emplace_back(ctx);
+            }
+            cv.notify_one();
+        }
+
+        int core_count;
+        std::atomic<int> decoding_count{0};
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::vector<std::unique_ptr<DecoderContext>> contexts;
+        std::unordered_map<int,std::vector<DecoderContext*>> idle_contexts;
+    };
+
+    std::unique_ptr<DecoderPool> decoder_pool;
+
+    void createDecoderPool(int coreCount){
+        decoder_pool = std::make_unique<DecoderPool>(coreCount);
+    }
+    void decode(void* ptr,size_t size,const PacketType& packets){
+        assert(decoder_pool);
+        decoder_pool->uncompress(ptr,size,packets);
+    }
+    void decodeRange(void* ptr,size_t size,const PacketType& packets,int frameCount,int z0,int z1){
+        assert(decoder_pool);
+        decoder_pool->uncompressRange(ptr,size,packets,frameCount,z0,z1);
     }
 };
 
@@ -191,7 +561,6 @@ void H264VolumeBlockProvider::setHostNode(HostNode* hostNode)
     assert(hostNode);
     this->host_node = hostNode;
 
-    impl->createDecoders(this->host_node->getGPUNum());
 }
 const Volume& H264VolumeBlockProvider::getVolume() const
 {
@@ -199,19 +568,66 @@ const Volume& H264VolumeBlockProvider::getVolume() const
 }
 void H264VolumeBlockProvider::getVolumeBlock(void *dst,BlockIndex blockIndex)
 {
-    Impl::PacketType packets;
+    auto packets = impl->readPacket(blockIndex);
 
-    impl->readPacket(blockIndex,packets);
-
-    int gpu_index = GPUTaskScheduleHelper::GetOptimalGPUIndex(host_node,GPUTaskScheduleHelper::DefaultGPUTaskCodecEvaluator);
+    //decode on cpu, no gpu codec task to record
+    impl->decode(dst,volume.getBlockSize(),*packets);
+}
+void H264VolumeBlockProvider::getVolumeBlockRange(void *dst, BlockIndex blockIndex, int z0, int z1)
+{
+    if(z0 <= 0 && z1 >= volume.getBlockLength()){
+        getVolumeBlock(dst,blockIndex);
+        return;
+    }
+    auto packets = impl->readPacket(blockIndex);
 
-    auto task_handle = host_node->recordGPUTask(
-        {HostNode::Codec,1,1,gpu_index}
-        );
+    impl->decodeRange(dst,volume.getBlockSize(),*packets,volume.getBlockLength(),z0,z1);
+}
+/**
+ * 预读线程按照块在lod文件中的顺序读取packet 同时解码线程按优先级从解码器池中取上下文解码
+ * 解码线程需要的packet若正在预读 readPacket会等待同一次读取而不会重复读
+ * 预读仍然是Reader池上的同步读取 最多ReaderCountPerLod个同时进行 相邻的packet不会合并
+ */
+void H264VolumeBlockProvider::getVolumeBlocks(const std::vector<BlockRequest>& requests,const BlockCompletion& onComplete)
+{
+    if(requests.empty()) return;
+    //lod文件中块按照z y x的顺序存储 用块的索引顺序代替文件偏移
+    std::vector<BlockIndex> by_offset;
+    by_offset.reserve(requests.size());
+    for(auto& request:requests){
+        by_offset.emplace_back(request.index);
+    }
+    std::sort(by_offset.begin(),by_offset.end());
+    //每个lod有ReaderCountPerLod个Reader 同时保持这么多读取在进行 按文件顺序依次取下一个块
+    auto prefetch = std::async(std::launch::async,[&](){
+        parallel_foreach(by_offset,[&](int,const BlockIndex& index){
+            try{
+                impl->readPacket(index);
+            }
+            catch(const std::exception& err){
+                LOG_ERROR("prefetch block packet failed: {}",err.what());
+            }
+        },(std::min)(static_cast<int>(by_offset.size()),Impl::ReaderCountPerLod));
+    });
 
-    impl->decode(gpu_index,dst,volume.getBlockSize(),packets);
+    auto by_priority = requests;
+    std::stable_sort(by_priority.begin(),by_priority.end(),[](const BlockRequest& a,const BlockRequest& b){
+        return a.priority < b.priority;
+    });
+    int worker_count = (std::min)(static_cast<int>(by_priority.size()),actual_worker_count(0));
+    parallel_foreach(by_priority,[&](int,const BlockRequest& request){
+        bool ok = true;
+        try{
+            getVolumeBlock(request.dst,request.index);
+        }
+        catch(const std::exception& err){
+            LOG_ERROR("decode block failed: {}",err.what());
+            ok = false;
+        }
+        if(onComplete) onComplete(request,ok);
+    },worker_count);
 
-    host_node->eraseGPUTask(task_handle);
+    prefetch.wait();
 }
 H264VolumeBlockProvider::H264VolumeBlockProvider()
 {
@@ -22,6 +22,10 @@ class H264VolumeBlockProvider: public IVolumeBlockProviderInterface{
 
     void getVolumeBlock(void* dst,BlockIndex blockIndex) override;
 
+    void getVolumeBlockRange(void* dst,BlockIndex blockIndex,int z0,int z1) override;
+
+    void getVolumeBlocks(const std::vector<BlockRequest>& requests,const BlockCompletion& onComplete) override;
+
   private:
 
     struct Impl;
@@ -0,0 +1,147 @@
+//
+// Created by wyz on 2022/5/20.
+//
+#pragma once
+#include "core/Volume.hpp"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+MRAYNS_BEGIN
+
+/**
+ * 未压缩的分块体数据格式
+ * [RawBrickHeader][lod min_lod的偏移表]...[lod max_lod的偏移表][对齐填充][bricks]
+ * 偏移表按照 x y z 的顺序存储每个brick在文件中的字节偏移 不存在的brick记为InvalidBrickOffset
+ * 每个brick包含padding 大小为block_length^3*voxel_bytes 起始地址按BrickAlignment对齐 可以直接用O_DIRECT读取
+ */
+struct RawBrickFormat{
+    static constexpr char Magic[8] = {'M','R','A','Y','B','R','K','\0'};
+    static constexpr uint32_t Version = 1;
+    static constexpr uint64_t BrickAlignment = 4096;
+    static constexpr uint64_t InvalidBrickOffset = ~uint64_t(0);
+
+    struct Header{
+        char magic[8];
+        uint32_t version;
+        uint32_t voxel_type;
+        int32_t block_length;
+        int32_t padding;
+        int32_t dim_x,dim_y,dim_z;
+        float space_x,space_y,space_z;
+        int32_t min_lod,max_lod;
+        uint64_t brick_bytes;
+        uint64_t table_offset;
+        uint64_t data_offset;
+    };
+
+    static size_t GetVoxelBytes(Volume::VoxelType type){
+        switch(type){
+        case Volume::INT8:
+        case Volume::UINT8: return 1;
+        case Volume::INT16:
+        case Volume::UINT16:
+        case Volume::FLOAT16: return 2;
+        case Volume::INT32:
+        case Volume::UINT32:
+        case Volume::FLOAT32: return 4;
+        case Volume::FLOAT64: return 8;
+        default: return 0;
+        }
+    }
+
+    static uint64_t AlignUp(uint64_t x,uint64_t alignment = BrickAlignment){
+        return (x + alignment - 1) / alignment * alignment;
+    }
+
+    static Header CreateHeader(const Volume& volume,int minLod,int maxLod){
+        Header header{};
+        std::memcpy(header.magic,Magic,sizeof(Magic));
+        header.version = Version;
+        header.voxel_type = volume.getVoxelType();
+        header.block_length = volume.getBlockLength();
+        header.padding = volume.getBlockPadding();
+        header.dim_x = volume.volume_dim_x;
+        header.dim_y = volume.volume_dim_y;
+        header.dim_z = volume.volume_dim_z;
+        header.space_x = volume.volume_space_x;
+        header.space_y = volume.volume_space_y;
+        header.space_z = volume.volume_space_z;
+        header.min_lod = minLod;
+        header.max_lod = maxLod;
+        header.brick_bytes = static_cast<uint64_t>(volume.getBlockSize()) * GetVoxelBytes(volume.getVoxelType());
+        header.table_offset = sizeof(Header);
+        header.data_offset = AlignUp(header.table_offset + GetTableCount(header) * sizeof(uint64_t));
+        return header;
+    }
+
+    static void CheckHeader(const Header& header){
+        if(std::memcmp(header.magic,Magic,sizeof(Magic)) != 0){
+            throw std::runtime_error("not a raw brick file");
+        }
+        if(header.version != Version){
+            throw std::runtime_error("unsupported raw brick file version");
+        }
+        if(header.min_lod < 0 || header.max_lod < header.min_lod || header.block_length <= 2 * header.padding){
+            throw std::runtime_error("invalid raw brick file header");
+        }
+        if(header.data_offset % BrickAlignment != 0 || header.brick_bytes % BrickAlignment != 0){
+            throw std::runtime_error("raw brick file is not aligned");
+        }
+    }
+
+    static Volume GetVolume(const Header& header){
+        Volume volume;
+        volume.name = "raw-brick";
+        volume.voxel_type = static_cast<Volume::VoxelType>(header.voxel_type);
+        volume.block_length = header.block_length;
+        volume.padding = header.padding;
+        volume.volume_dim_x = header.dim_x;
+        volume.volume_dim_y = header.dim_y;
+        volume.volume_dim_z = header.dim_z;
+        volume.volume_space_x = header.space_x;
+        volume.volume_space_y = header.space_y;
+        volume.volume_space_z = header.space_z;
+        volume.max_lod = header.max_lod;
+        return volume;
+    }
+
+    //与VolumeHelper::ComputeLodVolumeBlockDim相同
+    static void GetLodBlockDim(const Header& header,int lod,int& x,int& y,int& z){
+        int no_padding = header.block_length - 2 * header.padding;
+        int lod_t = 1 << lod;
+        x = ((header.dim_x + no_padding - 1) / no_padding + lod_t - 1) / lod_t;
+        y = ((header.dim_y + no_padding - 1) / no_padding + lod_t - 1) / lod_t;
+        z = ((header.dim_z + no_padding - 1) / no_padding + lod_t - 1) / lod_t;
+    }
+
+    static size_t GetLodBlockCount(const Header& header,int lod){
+        int x,y,z;
+        GetLodBlockDim(header,lod,x,y,z);
+        return static_cast<size_t>(x) * y * z;
+    }
+
+    static size_t GetTableCount(const Header& header){
+        size_t count = 0;
+        for(int lod = header.min_lod; lod <= header.max_lod; lod++){
+            count += GetLodBlockCount(header,lod);
+        }
+        return count;
+    }
+
+    //偏移表中的位置 越界返回-1
+    static int64_t GetTableIndex(const Header& header,const Volume::BlockIndex& index){
+        if(index.w < header.min_lod || index.w > header.max_lod) return -1;
+        int x,y,z;
+        GetLodBlockDim(header,index.w,x,y,z);
+        if(index.x < 0 || index.y < 0 || index.z < 0 || index.x >= x || index.y >= y || index.z >= z) return -1;
+        int64_t base = 0;
+        for(int lod = header.min_lod; lod < index.w; lod++){
+            base += GetLodBlockCount(header,lod);
+        }
+        return base + (static_cast<int64_t>(index.z) * y + index.y) * x + index.x;
+    }
+};
+
+MRAYNS_END
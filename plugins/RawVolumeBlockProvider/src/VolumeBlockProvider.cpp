@@ -0,0 +1,338 @@
+//
+// Created by wyz on 2022/5/20.
+//
+#include "VolumeBlockProvider.hpp"
+#include "RawBrickFormat.hpp"
+#include "common/Logger.hpp"
+#include "utils/AsyncFileReader.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#ifdef WINDOWS
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+MRAYNS_BEGIN
+
+struct RawVolumeBlockProvider::Impl{
+    enum class IOMode{
+        MMap,Direct
+    };
+    IOMode io_mode{IOMode::MMap};
+    RawBrickFormat::Header header{};
+    std::vector<uint64_t> brick_offsets;
+
+    //direct io批量读取时使用 保持多个读取同时在进行
+    std::unique_ptr<AsyncFileReader> async_reader;
+
+    const uint8_t* mapped{nullptr};
+    size_t mapped_size{0};
+#ifdef WINDOWS
+    HANDLE file{INVALID_HANDLE_VALUE};
+    HANDLE mapping{nullptr};
+#else
+    int fd{-1};
+#endif
+
+    ~Impl(){
+        close();
+    }
+
+    void readHeader(const std::string& filename){
+        std::ifstream in(filename,std::ios::binary);
+        if(!in.is_open()){
+            throw std::runtime_error("open raw brick file failed: " + filename);
+        }
+        in.read(reinterpret_cast<char*>(&header),sizeof(header));
+        if(!in){
+            throw std::runtime_error("read raw brick file header failed");
+        }
+        RawBrickFormat::CheckHeader(header);
+        brick_offsets.resize(RawBrickFormat::GetTableCount(header));
+        in.seekg(header.table_offset,std::ios::beg);
+        in.read(reinterpret_cast<char*>(brick_offsets.data()),brick_offsets.size() * sizeof(uint64_t));
+        if(!in){
+            throw std::runtime_error("read raw brick offset table failed");
+        }
+    }
+
+    void open(const std::string& filename){
+        close();
+        readHeader(filename);
+        auto mode = std::getenv("MRAYNS_RAW_BRICK_IO");
+        io_mode = (mode && std::string(mode) == "direct") ? IOMode::Direct : IOMode::MMap;
+        if(io_mode == IOMode::Direct && !openDirect(filename)){
+            LOG_ERROR("open raw brick file with direct io failed, fall back to mmap");
+            io_mode = IOMode::MMap;
+        }
+        if(io_mode == IOMode::MMap){
+            openMapped(filename);
+        }
+        else{
+            async_reader = std::make_unique<AsyncFileReader>();
+            async_reader->open(filename,true);
+        }
+        LOG_INFO("open raw brick file {} with {}",filename,io_mode == IOMode::MMap ? "mmap" : "direct io");
+    }
+
+#ifdef WINDOWS
+    bool openDirect(const std::string& filename){
+        file = CreateFileA(filename.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,
+                           FILE_FLAG_NO_BUFFERING | FILE_FLAG_RANDOM_ACCESS,nullptr);
+        return file != INVALID_HANDLE_VALUE;
+    }
+    void openMapped(const std::string& filename){
+        file = CreateFileA(filename.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,
+                           FILE_FLAG_RANDOM_ACCESS,nullptr);
+        if(file == INVALID_HANDLE_VALUE){
+            throw std::runtime_error("open raw brick file failed: " + filename);
+        }
+        LARGE_INTEGER size;
+        GetFileSizeEx(file,&size);
+        mapped_size = static_cast<size_t>(size.QuadPart);
+        mapping = CreateFileMappingA(file,nullptr,PAGE_READONLY,0,0,nullptr);
+        if(!mapping){
+            throw std::runtime_error("create raw brick file mapping failed");
+        }
+        mapped = reinterpret_cast<const uint8_t*>(MapViewOfFile(mapping,FILE_MAP_READ,0,0,0));
+        if(!mapped){
+            throw std::runtime_error("map raw brick file failed");
+        }
+    }
+    void close(){
+        async_reader.reset();
+        if(mapped) UnmapViewOfFile(mapped);
+        if(mapping) CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapped = nullptr;
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+        mapped_size = 0;
+    }
+    //提前让系统把整个brick读入page cache 之后拷贝时不会逐页缺页
+    void prefetch(uint64_t offset,size_t bytes){
+#if _WIN32_WINNT >= 0x0602
+        WIN32_MEMORY_RANGE_ENTRY entry{const_cast<uint8_t*>(mapped + offset),bytes};
+        PrefetchVirtualMemory(GetCurrentProcess(),1,&entry,0);
+#endif
+    }
+    //offset dst bytes都已经按照BrickAlignment对齐
+    void readAligned(void* dst,uint64_t offset,size_t bytes){
+        auto p = reinterpret_cast<uint8_t*>(dst);
+        while(bytes > 0){
+            DWORD n = static_cast<DWORD>((std::min)(bytes,size_t(1) << 30));
+            OVERLAPPED ov{};
+            ov.Offset = static_cast<DWORD>(offset);
+            ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD read = 0;
+            if(!ReadFile(file,p,n,&read,&ov) || read == 0){
+                throw std::runtime_error("read raw brick file failed");
+            }
+            p += read;
+            offset += read;
+            bytes -= read;
+        }
+    }
+#else
+    bool openDirect(const std::string& filename){
+#ifdef O_DIRECT
+        fd = ::open(filename.c_str(),O_RDONLY | O_DIRECT);
+#endif
+        return fd >= 0;
+    }
+    void openMapped(const std::string& filename){
+        fd = ::open(filename.c_str(),O_RDONLY);
+        if(fd < 0){
+            throw std::runtime_error("open raw brick file failed: " + filename);
+        }
+        struct stat st{};
+        fstat(fd,&st);
+        mapped_size = static_cast<size_t>(st.st_size);
+        auto p = mmap(nullptr,mapped_size,PROT_READ,MAP_SHARED,fd,0);
+        if(p == MAP_FAILED){
+            throw std::runtime_error("mmap raw brick file failed");
+        }
+        mapped = reinterpret_cast<const uint8_t*>(p);
+        //bricks按视点随机访问 关闭内核默认的顺序预读 由prefetch按brick预读
+        madvise(const_cast<uint8_t*>(mapped),mapped_size,MADV_RANDOM);
+    }
+    void close(){
+        async_reader.reset();
+        if(mapped) munmap(const_cast<uint8_t*>(mapped),mapped_size);
+        if(fd >= 0) ::close(fd);
+        mapped = nullptr;
+        mapped_size = 0;
+        fd = -1;
+    }
+    void prefetch(uint64_t offset,size_t bytes){
+        auto page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        auto begin = offset / page * page;
+        madvise(const_cast<uint8_t*>(mapped + begin),offset + bytes - begin,MADV_WILLNEED);
+    }
+    void readAligned(void* dst,uint64_t offset,size_t bytes){
+        auto p = reinterpret_cast<uint8_t*>(dst);
+        while(bytes > 0){
+            auto n = pread(fd,p,bytes,static_cast<off_t>(offset));
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0){
+                throw std::runtime_error("read raw brick file failed");
+            }
+            p += n;
+            offset += n;
+            bytes -= n;
+        }
+    }
+#endif
+
+    uint64_t getBrickOffset(const BlockIndex& index) const{
+        auto i = RawBrickFormat::GetTableIndex(header,index);
+        if(i < 0){
+            throw std::runtime_error("block index out of raw brick file range");
+        }
+        return brick_offsets[i];
+    }
+
+    /**
+     * mmap直接从映射拷贝到dst
+     * direct io在dst对齐时直接读到dst 否则读到对齐的临时缓冲再拷贝
+     */
+    void read(void* dst,uint64_t offset,size_t bytes){
+        if(io_mode == IOMode::MMap){
+            if(offset + bytes > mapped_size){
+                throw std::runtime_error("raw brick out of file range");
+            }
+            prefetch(offset,bytes);
+            std::memcpy(dst,mapped + offset,bytes);
+            return;
+        }
+        constexpr auto alignment = RawBrickFormat::BrickAlignment;
+        if(reinterpret_cast<uintptr_t>(dst) % alignment == 0 && offset % alignment == 0 && bytes % alignment == 0){
+            readAligned(dst,offset,bytes);
+            return;
+        }
+        auto begin = offset / alignment * alignment;
+        auto end = RawBrickFormat::AlignUp(offset + bytes);
+        auto buffer = getBounceBuffer(end - begin);
+        readAligned(buffer,begin,end - begin);
+        std::memcpy(dst,buffer + (offset - begin),bytes);
+    }
+
+    static uint8_t* getBounceBuffer(size_t bytes){
+        struct AlignedDeleter{
+            void operator()(uint8_t* p) const{
+                ::operator delete(p,std::align_val_t(RawBrickFormat::BrickAlignment));
+            }
+        };
+        thread_local std::unique_ptr<uint8_t,AlignedDeleter> buffer;
+        thread_local size_t buffer_size = 0;
+        if(buffer_size < bytes){
+            buffer.reset(reinterpret_cast<uint8_t*>(::operator new(bytes,std::align_val_t(RawBrickFormat::BrickAlignment))));
+            buffer_size = bytes;
+        }
+        return buffer.get();
+    }
+};
+
+RawVolumeBlockProvider::RawVolumeBlockProvider()
+{
+    impl = std::make_unique<Impl>();
+}
+RawVolumeBlockProvider::~RawVolumeBlockProvider()
+{
+
+}
+void RawVolumeBlockProvider::open(const std::string &filename)
+{
+    impl->open(filename);
+
+    volume = RawBrickFormat::GetVolume(impl->header);
+    assert(volume.isValid());
+}
+void RawVolumeBlockProvider::setHostNode(HostNode* hostNode)
+{
+    assert(hostNode);
+    this->host_node = hostNode;
+}
+const Volume& RawVolumeBlockProvider::getVolume() const
+{
+    return this->volume;
+}
+void RawVolumeBlockProvider::getVolumeBlock(void *dst, BlockIndex blockIndex)
+{
+    auto offset = impl->getBrickOffset(blockIndex);
+    auto bytes = static_cast<size_t>(impl->header.brick_bytes);
+    if(offset == RawBrickFormat::InvalidBrickOffset){
+        std::memset(dst,0,bytes);
+        return;
+    }
+    impl->read(dst,offset,bytes);
+}
+void RawVolumeBlockProvider::getVolumeBlockRange(void *dst, BlockIndex blockIndex, int z0, int z1)
+{
+    //brick按z切片连续存储 只读取需要的z范围
+    int block_length = volume.getBlockLength();
+    z0 = (std::max)(z0,0);
+    z1 = (std::min)(z1,block_length);
+    if(z0 >= z1) return;
+    auto offset = impl->getBrickOffset(blockIndex);
+    size_t slice_bytes = static_cast<size_t>(impl->header.brick_bytes) / block_length;
+    auto p = reinterpret_cast<uint8_t*>(dst) + slice_bytes * z0;
+    if(offset == RawBrickFormat::InvalidBrickOffset){
+        std::memset(p,0,slice_bytes * (z1 - z0));
+        return;
+    }
+    impl->read(p,offset + slice_bytes * z0,slice_bytes * (z1 - z0));
+}
+void RawVolumeBlockProvider::getVolumeBlocks(const std::vector<BlockRequest>& requests,const BlockCompletion& onComplete)
+{
+    //mmap时先按文件顺序对整批brick发出预读 再按优先级拷贝
+    if(impl->io_mode == Impl::IOMode::MMap){
+        std::vector<uint64_t> offsets;
+        offsets.reserve(requests.size());
+        for(auto& request:requests){
+            auto i = RawBrickFormat::GetTableIndex(impl->header,request.index);
+            if(i >= 0 && impl->brick_offsets[i] != RawBrickFormat::InvalidBrickOffset){
+                offsets.emplace_back(impl->brick_offsets[i]);
+            }
+        }
+        std::sort(offsets.begin(),offsets.end());
+        for(auto offset:offsets){
+            if(offset + impl->header.brick_bytes > impl->mapped_size) continue;
+            impl->prefetch(offset,impl->header.brick_bytes);
+        }
+    }
+    else if(impl->async_reader){
+        //对齐的brick直接读入dst 交给io线程按文件顺序合并读取 其余的走同步路径
+        constexpr auto alignment = RawBrickFormat::BrickAlignment;
+        std::vector<AsyncFileReader::Request> reads;
+        std::vector<BlockRequest> others;
+        for(auto& request:requests){
+            auto i = RawBrickFormat::GetTableIndex(impl->header,request.index);
+            if(i < 0 || impl->brick_offsets[i] == RawBrickFormat::InvalidBrickOffset
+                || reinterpret_cast<uintptr_t>(request.dst) % alignment != 0){
+                others.emplace_back(request);
+                continue;
+            }
+            reads.push_back({impl->brick_offsets[i],static_cast<size_t>(impl->header.brick_bytes),request.dst,
+                             [request,&onComplete](bool ok){
+                                 if(onComplete) onComplete(request,ok);
+                             }});
+        }
+        impl->async_reader->submit(std::move(reads));
+        IVolumeBlockProviderInterface::getVolumeBlocks(others,onComplete);
+        impl->async_reader->wait();
+        return;
+    }
+    IVolumeBlockProviderInterface::getVolumeBlocks(requests,onComplete);
+}
+
+MRAYNS_END
+
+REGISTER_PLUGIN_FACTORY_IMPL(RawVolumeBlockProviderFactory)
+EXPORT_PLUGIN_FACTORY_IMPL(RawVolumeBlockProviderFactory)
@@ -0,0 +1,59 @@
+//
+// Created by wyz on 2022/5/20.
+//
+#pragma once
+
+#include "extension/VolumeBlockProviderInterface.hpp"
+#include "plugin/Plugin.hpp"
+#include <memory>
+MRAYNS_BEGIN
+
+/**
+ * @brief Serve uncompressed bricks from RawBrickFormat file without decoding.
+ * Default read through mmap, set env MRAYNS_RAW_BRICK_IO=direct to read with O_DIRECT.
+ */
+class RawVolumeBlockProvider: public IVolumeBlockProviderInterface{
+  public:
+    RawVolumeBlockProvider();
+
+    ~RawVolumeBlockProvider() override;
+
+    void open(const std::string& filename) override;
+
+    void setHostNode(HostNode* hostNode) override;
+
+    const Volume& getVolume() const override;
+
+    void getVolumeBlock(void* dst,BlockIndex blockIndex) override;
+
+    void getVolumeBlockRange(void* dst,BlockIndex blockIndex,int z0,int z1) override;
+
+    void getVolumeBlocks(const std::vector<BlockRequest>& requests,const BlockCompletion& onComplete) override;
+
+  private:
+
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+    HostNode* host_node{nullptr};
+
+    Volume volume;
+};
+
+MRAYNS_END
+
+class RawVolumeBlockProviderFactory: public mrayns::IPluginFactory{
+  public:
+    std::string Key() const override{
+        return "raw-block-provider";
+    }
+    void *Create(const std::string &key) override{
+        return new ::mrayns::RawVolumeBlockProvider();
+    }
+    std::string GetModuleID() const override{
+        return ::mrayns::module_id_traits<::mrayns::IVolumeBlockProviderInterface>::GetModuleID();
+    }
+};
+
+REGISTER_PLUGIN_FACTORY_DECL(RawVolumeBlockProviderFactory)
+EXPORT_PLUGIN_FACTORY_DECL(RawVolumeBlockProviderFactory)
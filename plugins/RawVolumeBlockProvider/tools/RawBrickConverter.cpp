@@ -0,0 +1,113 @@
+//
+// Created by wyz on 2022/5/20.
+//
+#include "../src/RawBrickFormat.hpp"
+#include "common/Parrallel.hpp"
+#include "extension/VolumeBlockProviderInterface.hpp"
+#include "plugin/PluginLoader.hpp"
+#include "utils/Timer.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+using namespace mrayns;
+
+/**
+ * 从任意block-provider插件读取数据块 转换为RawBrickFormat文件
+ * 全零的brick不写入文件 偏移记为InvalidBrickOffset 读取时直接填零
+ * usage: RawBrickConverter <plugin_dir> <provider_key> <input> <output> [min_lod] [max_lod]
+ */
+int main(int argc,char** argv){
+    if(argc < 5){
+        std::cout<<"usage: RawBrickConverter <plugin_dir> <provider_key> <input> <output> [min_lod] [max_lod]"<<std::endl;
+        return 1;
+    }
+    try{
+        PluginLoader::LoadPlugins(argv[1]);
+        auto p = std::unique_ptr<IVolumeBlockProviderInterface>(
+            PluginLoader::CreatePlugin<IVolumeBlockProviderInterface>(argv[2]));
+        if(!p){
+            throw std::runtime_error(std::string("can't create provider: ") + argv[2]);
+        }
+        p->setHostNode(&HostNode::getInstance());
+        p->open(argv[3]);
+        const auto& volume = p->getVolume();
+        if(!volume.isValid()){
+            throw std::runtime_error("provider return invalid volume");
+        }
+        int min_lod = argc > 5 ? std::stoi(argv[5]) : 0;
+        int max_lod = argc > 6 ? std::stoi(argv[6]) : volume.getMaxLod();
+
+        auto header = RawBrickFormat::CreateHeader(volume,min_lod,max_lod);
+        RawBrickFormat::CheckHeader(header);
+        std::vector<uint64_t> brick_offsets(RawBrickFormat::GetTableCount(header),RawBrickFormat::InvalidBrickOffset);
+
+        std::ofstream out(argv[4],std::ios::binary);
+        if(!out.is_open()){
+            throw std::runtime_error(std::string("open output file failed: ") + argv[4]);
+        }
+        //先写入头和占位的偏移表 bricks写完后再回填偏移表
+        out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+        std::vector<char> zeros(header.data_offset - sizeof(header),0);
+        out.write(zeros.data(),zeros.size());
+        uint64_t cur_offset = header.data_offset;
+
+        //每批交给provider并行解码 再按文件顺序写出
+        int batch_count = actual_worker_count(0) * 2;
+        std::vector<std::vector<uint8_t>> buffers(batch_count,std::vector<uint8_t>(header.brick_bytes));
+        //完成回调按照dst找到对应的缓冲 priority只是调度的提示 provider可以改变它
+        std::unordered_map<const void*,size_t> buffer_pos;
+        for(int j = 0; j < batch_count; j++){
+            buffer_pos[buffers[j].data()] = j;
+        }
+        START_TIMER
+        for(int lod = min_lod; lod <= max_lod; lod++){
+            int dim_x,dim_y,dim_z;
+            RawBrickFormat::GetLodBlockDim(header,lod,dim_x,dim_y,dim_z);
+            std::vector<Volume::BlockIndex> blocks;
+            for(int z = 0; z < dim_z; z++){
+                for(int y = 0; y < dim_y; y++){
+                    for(int x = 0; x < dim_x; x++){
+                        blocks.emplace_back(x,y,z,lod);
+                    }
+                }
+            }
+            for(size_t i = 0; i < blocks.size(); i += batch_count){
+                size_t n = (std::min)(blocks.size() - i,static_cast<size_t>(batch_count));
+                std::vector<IVolumeBlockProviderInterface::BlockRequest> requests;
+                for(size_t j = 0; j < n; j++){
+                    requests.push_back({blocks[i + j],buffers[j].data(),static_cast<float>(j)});
+                }
+                std::vector<char> ok(n,0);
+                p->getVolumeBlocks(requests,[&](const IVolumeBlockProviderInterface::BlockRequest& request,bool success){
+                    ok[buffer_pos.at(request.dst)] = success;
+                });
+                for(size_t j = 0; j < n; j++){
+                    const auto& index = blocks[i + j];
+                    if(!ok[j]){
+                        throw std::runtime_error("provider load block failed");
+                    }
+                    const auto& buffer = buffers[j];
+                    bool empty = std::all_of(buffer.begin(),buffer.end(),[](uint8_t v){ return v == 0; });
+                    if(empty) continue;
+                    out.write(reinterpret_cast<const char*>(buffer.data()),buffer.size());
+                    brick_offsets[RawBrickFormat::GetTableIndex(header,index)] = cur_offset;
+                    cur_offset += header.brick_bytes;
+                }
+            }
+            LOG_INFO("convert lod {} finish, block count: {}",lod,blocks.size());
+        }
+        out.seekp(header.table_offset,std::ios::beg);
+        out.write(reinterpret_cast<const char*>(brick_offsets.data()),brick_offsets.size() * sizeof(uint64_t));
+        out.close();
+        if(!out){
+            throw std::runtime_error("write output file failed");
+        }
+        STOP_TIMER("convert raw brick file")
+    }
+    catch(const std::exception& err){
+        std::cout<<err.what()<<std::endl;
+        return 1;
+    }
+    return 0;
+}
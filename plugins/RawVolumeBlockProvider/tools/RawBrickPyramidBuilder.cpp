@@ -0,0 +1,420 @@
+//
+// Created by wyz on 2022/5/28.
+//
+#include "../src/RawBrickFormat.hpp"
+#include "algorithm/DownsampleHelper.hpp"
+#include "common/LRU.hpp"
+#include "common/Parrallel.hpp"
+#include "extension/VolumeBlockProviderInterface.hpp"
+#include "plugin/PluginLoader.hpp"
+#include "utils/AsyncFileReader.hpp"
+#include "utils/Timer.hpp"
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <numeric>
+#include <string>
+using namespace mrayns;
+
+/**
+ * 从provider插件或者uint8的raw体数据读取lod0 逐级下采样生成完整的带padding的brick金字塔 输出RawBrickFormat文件
+ * lod n+1只依赖lod n 每一级按Morton顺序分批生成 需要的lod n块放在固定大小的LRU缓存中 不在缓存中的从输出文件读回
+ * 所以内存占用只和缓存大小以及brick大小有关 与体数据大小无关
+ * 计算和写出重叠 每批brick写出的同时计算下一批
+ * usage:
+ *   RawBrickPyramidBuilder <output> <max_lod> <cache_mb> provider <plugin_dir> <provider_key> <input>
+ *   RawBrickPyramidBuilder <output> <max_lod> <cache_mb> raw <input> <dim_x> <dim_y> <dim_z> <block_length> <padding>
+ * max_lod小于0时一直生成到一个块覆盖整个体数据
+ * cache_mb至少要放下一个父块的所有源块 有padding时64个brick 否则8个 太小时直接报错
+ */
+namespace{
+
+using BlockIndex = Volume::BlockIndex;
+using Brick = std::vector<uint8_t>;
+using BrickPtr = std::shared_ptr<Brick>;
+
+uint64_t MortonCode(uint32_t x,uint32_t y,uint32_t z){
+    auto split = [](uint64_t v){
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffff;
+        v = (v | v << 16) & 0x1f0000ff0000ff;
+        v = (v | v << 8) & 0x100f00f00f00f00f;
+        v = (v | v << 4) & 0x10c30c30c30c30c3;
+        v = (v | v << 2) & 0x1249249249249249;
+        return v;
+    };
+    return split(x) | split(y) << 1 | split(z) << 2;
+}
+
+std::vector<BlockIndex> GetLodBlocksInMortonOrder(const RawBrickFormat::Header& header,int lod){
+    int dim_x,dim_y,dim_z;
+    RawBrickFormat::GetLodBlockDim(header,lod,dim_x,dim_y,dim_z);
+    std::vector<BlockIndex> blocks;
+    blocks.reserve(static_cast<size_t>(dim_x) * dim_y * dim_z);
+    for(int z = 0; z < dim_z; z++){
+        for(int y = 0; y < dim_y; y++){
+            for(int x = 0; x < dim_x; x++){
+                blocks.emplace_back(x,y,z,lod);
+            }
+        }
+    }
+    std::sort(blocks.begin(),blocks.end(),[](const BlockIndex& a,const BlockIndex& b){
+        return MortonCode(a.x,a.y,a.z) < MortonCode(b.x,b.y,b.z);
+    });
+    return blocks;
+}
+
+int ComputeMaxLod(const Volume& volume){
+    int max_lod = 0;
+    while(true){
+        auto dim = VolumeHelper::ComputeLodVolumeBlockDim(volume,max_lod);
+        if(dim.x <= 1 && dim.y <= 1 && dim.z <= 1) break;
+        max_lod++;
+    }
+    return max_lod;
+}
+
+//按分配好的偏移顺序写出brick 写出在单独的线程中进行 与下一批的计算重叠
+class BrickWriter{
+  public:
+    BrickWriter(const std::string& filename,const RawBrickFormat::Header& header)
+    :header(header),brick_offsets(RawBrickFormat::GetTableCount(header),RawBrickFormat::InvalidBrickOffset)
+    {
+        out.open(filename,std::ios::binary);
+        if(!out.is_open()){
+            throw std::runtime_error("open output file failed: " + filename);
+        }
+        //先写入头和占位的偏移表 最后回填偏移表
+        out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+        std::vector<char> zeros(header.data_offset - sizeof(header),0);
+        out.write(zeros.data(),zeros.size());
+        out.flush();
+        cur_offset = header.data_offset;
+    }
+
+    //全零的brick不写入
+    void write(const std::vector<std::pair<BlockIndex,BrickPtr>>& bricks,const std::vector<char>& empty){
+        std::vector<BrickPtr> batch;
+        for(size_t i = 0; i < bricks.size(); i++){
+            if(empty[i]) continue;
+            brick_offsets[RawBrickFormat::GetTableIndex(header,bricks[i].first)] = cur_offset;
+            cur_offset += header.brick_bytes;
+            batch.emplace_back(bricks[i].second);
+        }
+        wait();
+        writing = std::async(std::launch::async,[this,batch = std::move(batch)](){
+            for(auto& brick:batch){
+                out.write(reinterpret_cast<const char*>(brick->data()),brick->size());
+            }
+            if(!out){
+                throw std::runtime_error("write output file failed");
+            }
+        });
+    }
+
+    //等待写出完成 之后可以从输出文件读回已经写出的brick
+    void wait(){
+        if(writing.valid()){
+            writing.get();
+            out.flush();
+        }
+    }
+
+    uint64_t getBrickOffset(const BlockIndex& index) const{
+        return brick_offsets[RawBrickFormat::GetTableIndex(header,index)];
+    }
+
+    void finish(){
+        wait();
+        out.seekp(header.table_offset,std::ios::beg);
+        out.write(reinterpret_cast<const char*>(brick_offsets.data()),brick_offsets.size() * sizeof(uint64_t));
+        out.close();
+        if(!out){
+            throw std::runtime_error("write output file failed");
+        }
+    }
+
+  private:
+    RawBrickFormat::Header header;
+    std::vector<uint64_t> brick_offsets;
+    std::ofstream out;
+    uint64_t cur_offset{0};
+    std::future<void> writing;
+};
+
+class PyramidBuilder{
+  public:
+    PyramidBuilder(const Volume& volume,const std::string& output,size_t cacheMB)
+    :volume(volume),header(RawBrickFormat::CreateHeader(volume,0,volume.getMaxLod())),
+    writer(output,header),cache(1)
+    {
+        RawBrickFormat::CheckHeader(header);
+        if(volume.getVoxelType() != Volume::UINT8){
+            throw std::runtime_error("pyramid builder only support uint8 volume");
+        }
+        worker_count = actual_worker_count(0);
+        //缓存至少要同时放下一个父块的所有源块 否则它们会互相替换
+        const size_t min_cache_count = header.padding > 0 ? 64 : 8;
+        size_t cache_count = cacheMB * (size_t(1) << 20) / header.brick_bytes;
+        if(cache_count < min_cache_count){
+            size_t min_cache_mb = (min_cache_count * header.brick_bytes + (size_t(1) << 20) - 1) >> 20;
+            throw std::runtime_error("cache_mb " + std::to_string(cacheMB) + " is too small, need at least "
+                                     + std::to_string(min_cache_mb) + " MB for " + std::to_string(min_cache_count) + " bricks");
+        }
+        cache = LRUCache<BlockIndex,BrickPtr>(cache_count);
+        zero_brick = std::make_shared<Brick>(header.brick_bytes,0);
+        reader.open(output,false);
+        //每批正在生成和正在写出的brick不算在缓存中
+        size_t batch_mb = (static_cast<size_t>(worker_count) * 2 * 2 * header.brick_bytes) >> 20;
+        LOG_INFO("pyramid builder: max lod {}, cache {} bricks, {} workers, about {} MB more for in-flight batches",
+                 volume.getMaxLod(),cache_count,worker_count,batch_mb);
+    }
+
+    /**
+     * @param load 把一批lod0块读入对应的buffer
+     */
+    void build(const std::function<void(const std::vector<std::pair<BlockIndex,BrickPtr>>&)>& load){
+        START_TIMER
+        auto blocks = GetLodBlocksInMortonOrder(header,0);
+        size_t batch_size = worker_count * 2;
+        for(size_t i = 0; i < blocks.size(); i += batch_size){
+            size_t n = (std::min)(blocks.size() - i,batch_size);
+            std::vector<std::pair<BlockIndex,BrickPtr>> batch;
+            for(size_t j = 0; j < n; j++){
+                batch.emplace_back(blocks[i + j],std::make_shared<Brick>(header.brick_bytes));
+            }
+            load(batch);
+            emit(batch);
+        }
+        LOG_INFO("build lod 0 finish, block count: {}",blocks.size());
+        for(int lod = 1; lod <= header.max_lod; lod++){
+            writer.wait();
+            buildLod(lod);
+        }
+        writer.finish();
+        STOP_TIMER("build raw brick pyramid")
+    }
+
+  private:
+    //生成一批brick后检查是否全零 放入缓存并交给writer
+    void emit(const std::vector<std::pair<BlockIndex,BrickPtr>>& batch){
+        std::vector<char> empty(batch.size(),0);
+        std::vector<size_t> indices(batch.size());
+        std::iota(indices.begin(),indices.end(),0);
+        parallel_foreach(indices,[&](int,size_t i){
+            const auto& brick = *batch[i].second;
+            empty[i] = std::all_of(brick.begin(),brick.end(),[](uint8_t v){ return v == 0; });
+        },worker_count);
+        for(auto& item:batch){
+            cache.emplace_back(item.first,item.second);
+        }
+        writer.write(batch,empty);
+    }
+
+    void getSourceBlocks(const BlockIndex& index,std::vector<BlockIndex>& sources) const{
+        sources.clear();
+        int dim_x,dim_y,dim_z;
+        RawBrickFormat::GetLodBlockDim(header,index.w - 1,dim_x,dim_y,dim_z);
+        //有padding时需要子块外面一圈的块 包括角上的块
+        int r = header.padding > 0 ? 1 : 0;
+        for(int z = 2 * index.z - r; z <= 2 * index.z + 1 + r; z++){
+            for(int y = 2 * index.y - r; y <= 2 * index.y + 1 + r; y++){
+                for(int x = 2 * index.x - r; x <= 2 * index.x + 1 + r; x++){
+                    if(x < 0 || y < 0 || z < 0 || x >= dim_x || y >= dim_y || z >= dim_z) continue;
+                    sources.emplace_back(x,y,z,index.w - 1);
+                }
+            }
+        }
+    }
+
+    //一批父块需要的lod n-1块 命中缓存的直接使用 否则从输出文件读回 没有写出的块是全零的
+    std::unordered_map<BlockIndex,const uint8_t*> fetchSources(const std::vector<BlockIndex>& blocks,
+                                                                std::vector<BrickPtr>& pinned){
+        std::unordered_map<BlockIndex,const uint8_t*> sources;
+        std::vector<AsyncFileReader::Request> requests;
+        std::atomic<bool> ok{true};
+        for(auto& index:blocks){
+            if(sources.count(index)) continue;
+            BrickPtr brick;
+            if(auto p = cache.get_value_ptr(index)){
+                brick = *p;
+            }
+            else{
+                auto offset = writer.getBrickOffset(index);
+                if(offset == RawBrickFormat::InvalidBrickOffset){
+                    brick = zero_brick;
+                }
+                else{
+                    brick = std::make_shared<Brick>(header.brick_bytes);
+                    requests.push_back({offset,header.brick_bytes,brick->data(),[&ok](bool success){
+                        if(!success) ok = false;
+                    }});
+                    cache.emplace_back(index,brick);
+                }
+            }
+            pinned.emplace_back(brick);
+            sources[index] = brick->data();
+        }
+        if(!requests.empty()){
+            reader.submit(std::move(requests));
+            reader.wait();
+        }
+        if(!ok){
+            throw std::runtime_error("read back brick from output file failed");
+        }
+        return sources;
+    }
+
+    void buildLod(int lod){
+        auto blocks = GetLodBlocksInMortonOrder(header,lod);
+        //一批中需要的源块不超过缓存的一半 保证同一批的源块不会互相替换
+        const size_t max_batch_sources = (std::max<size_t>)(cache.get_capacity() / 2,1);
+        std::vector<BlockIndex> block_sources;
+        size_t i = 0;
+        while(i < blocks.size()){
+            std::vector<BlockIndex> batch_blocks;
+            std::vector<BlockIndex> batch_sources;
+            while(i < blocks.size() && batch_blocks.size() < static_cast<size_t>(worker_count) * 2){
+                getSourceBlocks(blocks[i],block_sources);
+                if(!batch_blocks.empty() && batch_sources.size() + block_sources.size() > max_batch_sources) break;
+                batch_sources.insert(batch_sources.end(),block_sources.begin(),block_sources.end());
+                batch_blocks.emplace_back(blocks[i++]);
+            }
+            std::vector<BrickPtr> pinned;
+            auto sources = fetchSources(batch_sources,pinned);
+
+            std::vector<std::pair<BlockIndex,BrickPtr>> batch;
+            for(auto& index:batch_blocks){
+                batch.emplace_back(index,std::make_shared<Brick>(header.brick_bytes));
+            }
+            parallel_foreach(batch,[&](int,const std::pair<BlockIndex,BrickPtr>& item){
+                DownsampleHelper::DownsampleBlock(volume,item.first,sources,item.second->data(),DownsampleHelper::AVERAGE);
+            },worker_count);
+            emit(batch);
+        }
+        LOG_INFO("build lod {} finish, block count: {}",lod,blocks.size());
+    }
+
+  private:
+    Volume volume;
+    RawBrickFormat::Header header;
+    BrickWriter writer;
+    AsyncFileReader reader;
+    LRUCache<BlockIndex,BrickPtr> cache;
+    BrickPtr zero_brick;
+    int worker_count{1};
+};
+
+//从x y z顺序存储的uint8 raw文件中读取brick 一行一个读取请求 超出体数据的部分为零
+void LoadRawBricks(AsyncFileReader& reader,const Volume& volume,const std::vector<std::pair<BlockIndex,BrickPtr>>& batch){
+    const int block_length = volume.getBlockLength();
+    const int padding = volume.getBlockPadding();
+    const int nopad = volume.getBlockLengthWithoutPadding();
+    const int64_t dim_x = volume.volume_dim_x,dim_y = volume.volume_dim_y,dim_z = volume.volume_dim_z;
+    std::atomic<bool> ok{true};
+    std::vector<AsyncFileReader::Request> requests;
+    for(auto& item:batch){
+        const auto& index = item.first;
+        auto& brick = *item.second;
+        std::fill(brick.begin(),brick.end(),0);
+        int64_t x0 = static_cast<int64_t>(index.x) * nopad - padding;
+        int64_t y0 = static_cast<int64_t>(index.y) * nopad - padding;
+        int64_t z0 = static_cast<int64_t>(index.z) * nopad - padding;
+        int64_t gx0 = (std::max<int64_t>)(x0,0);
+        int64_t gx1 = (std::min<int64_t>)(x0 + block_length,dim_x);
+        if(gx0 >= gx1) continue;
+        for(int k = 0; k < block_length; k++){
+            int64_t gz = z0 + k;
+            if(gz < 0 || gz >= dim_z) continue;
+            for(int j = 0; j < block_length; j++){
+                int64_t gy = y0 + j;
+                if(gy < 0 || gy >= dim_y) continue;
+                auto dst = brick.data() + (static_cast<size_t>(k) * block_length + j) * block_length + (gx0 - x0);
+                requests.push_back({static_cast<uint64_t>((gz * dim_y + gy) * dim_x + gx0),static_cast<size_t>(gx1 - gx0),dst,
+                                    [&ok](bool success){
+                                        if(!success) ok = false;
+                                    }});
+            }
+        }
+    }
+    reader.submit(std::move(requests));
+    reader.wait();
+    if(!ok){
+        throw std::runtime_error("read raw volume failed");
+    }
+}
+
+}
+
+int main(int argc,char** argv){
+    const char* usage = "usage:\n"
+                        "  RawBrickPyramidBuilder <output> <max_lod> <cache_mb> provider <plugin_dir> <provider_key> <input>\n"
+                        "  RawBrickPyramidBuilder <output> <max_lod> <cache_mb> raw <input> <dim_x> <dim_y> <dim_z> <block_length> <padding>";
+    if(argc < 5){
+        std::cout<<usage<<std::endl;
+        return 1;
+    }
+    try{
+        std::string output = argv[1];
+        int max_lod = std::stoi(argv[2]);
+        size_t cache_mb = std::stoul(argv[3]);
+        std::string mode = argv[4];
+        if(mode == "provider" && argc >= 8){
+            PluginLoader::LoadPlugins(argv[5]);
+            auto p = std::unique_ptr<IVolumeBlockProviderInterface>(
+                PluginLoader::CreatePlugin<IVolumeBlockProviderInterface>(argv[6]));
+            if(!p){
+                throw std::runtime_error(std::string("can't create provider: ") + argv[6]);
+            }
+            p->setHostNode(&HostNode::getInstance());
+            p->open(argv[7]);
+            auto volume = p->getVolume();
+            if(!volume.isValid()){
+                throw std::runtime_error("provider return invalid volume");
+            }
+            volume.max_lod = max_lod < 0 ? ComputeMaxLod(volume) : max_lod;
+            PyramidBuilder builder(volume,output,cache_mb);
+            builder.build([&](const std::vector<std::pair<BlockIndex,BrickPtr>>& batch){
+                std::vector<IVolumeBlockProviderInterface::BlockRequest> requests;
+                for(size_t i = 0; i < batch.size(); i++){
+                    requests.push_back({batch[i].first,batch[i].second->data(),static_cast<float>(i)});
+                }
+                std::atomic<bool> ok{true};
+                p->getVolumeBlocks(requests,[&](const IVolumeBlockProviderInterface::BlockRequest&,bool success){
+                    if(!success) ok = false;
+                });
+                if(!ok){
+                    throw std::runtime_error("provider load block failed");
+                }
+            });
+        }
+        else if(mode == "raw" && argc >= 11){
+            Volume volume;
+            volume.name = "raw";
+            volume.voxel_type = Volume::UINT8;
+            volume.volume_dim_x = std::stoi(argv[6]);
+            volume.volume_dim_y = std::stoi(argv[7]);
+            volume.volume_dim_z = std::stoi(argv[8]);
+            volume.volume_space_x = volume.volume_space_y = volume.volume_space_z = 1.f;
+            volume.block_length = std::stoi(argv[9]);
+            volume.padding = std::stoi(argv[10]);
+            volume.max_lod = max_lod < 0 ? ComputeMaxLod(volume) : max_lod;
+            AsyncFileReader input;
+            input.open(argv[5],false);
+            PyramidBuilder builder(volume,output,cache_mb);
+            builder.build([&](const std::vector<std::pair<BlockIndex,BrickPtr>>& batch){
+                LoadRawBricks(input,volume,batch);
+            });
+        }
+        else{
+            std::cout<<usage<<std::endl;
+            return 1;
+        }
+    }
+    catch(const std::exception& err){
+        std::cout<<err.what()<<std::endl;
+        return 1;
+    }
+    return 0;
+}
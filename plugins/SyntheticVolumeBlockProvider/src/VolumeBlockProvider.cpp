@@ -0,0 +1,424 @@
+//
+// Created by wyz on 2022/5/22.
+//
+#include "VolumeBlockProvider.hpp"
+#include "common/Logger.hpp"
+#include <json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <thread>
+MRAYNS_BEGIN
+
+/**
+ * 体素的值只由它在lod0中的位置和seed决定 因此padding和相邻块一致 不同线程 不同次运行生成的结果相同
+ * 背景是value noise 按lod0块为单位随机置零模拟稀疏的脑区 神经纤维用网格中随机节点相连的线段表示
+ */
+struct SyntheticVolumeBlockProvider::Impl{
+    //超过这一层后纤维网格随lod变粗 避免大lod的块需要遍历过多的网格
+    static constexpr int FilamentFullDetailLod = 2;
+
+    uint64_t seed{0};
+    int64_t dim[3]{16384,16384,8192};
+    float space[3]{1.f,1.f,1.f};
+    int block_length{256};
+    int padding{2};
+    int max_lod{-1};
+    float sparsity{0.5f};
+    float noise_amplitude{24.f};
+    int64_t noise_scale{32};
+    float filament_density{0.3f};
+    int64_t filament_cell{64};
+    float filament_radius{2.f};
+    float filament_intensity{220.f};
+    float decode_latency_ms{0.f};
+    float decode_throughput_mb{0.f};
+
+    void loadConfig(const std::string& filename){
+        auto first = filename.find_first_not_of(" \t\r\n");
+        if(first == std::string::npos) return;
+        nlohmann::json j;
+        if(filename[first] == '{'){
+            j = nlohmann::json::parse(filename);
+        }
+        else{
+            std::ifstream in(filename);
+            if(!in.is_open()){
+                throw std::runtime_error("open synthetic volume config failed: " + filename);
+            }
+            in >> j;
+        }
+        seed = j.value("seed",seed);
+        if(j.contains("dim")){
+            for(int i = 0; i < 3; i++) dim[i] = j["dim"][i].get<int64_t>();
+        }
+        if(j.contains("space")){
+            for(int i = 0; i < 3; i++) space[i] = j["space"][i].get<float>();
+        }
+        block_length = j.value("block_length",block_length);
+        padding = j.value("padding",padding);
+        max_lod = j.value("max_lod",max_lod);
+        sparsity = j.value("sparsity",sparsity);
+        noise_amplitude = j.value("noise_amplitude",noise_amplitude);
+        noise_scale = j.value("noise_scale",noise_scale);
+        filament_density = j.value("filament_density",filament_density);
+        filament_cell = j.value("filament_cell",filament_cell);
+        filament_radius = j.value("filament_radius",filament_radius);
+        filament_intensity = j.value("filament_intensity",filament_intensity);
+        decode_latency_ms = j.value("decode_latency_ms",decode_latency_ms);
+        decode_throughput_mb = j.value("decode_throughput_mb",decode_throughput_mb);
+    }
+
+    Volume createVolume(){
+        for(int i = 0; i < 3; i++){
+            if(dim[i] <= 0 || dim[i] > std::numeric_limits<int>::max()){
+                throw std::runtime_error("invalid synthetic volume dim");
+            }
+        }
+        if(block_length <= 2 * padding || noise_scale <= 0 || filament_cell <= 0){
+            throw std::runtime_error("invalid synthetic volume config");
+        }
+        Volume volume;
+        volume.name = "synthetic";
+        volume.voxel_type = Volume::UINT8;
+        volume.block_length = block_length;
+        volume.padding = padding;
+        volume.volume_dim_x = static_cast<int>(dim[0]);
+        volume.volume_dim_y = static_cast<int>(dim[1]);
+        volume.volume_dim_z = static_cast<int>(dim[2]);
+        volume.volume_space_x = space[0];
+        volume.volume_space_y = space[1];
+        volume.volume_space_z = space[2];
+        if(max_lod < 0){
+            //直到最粗的一层只有一个块
+            int64_t no_padding = block_length - 2 * padding;
+            int64_t n = (std::max)({dim[0],dim[1],dim[2]});
+            int64_t blocks = (n + no_padding - 1) / no_padding;
+            max_lod = 0;
+            while((int64_t(1) << max_lod) < blocks) max_lod++;
+        }
+        volume.max_lod = max_lod;
+        return volume;
+    }
+
+    static uint64_t Mix(uint64_t x){
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+    static uint64_t Hash(uint64_t s,int64_t x,int64_t y,int64_t z){
+        return Mix(Mix(Mix(s ^ static_cast<uint64_t>(x)) ^ static_cast<uint64_t>(y)) ^ static_cast<uint64_t>(z));
+    }
+    static float ToUnit(uint64_t h){
+        return static_cast<float>(h >> 40) * (1.f / 16777216.f);
+    }
+
+    int64_t noPadding() const{
+        return block_length - 2 * padding;
+    }
+    //lod0中的块是否整个为零
+    bool isEmptyBlock(int64_t x,int64_t y,int64_t z) const{
+        return sparsity > 0.f && ToUnit(Hash(seed,x,y,z)) < sparsity;
+    }
+    bool isEmptyPosition(float x,float y,float z) const{
+        auto l = static_cast<float>(noPadding());
+        return isEmptyBlock(static_cast<int64_t>(std::floor(x / l)),static_cast<int64_t>(std::floor(y / l)),
+                            static_cast<int64_t>(std::floor(z / l)));
+    }
+    bool isInsideVolume(float x,float y,float z) const{
+        return x >= 0.f && y >= 0.f && z >= 0.f && x < dim[0] && y < dim[1] && z < dim[2];
+    }
+
+    struct Node{
+        bool valid{false};
+        float pos[3];
+        float radius;
+    };
+    Node getFilamentNode(int64_t x,int64_t y,int64_t z,int64_t cell) const{
+        Node node;
+        auto h = Hash(seed ^ 0x5f3759dfull,x,y,z);
+        if(ToUnit(h) >= filament_density) return node;
+        int64_t c[3] = {x,y,z};
+        for(int i = 0; i < 3; i++){
+            h = Mix(h);
+            node.pos[i] = (static_cast<float>(c[i]) + 0.2f + 0.6f * ToUnit(h)) * static_cast<float>(cell);
+        }
+        h = Mix(h);
+        node.radius = filament_radius * (0.7f + 0.6f * ToUnit(h));
+        node.valid = !isEmptyPosition(node.pos[0],node.pos[1],node.pos[2]);
+        return node;
+    }
+
+    struct BlockRegion{
+        uint8_t* data;
+        int64_t origin[3];//块中第一个体素在当前lod中的坐标 包括padding
+        int64_t lod_t;
+    };
+
+    //每个体素的位置为体素中心在lod0中的坐标
+    void generateNoise(const BlockRegion& region) const{
+        const auto h = static_cast<float>(region.lod_t);
+        const int64_t l = block_length;
+        const int64_t scale = (std::max)(noise_scale,region.lod_t * 4);
+        const float inv_scale = 1.f / static_cast<float>(scale);
+        int64_t lattice_min[3],lattice_count[3];
+        for(int i = 0; i < 3; i++){
+            lattice_min[i] = static_cast<int64_t>(std::floor((region.origin[i] + 0.5f) * h * inv_scale));
+            lattice_count[i] = static_cast<int64_t>(std::floor((region.origin[i] + l - 0.5f) * h * inv_scale)) - lattice_min[i] + 2;
+        }
+        std::vector<float> lattice(lattice_count[0] * lattice_count[1] * lattice_count[2]);
+        for(int64_t z = 0; z < lattice_count[2]; z++){
+            for(int64_t y = 0; y < lattice_count[1]; y++){
+                for(int64_t x = 0; x < lattice_count[0]; x++){
+                    lattice[(z * lattice_count[1] + y) * lattice_count[0] + x] =
+                        ToUnit(Hash(seed ^ 0x2545f4914f6cdd1dull,lattice_min[0] + x,lattice_min[1] + y,lattice_min[2] + z));
+                }
+            }
+        }
+        auto lattice_at = [&](int64_t x,int64_t y,int64_t z){
+            return lattice[(z * lattice_count[1] + y) * lattice_count[0] + x];
+        };
+        std::vector<float> row(lattice_count[0]);
+        //x方向的lattice位置和所属lod0块与行无关 提前算好 同一lattice区间内只需要一次线性插值
+        const auto block_l = static_cast<float>(noPadding());
+        struct Run{
+            int64_t begin,end,key;
+        };
+        std::vector<float> fx(l);
+        std::vector<Run> lattice_runs,block_runs;
+        int64_t inside_begin = l,inside_end = 0;
+        for(int64_t i = 0; i < l; i++){
+            float px = (region.origin[0] + i + 0.5f) * h;
+            float ux = px * inv_scale;
+            int64_t ix = static_cast<int64_t>(std::floor(ux)) - lattice_min[0];
+            int64_t bx = static_cast<int64_t>(std::floor(px / block_l));
+            fx[i] = ux - std::floor(ux);
+            if(lattice_runs.empty() || lattice_runs.back().key != ix) lattice_runs.push_back({i,i,ix});
+            lattice_runs.back().end = i + 1;
+            if(block_runs.empty() || block_runs.back().key != bx) block_runs.push_back({i,i,bx});
+            block_runs.back().end = i + 1;
+            if(px >= 0.f && px < dim[0]){
+                inside_begin = (std::min)(inside_begin,i);
+                inside_end = i + 1;
+            }
+        }
+        for(int64_t k = 0; k < l; k++){
+            float pz = (region.origin[2] + k + 0.5f) * h;
+            float uz = pz * inv_scale;
+            int64_t iz = static_cast<int64_t>(std::floor(uz)) - lattice_min[2];
+            float fz = uz - std::floor(uz);
+            int64_t bz = static_cast<int64_t>(std::floor(pz / block_l));
+            for(int64_t j = 0; j < l; j++){
+                uint8_t* dst = region.data + (k * l + j) * l;
+                float py = (region.origin[1] + j + 0.5f) * h;
+                if(!isInsideVolume(0.f,py,pz) || inside_begin >= inside_end){
+                    std::memset(dst,0,l);
+                    continue;
+                }
+                float uy = py * inv_scale;
+                int64_t iy = static_cast<int64_t>(std::floor(uy)) - lattice_min[1];
+                float fy = uy - std::floor(uy);
+                for(int64_t x = 0; x < lattice_count[0]; x++){
+                    float a = lattice_at(x,iy,iz) + (lattice_at(x,iy + 1,iz) - lattice_at(x,iy,iz)) * fy;
+                    float b = lattice_at(x,iy,iz + 1) + (lattice_at(x,iy + 1,iz + 1) - lattice_at(x,iy,iz + 1)) * fy;
+                    row[x] = (a + (b - a) * fz) * noise_amplitude;
+                }
+                const float* f = fx.data();
+                for(auto& run:lattice_runs){
+                    const float a = row[run.key];
+                    const float d = row[run.key + 1] - a;
+                    for(int64_t i = run.begin; i < run.end; i++){
+                        dst[i] = static_cast<uint8_t>((std::min)(a + d * f[i],255.f));
+                    }
+                }
+                int64_t by = static_cast<int64_t>(std::floor(py / block_l));
+                for(auto& run:block_runs){
+                    if(isEmptyBlock(run.key,by,bz)){
+                        std::memset(dst + run.begin,0,run.end - run.begin);
+                    }
+                }
+                std::memset(dst,0,inside_begin);
+                std::memset(dst + inside_end,0,l - inside_end);
+            }
+        }
+    }
+
+    //沿线段等间隔采样 对每个采样点邻域内的体素计算到线段的精确距离
+    void drawSegment(const BlockRegion& region,const float a[3],const float b[3],float radius) const{
+        const auto h = static_cast<float>(region.lod_t);
+        const int64_t l = block_length;
+        radius = (std::max)(radius,0.75f * h);
+        float d[3] = {b[0] - a[0],b[1] - a[1],b[2] - a[2]};
+        float len2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        for(int i = 0; i < 3; i++){
+            float lo = ((std::min)(a[i],b[i]) - radius) / h - 0.5f - region.origin[i];
+            float hi = ((std::max)(a[i],b[i]) + radius) / h - 0.5f - region.origin[i];
+            if(hi < 0.f || lo >= l) return;
+        }
+        //采样点间隔为step时 邻域半径取n个体素就能覆盖所有到线段距离小于radius的体素
+        //细纤维在粗lod上用半个体素的步长邻域更小 选择计算量小的一种
+        auto neighbor = [&](float step){
+            return static_cast<int>(std::ceil((radius + step * 0.5f) / h));
+        };
+        auto cost = [&](float step){
+            float w = 2.f * neighbor(step) + 1.f;
+            return w * w * w / step;
+        };
+        float step = cost(h * 0.5f) < cost(h) ? h * 0.5f : h;
+        int n = neighbor(step);
+        int steps = (std::max)(1,static_cast<int>(std::ceil(std::sqrt(len2) / step)));
+        for(int s = 0; s <= steps; s++){
+            float t = static_cast<float>(s) / steps;
+            int64_t c[3];
+            for(int i = 0; i < 3; i++){
+                c[i] = static_cast<int64_t>(std::floor((a[i] + d[i] * t) / h)) - region.origin[i];
+            }
+            for(int64_t k = (std::max)(c[2] - n,int64_t(0)); k <= (std::min)(c[2] + n,l - 1); k++){
+                for(int64_t j = (std::max)(c[1] - n,int64_t(0)); j <= (std::min)(c[1] + n,l - 1); j++){
+                    for(int64_t i = (std::max)(c[0] - n,int64_t(0)); i <= (std::min)(c[0] + n,l - 1); i++){
+                        float p[3] = {(region.origin[0] + i + 0.5f) * h,(region.origin[1] + j + 0.5f) * h,
+                                      (region.origin[2] + k + 0.5f) * h};
+                        float ap[3] = {p[0] - a[0],p[1] - a[1],p[2] - a[2]};
+                        float u = len2 > 0.f ? (ap[0] * d[0] + ap[1] * d[1] + ap[2] * d[2]) / len2 : 0.f;
+                        u = (std::min)((std::max)(u,0.f),1.f);
+                        float q[3] = {ap[0] - d[0] * u,ap[1] - d[1] * u,ap[2] - d[2] * u};
+                        float dist = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2]);
+                        if(dist >= radius) continue;
+                        if(!isInsideVolume(p[0],p[1],p[2]) || isEmptyPosition(p[0],p[1],p[2])) continue;
+                        auto v = static_cast<uint8_t>((std::min)(filament_intensity * (1.f - dist / radius),255.f));
+                        auto& dst = region.data[(k * l + j) * l + i];
+                        dst = (std::max)(dst,v);
+                    }
+                }
+            }
+        }
+    }
+
+    void generateFilaments(const BlockRegion& region,int lod) const{
+        if(filament_density <= 0.f) return;
+        static const int Directions[13][3] = {
+            {1,0,0},{0,1,0},{0,0,1},
+            {1,1,0},{1,-1,0},{1,0,1},{1,0,-1},{0,1,1},{0,1,-1},
+            {1,1,1},{1,1,-1},{1,-1,1},{1,-1,-1}
+        };
+        const int64_t cell = filament_cell << (std::max)(0,lod - FilamentFullDetailLod);
+        const auto h = region.lod_t;
+        const int64_t margin = cell + static_cast<int64_t>(std::ceil(filament_radius * 1.3f)) + h;
+        int64_t cell_min[3],cell_max[3];
+        for(int i = 0; i < 3; i++){
+            int64_t lo = region.origin[i] * h - margin;
+            int64_t hi = (region.origin[i] + block_length) * h + margin;
+            cell_min[i] = lo >= 0 ? lo / cell : -((-lo + cell - 1) / cell);
+            cell_max[i] = hi >= 0 ? hi / cell : -((-hi + cell - 1) / cell);
+        }
+        for(int64_t z = cell_min[2]; z <= cell_max[2]; z++){
+            for(int64_t y = cell_min[1]; y <= cell_max[1]; y++){
+                for(int64_t x = cell_min[0]; x <= cell_max[0]; x++){
+                    auto node = getFilamentNode(x,y,z,cell);
+                    if(!node.valid) continue;
+                    //每个节点向正半空间的一到两个邻居连线 每条边只由一个节点生成
+                    auto h0 = Hash(seed ^ 0x9e3779b9ull,x,y,z);
+                    int edges[2] = {static_cast<int>(h0 % 13),(h0 >> 8) & 1 ? static_cast<int>((h0 >> 16) % 13) : -1};
+                    for(int e:edges){
+                        if(e < 0) continue;
+                        auto& dir = Directions[e];
+                        auto neighbor = getFilamentNode(x + dir[0],y + dir[1],z + dir[2],cell);
+                        if(!neighbor.valid) continue;
+                        drawSegment(region,node.pos,neighbor.pos,(node.radius + neighbor.radius) * 0.5f);
+                    }
+                }
+            }
+        }
+    }
+
+    //padding区域覆盖的lod0块全部为空时直接置零
+    bool isEmptyRegion(const BlockRegion& region) const{
+        int64_t lo[3],hi[3];
+        int64_t count = 1;
+        for(int i = 0; i < 3; i++){
+            int64_t a = (std::max)(region.origin[i] * region.lod_t,int64_t(0));
+            int64_t b = (std::max)((region.origin[i] + block_length) * region.lod_t - 1,int64_t(0));
+            lo[i] = a / noPadding();
+            hi[i] = b / noPadding();
+            count *= hi[i] - lo[i] + 1;
+        }
+        if(count > 64) return false;
+        for(int64_t z = lo[2]; z <= hi[2]; z++)
+            for(int64_t y = lo[1]; y <= hi[1]; y++)
+                for(int64_t x = lo[0]; x <= hi[0]; x++)
+                    if(!isEmptyBlock(x,y,z)) return false;
+        return true;
+    }
+
+    void generate(void* dst,const BlockIndex& index) const{
+        BlockRegion region;
+        region.data = reinterpret_cast<uint8_t*>(dst);
+        region.lod_t = int64_t(1) << index.w;
+        int64_t b[3] = {index.x,index.y,index.z};
+        for(int i = 0; i < 3; i++){
+            region.origin[i] = b[i] * noPadding() - padding;
+        }
+        if(isEmptyRegion(region)){
+            std::memset(dst,0,static_cast<size_t>(block_length) * block_length * block_length);
+            return;
+        }
+        generateNoise(region);
+        generateFilaments(region,index.w);
+    }
+
+    //补足到设定的解码耗时 用于模拟真实的编解码器
+    void emulateDecodeCost(std::chrono::steady_clock::time_point start) const{
+        double target_ms = decode_latency_ms;
+        if(decode_throughput_mb > 0.f){
+            double mb = static_cast<double>(block_length) * block_length * block_length / (1024.0 * 1024.0);
+            target_ms += mb / decode_throughput_mb * 1000.0;
+        }
+        if(target_ms <= 0.0) return;
+        auto end = start + std::chrono::microseconds(static_cast<int64_t>(target_ms * 1000.0));
+        std::this_thread::sleep_until(end);
+    }
+};
+
+SyntheticVolumeBlockProvider::SyntheticVolumeBlockProvider()
+{
+    impl = std::make_unique<Impl>();
+}
+SyntheticVolumeBlockProvider::~SyntheticVolumeBlockProvider()
+{
+
+}
+void SyntheticVolumeBlockProvider::open(const std::string &filename)
+{
+    impl->loadConfig(filename);
+
+    volume = impl->createVolume();
+    assert(volume.isValid());
+    LOG_INFO("synthetic volume dim: {} {} {}, max lod: {}",volume.volume_dim_x,volume.volume_dim_y,volume.volume_dim_z,volume.max_lod);
+}
+void SyntheticVolumeBlockProvider::setHostNode(HostNode* hostNode)
+{
+    assert(hostNode);
+    this->host_node = hostNode;
+}
+const Volume& SyntheticVolumeBlockProvider::getVolume() const
+{
+    return this->volume;
+}
+void SyntheticVolumeBlockProvider::getVolumeBlock(void *dst, BlockIndex blockIndex)
+{
+    if(!blockIndex.isValid() || blockIndex.w > volume.getMaxLod()){
+        throw std::runtime_error("invalid synthetic volume block index");
+    }
+    auto start = std::chrono::steady_clock::now();
+    impl->generate(dst,blockIndex);
+    impl->emulateDecodeCost(start);
+}
+
+MRAYNS_END
+
+REGISTER_PLUGIN_FACTORY_IMPL(SyntheticVolumeBlockProviderFactory)
+EXPORT_PLUGIN_FACTORY_IMPL(SyntheticVolumeBlockProviderFactory)
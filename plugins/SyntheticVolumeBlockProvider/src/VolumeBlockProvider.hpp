@@ -0,0 +1,65 @@
+//
+// Created by wyz on 2022/5/22.
+//
+#pragma once
+
+#include "extension/VolumeBlockProviderInterface.hpp"
+#include "plugin/Plugin.hpp"
+#include <memory>
+MRAYNS_BEGIN
+
+/**
+ * @brief Generate uint8 volume blocks procedurally from a seed, no data file needed.
+ * Same config always gives same voxels, so it can be used for reproducible tests and benchmarks.
+ * open() accepts a json file path or an inline json string, empty string for default config:
+ * {
+ *   "seed": 0,
+ *   "dim": [x,y,z], "space": [x,y,z],
+ *   "block_length": 256, "padding": 2, "max_lod": -1(auto),
+ *   "sparsity": 0.5,                 //fraction of lod0 blocks which are all zero
+ *   "noise_amplitude": 24, "noise_scale": 32,
+ *   "filament_density": 0.3, "filament_cell": 64, "filament_radius": 2, "filament_intensity": 220,
+ *   "decode_latency_ms": 0, "decode_throughput_mb": 0   //emulate codec cost, 0 means no limit
+ * }
+ */
+class SyntheticVolumeBlockProvider: public IVolumeBlockProviderInterface{
+  public:
+    SyntheticVolumeBlockProvider();
+
+    ~SyntheticVolumeBlockProvider() override;
+
+    void open(const std::string& filename) override;
+
+    void setHostNode(HostNode* hostNode) override;
+
+    const Volume& getVolume() const override;
+
+    void getVolumeBlock(void* dst,BlockIndex blockIndex) override;
+
+  private:
+
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+    HostNode* host_node{nullptr};
+
+    Volume volume;
+};
+
+MRAYNS_END
+
+class SyntheticVolumeBlockProviderFactory: public mrayns::IPluginFactory{
+  public:
+    std::string Key() const override{
+        return "synthetic-block-provider";
+    }
+    void *Create(const std::string &key) override{
+        return new ::mrayns::SyntheticVolumeBlockProvider();
+    }
+    std::string GetModuleID() const override{
+        return ::mrayns::module_id_traits<::mrayns::IVolumeBlockProviderInterface>::GetModuleID();
+    }
+};
+
+REGISTER_PLUGIN_FACTORY_DECL(SyntheticVolumeBlockProviderFactory)
+EXPORT_PLUGIN_FACTORY_DECL(SyntheticVolumeBlockProviderFactory)
@@ -18,44 +18,33 @@ layout(std140,binding = 2) uniform VolumeInfoUBO{
     float voxel; //4
 
     vec3 inv_texture_shape[MaxTextureNum];//256
+    uvec4 lod_page_directory[MaxVolumeLod];//每个lod的块数xyz和在页目录中的起始位置w
 }volumeInfoUBO;
 
-//64mb uniform buffer
-const int HashTableSize = 1024;
-layout(binding = 3) uniform PageTable{
-    ivec4 hash_table[HashTableSize][2];
+//直接索引的页目录 与internal::PageDirectory的布局相同
+const int MaxResidentBlockCount = 32768;
+const uint InvalidPageID = 0xffffffffu;
+layout(std430,binding = 3) readonly buffer PageTable{
+    uint entries[MaxResidentBlockCount];//常驻块的texture entry x y z各9位 w为5位
+    uint directory[];//每个lod每个块对应的常驻块编号 高8位不为0时是缺失块的祖先块 值为两者的lod差
 }pageTable;
-
-
-uint GetHashValue(in uvec4 key){
-    uint value = key[0];
-    for(int i = 1; i < 4; i++){
-        value = value ^  (key[i] + 0x9e3779b9 + (value << 6) + (value >> 2));
+const uint FallbackLodShift = 24u;
+
+//lodOffset为实际命中的块相对于key的lod差 缺失的块由最近的常驻祖先块代替
+uvec4 QueryPageTable(in uvec4 key,out int lodOffset){
+    lodOffset = 0;
+    uvec4 lod = volumeInfoUBO.lod_page_directory[min(key.w,uint(MaxVolumeLod - 1))];
+    if(key.w >= uint(MaxVolumeLod) || any(greaterThanEqual(key.xyz,lod.xyz))){
+        return uvec4(MaxTextureNum);
     }
-    return value;
-}
-uvec4 QueryPageTable(in uvec4 key){
-    uint hash_v = GetHashValue(key);
-    uint pos = hash_v % HashTableSize;
-    int i = 0;
-    bool positive = false;
-    while(true){
-        int ii = i*i;
-        pos += positive ? ii : -ii;
-        pos %= HashTableSize;
-        if(pageTable.hash_table[pos][0].w >=0 && GetHashValue(pageTable.hash_table[pos][0]) == hash_v){
-            return pageTable.hash_table[pos][1];
-        }
-        else if(pageTable.hash_table[pos][0].w < 0){
-            return uvec4(MaxTextureNum);
-        }
-        if(!positive) i++;
-        positive = !positive;
-        if(i > HashTableSize){
-            break;
-        }
+    uint id = pageTable.directory[lod.w + (key.z * lod.y + key.y) * lod.x + key.x];
+    if(id == InvalidPageID){
+        return uvec4(MaxTextureNum);
     }
-    return uvec4(MaxTextureNum);
+    lodOffset = int(id >> FallbackLodShift);
+    id &= (1u << FallbackLodShift) - 1u;
+    uint entry = pageTable.entries[id];
+    return uvec4(entry & 0x1ffu,(entry >> 9) & 0x1ffu,(entry >> 18) & 0x1ffu,entry >> 27);
 }
 const int RENDER_TYPE_MIP = 0;
 const int RENDER_TYPE_RAYCAST = 1;
@@ -93,10 +82,16 @@ int VirtualSample(in int sampleLod,in vec3 samplePos,out float sampleScalar){
     int sampleLodT = 1 << sampleLod;
     vec3 block_index = vec3(ivec3(samplePos / (volumeInfoUBO.virtual_block_length_space * sampleLodT)));
 
-    uvec4 texture_entry = QueryPageTable(uvec4(block_index,sampleLod));
+    int lod_offset;
+    uvec4 texture_entry = QueryPageTable(uvec4(block_index,sampleLod),lod_offset);
     if(texture_entry.w == MaxTextureNum){
         return 0;
     }
+    if(lod_offset > 0){
+        sampleLod += lod_offset;
+        sampleLodT = 1 << sampleLod;
+        block_index = vec3(ivec3(samplePos / (volumeInfoUBO.virtual_block_length_space * sampleLodT)));
+    }
     //no check for texture entry
     vec3 offset_in_virtual_block = (samplePos * volumeInfoUBO.inv_volume_space - block_index * volumeInfoUBO.virtual_block_length * sampleLodT) / sampleLodT;
     vec3 texture_sample_coord = (texture_entry.xyz * volumeInfoUBO.padding_block_length + offset_in_virtual_block + vec3(volumeInfoUBO.padding)) * volumeInfoUBO.inv_texture_shape[texture_entry.w];
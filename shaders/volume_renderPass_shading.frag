@@ -25,44 +25,45 @@ layout(std140,binding = 6) uniform VolumeInfoUBO{
     float voxel; //4
 
     vec3 inv_texture_shape[MaxGPUTextureCount];//256
+    uvec4 lod_page_directory[MaxVolumeLod];//每个lod的块数xyz和在页目录中的起始位置w
 }volumeInfoUBO;
 
-//64mb uniform buffer
-const int HashTableSize = 1024;
-layout(binding = 7) uniform PageTable{
-    ivec4 hash_table[HashTableSize][2];
+//直接索引的页目录 与internal::PageDirectory的布局相同
+const int MaxResidentBlockCount = 32768;
+const uint InvalidPageID = 0xffffffffu;
+const uint EmptyPageID = 0xfffffffeu;//在当前传输函数下完全透明 没有加载 直接跳过
+layout(std430,binding = 7) readonly buffer PageTable{
+    uint entries[MaxResidentBlockCount];//常驻块的texture entry x y z各9位 w为5位
+    uint directory[];//每个lod每个块对应的常驻块编号 高8位不为0时是缺失块的祖先块 值为两者的lod差
 }pageTable;
+const uint FallbackLodShift = 24u;
 
-uint GetHashValue(in uvec4 key){
-    uint value = key[0];
-    for(int i = 1; i < 4; i++){
-        value = value ^  (key[i] + 0x9e3779b9 + (value << 6) + (value >> 2));
+//slot为常驻块编号 也是占用位图的下标 没有命中时为-1
+//lodOffset为实际命中的块相对于key的lod差 缺失的块由最近的常驻祖先块代替
+//超出范围返回InvalidPageID
+uint QueryPageDirectory(in uvec4 key){
+    uvec4 lod = volumeInfoUBO.lod_page_directory[min(key.w,uint(MaxVolumeLod - 1))];
+    if(key.w >= uint(MaxVolumeLod) || any(greaterThanEqual(key.xyz,lod.xyz))){
+        return InvalidPageID;
     }
-    return value;
+    return pageTable.directory[lod.w + (key.z * lod.y + key.y) * lod.x + key.x];
 }
-#define MAX_QUERY_NUM 64
-uvec4 QueryPageTable(in uvec4 key){
-    uint hash_v = GetHashValue(key);
-    uint pos = hash_v % HashTableSize;
-    int i = 0;
-    bool positive = false;
-    while(true){
-        int ii = i*i;
-        pos += positive ? ii : -ii;
-        pos %= HashTableSize;
-        if(pageTable.hash_table[pos][0].w >=0 && GetHashValue(pageTable.hash_table[pos][0]) == hash_v){
-            return pageTable.hash_table[pos][1];
-        }
-        else if(pageTable.hash_table[pos][0].w < 0){
-            return uvec4(MaxTextureNum);
-        }
-        if(!positive) i++;
-        positive = !positive;
-        if(i > MAX_QUERY_NUM){
-            break;
-        }
+uvec4 QueryPageTable(in uvec4 key,out int slot,out int lodOffset){
+    slot = -1;
+    lodOffset = 0;
+    uint id = QueryPageDirectory(key);
+    if(id == InvalidPageID || id == EmptyPageID){
+        return uvec4(MaxTextureNum);
     }
-    return uvec4(MaxTextureNum);
+    lodOffset = int(id >> FallbackLodShift);
+    id &= (1u << FallbackLodShift) - 1u;
+    slot = int(id);
+    uint entry = pageTable.entries[id];
+    return uvec4(entry & 0x1ffu,(entry >> 9) & 0x1ffu,(entry >> 18) & 0x1ffu,entry >> 27);
+}
+uvec4 QueryPageTable(in uvec4 key,out int lodOffset){
+    int slot;
+    return QueryPageTable(key,slot,lodOffset);
 }
 
 layout(std140,binding = 8) uniform RenderParams{
@@ -72,12 +73,21 @@ layout(std140,binding = 8) uniform RenderParams{
     float lod_dist[MaxVolumeLod];
 }renderParams;
 
+//每个常驻块的占用位图 块内不含padding的部分每个轴分为16个cell
+//0表示cell在当前传输函数下完全透明 与OccupancyHelper的布局相同
+const int OccupancyCellsPerAxis = 16;
+const int OccupancyWordCount = OccupancyCellsPerAxis * OccupancyCellsPerAxis * OccupancyCellsPerAxis / 32;
+layout(std430,binding = 9) readonly buffer OccupancyGrid{
+    uint bits[];
+}occupancyGrid;
+
 //计算视点到当前块中心的距离 块一直使用lod0
 float ComputeDistanceFromViewPosToBlockCenter(in vec3 rayPos){
     vec3 block_index = vec3(uvec3(rayPos / volumeInfoUBO.virtual_block_length_space));
     vec3 block_center = (block_index+vec3(0.5)) * volumeInfoUBO.virtual_block_length_space;
     return length(block_center - renderParams.view_pos);
 }
+//lod_dist由RenderHelper::GetScreenSpaceErrorLodDist计算 与CPU端求交使用同一张表
 //must return valid lod
 int ComputeCurrentSampleLod(in vec3 rayPos){
     float dist = ComputeDistanceFromViewPosToBlockCenter(rayPos);
@@ -100,10 +110,16 @@ int VirtualSample(in int sampleLod,in vec3 samplePos,out float sampleScalar){
     int sampleLodT = 1 << sampleLod;
     vec3 block_index = vec3(ivec3(samplePos / (volumeInfoUBO.virtual_block_length_space * sampleLodT)));
 
-    uvec4 texture_entry = QueryPageTable(uvec4(block_index,sampleLod));
+    int lod_offset;
+    uvec4 texture_entry = QueryPageTable(uvec4(block_index,sampleLod),lod_offset);
     if(texture_entry.w == MaxTextureNum){
         return 0;
     }
+    if(lod_offset > 0){
+        sampleLod += lod_offset;
+        sampleLodT = 1 << sampleLod;
+        block_index = vec3(ivec3(samplePos / (volumeInfoUBO.virtual_block_length_space * sampleLodT)));
+    }
     //no check for texture entry
     vec3 offset_in_virtual_block = (samplePos * volumeInfoUBO.inv_volume_space - block_index * volumeInfoUBO.virtual_block_length * sampleLodT) / sampleLodT;
     vec3 texture_sample_coord = (texture_entry.xyz * volumeInfoUBO.padding_block_length + offset_in_virtual_block + vec3(volumeInfoUBO.padding)) * volumeInfoUBO.inv_texture_shape[texture_entry.w];
@@ -116,10 +132,16 @@ void VirtualSampleExt(in int sampleLod,in vec3 samplePos,vec3 offset,out float s
     int sampleLodT = 1 << sampleLod;
     vec3 block_index = vec3(ivec3(samplePos / (volumeInfoUBO.virtual_block_length_space * sampleLodT)));
 
-    uvec4 texture_entry = QueryPageTable(uvec4(block_index,sampleLod));
+    int lod_offset;
+    uvec4 texture_entry = QueryPageTable(uvec4(block_index,sampleLod),lod_offset);
     if(texture_entry.w == MaxTextureNum){
         return;
     }
+    if(lod_offset > 0){
+        sampleLod += lod_offset;
+        sampleLodT = 1 << sampleLod;
+        block_index = vec3(ivec3(samplePos / (volumeInfoUBO.virtual_block_length_space * sampleLodT)));
+    }
     //no check for texture entry
     vec3 offset_in_virtual_block = ((samplePos + offset) * volumeInfoUBO.inv_volume_space - block_index * volumeInfoUBO.virtual_block_length * sampleLodT) / sampleLodT;
     vec3 texture_sample_coord = (texture_entry.xyz * volumeInfoUBO.padding_block_length + offset_in_virtual_block + vec3(volumeInfoUBO.padding)) * volumeInfoUBO.inv_texture_shape[texture_entry.w];
@@ -157,6 +179,41 @@ vec2 IntersectWithAABB(in vec3 minP,in vec3 maxP,in vec3 rayPos,in vec3 invRayDi
     float exit_t  = min(t_max_x,min(t_max_y,t_max_z));
     return vec2(enter_t,exit_t);
 }
+//采样点所在的cell为空时返回true cellExitDist为光线从samplePos离开这个cell的距离
+//被剔除的透明块整个作为一个cell 块不在页表中时返回false 由VirtualSample处理
+bool IsEmptyCell(in int sampleLod,in vec3 samplePos,in vec3 invRayDirection,out float cellExitDist){
+    int sampleLodT = 1 << sampleLod;
+    vec3 block_length_space = volumeInfoUBO.virtual_block_length_space * sampleLodT;
+    vec3 block_index = vec3(ivec3(samplePos / block_length_space));
+    if(QueryPageDirectory(uvec4(block_index,sampleLod)) == EmptyPageID){
+        vec3 block_min_pos = block_index * block_length_space;
+        vec2 t = IntersectWithAABB(block_min_pos,block_min_pos + block_length_space,samplePos,invRayDirection);
+        cellExitDist = max(t.y,0.f);
+        return true;
+    }
+    int slot,lod_offset;
+    QueryPageTable(uvec4(block_index,sampleLod),slot,lod_offset);
+    if(slot < 0){
+        return false;
+    }
+    //祖先块的cell覆盖更大的范围
+    if(lod_offset > 0){
+        block_length_space *= 1 << lod_offset;
+        block_index = vec3(ivec3(samplePos / block_length_space));
+    }
+    vec3 cell_length_space = block_length_space / OccupancyCellsPerAxis;
+    vec3 block_min_pos = block_index * block_length_space;
+    ivec3 cell = clamp(ivec3((samplePos - block_min_pos) / cell_length_space),ivec3(0),ivec3(OccupancyCellsPerAxis - 1));
+    int cell_index = (cell.z * OccupancyCellsPerAxis + cell.y) * OccupancyCellsPerAxis + cell.x;
+    uint word = occupancyGrid.bits[slot * OccupancyWordCount + cell_index / 32];
+    if((word & (1u << (cell_index % 32))) != 0u){
+        return false;
+    }
+    vec3 cell_min_pos = block_min_pos + vec3(cell) * cell_length_space;
+    vec2 t = IntersectWithAABB(cell_min_pos,cell_min_pos + cell_length_space,samplePos,invRayDirection);
+    cellExitDist = max(t.y,0.f);
+    return true;
+}
 vec3 GetRayExitPos(in vec3 rayDirection,in vec3 rayPos,in int sampleLod){
     int sampleLodT = 1 << sampleLod;
     vec3 block_index = vec3(ivec3(rayPos / (volumeInfoUBO.virtual_block_length_space * sampleLodT)));
@@ -244,6 +301,7 @@ void main() {
     int last_sample_lod = ComputeCurrentSampleLod(ray_cast_pos);
     vec3 last_lod_sample_pos = ray_entry_pos;
     int last_lod_sample_steps = 0;
+    vec3 inv_ray_direction = 1.f / ray_direction;
 
 
 
@@ -261,6 +319,14 @@ void main() {
             last_sample_lod = cur_sample_lod;
         }
         float cur_sample_step = (1 << cur_sample_lod) * renderParams.ray_step;
+        //空的cell直接跳到离开cell后的第一个采样点 采样点仍然在原来的步长网格上
+        float cell_exit_dist;
+        if(IsEmptyCell(cur_sample_lod,ray_cast_pos,inv_ray_direction,cell_exit_dist)){
+            int skip_steps = max(int(ceil(cell_exit_dist / cur_sample_step)),1);
+            i += skip_steps - 1;
+            ray_cast_pos = last_lod_sample_pos + (i + 1 - last_lod_sample_steps) * ray_direction * cur_sample_step;
+            continue;
+        }
         float sample_scalar = 0.f;
 
         int ret = VirtualSample(cur_sample_lod,ray_cast_pos,sample_scalar);
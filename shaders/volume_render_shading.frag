@@ -77,6 +77,7 @@ float ComputeDistanceFromViewPosToBlockCenter(in vec3 rayPos){
     vec3 block_center = (block_index+vec3(0.5)) * volumeInfoUBO.virtual_block_length_space;
     return length(block_center - renderParams.view_pos);
 }
+//lod_dist由RenderHelper::GetScreenSpaceErrorLodDist计算 与CPU端求交使用同一张表
 //must return valid lod
 int ComputeCurrentSampleLod(in vec3 rayPos){
     float dist = ComputeDistanceFromViewPosToBlockCenter(rayPos);
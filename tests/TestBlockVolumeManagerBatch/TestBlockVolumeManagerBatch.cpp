@@ -0,0 +1,90 @@
+//
+// Created by wyz on 2022/6/5.
+//
+#include "core/BlockVolumeManager.hpp"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+using namespace mrayns;
+//缺失的块比内存块多时批量请求不能卡住
+class TestProvider: public IVolumeBlockProviderInterface{
+  public:
+    TestProvider(){
+        volume.name = "test";
+        volume.voxel_type = Volume::UINT8;
+        volume.block_length = 64;
+        volume.padding = 2;
+        volume.volume_dim_x = 600;
+        volume.volume_dim_y = 600;
+        volume.volume_dim_z = 120;
+        volume.volume_space_x = volume.volume_space_y = volume.volume_space_z = 0.01f;
+        volume.max_lod = 0;
+    }
+    void open(const std::string& filename) override{}
+    void setHostNode(HostNode* hostNode) override{}
+    const Volume& getVolume() const override{
+        return volume;
+    }
+    void getVolumeBlock(void* dst,BlockIndex blockIndex) override{
+        std::memset(dst,Pattern(blockIndex),volume.getBlockSize());
+    }
+    static uint8_t Pattern(const BlockIndex& blockIndex){
+        return static_cast<uint8_t>(1 + blockIndex.x + blockIndex.y * 10 + blockIndex.z * 100);
+    }
+  private:
+    Volume volume;
+};
+
+int main(){
+    auto& block_volume_manager = BlockVolumeManager::getInstance();
+    block_volume_manager.setProvider(std::make_unique<TestProvider>());
+    const auto& volume = block_volume_manager.getVolume();
+    //10x10x2个块 内存中只有64个
+    std::vector<Volume::BlockIndex> blocks;
+    for(int z = 0; z < 2; z++){
+        for(int y = 0; y < 10; y++){
+            for(int x = 0; x < 10; x++){
+                blocks.push_back({x,y,z,0});
+            }
+        }
+    }
+    std::vector<Volume::BlockIndex> first(blocks.begin(),blocks.begin() + 100);
+    std::vector<Volume::BlockIndex> second(blocks.begin() + 100,blocks.end());
+    int error_count = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    auto ptrs = block_volume_manager.getVolumeBlocks(first,true);
+    std::unordered_set<void*> distinct;
+    int match_count = 0;
+    for(size_t i = 0; i < first.size(); i++){
+        if(!ptrs[i]){
+            error_count++;
+            continue;
+        }
+        distinct.insert(ptrs[i]);
+        //后面批次的块会替换前面批次的块 每个内存块只保存最后写入的块
+        if(*reinterpret_cast<uint8_t*>(ptrs[i]) == TestProvider::Pattern(first[i])) match_count++;
+    }
+    if(match_count != static_cast<int>(distinct.size())) error_count++;
+    std::cout<<"sync batch of "<<first.size()<<" blocks: "<<distinct.size()<<" memory blocks, "
+              <<match_count<<" match, cost "
+              <<std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+              <<"ms"<<std::endl;
+
+    //异步时用完空闲块就返回 剩下的块之后再请求
+    start = std::chrono::steady_clock::now();
+    auto async_ptrs = block_volume_manager.getVolumeBlocks(second,false);
+    std::cout<<"async batch of "<<second.size()<<" blocks return in "
+              <<std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+              <<"ms"<<std::endl;
+    ptrs = block_volume_manager.getVolumeBlocks(second,true);
+    for(size_t i = 0; i < second.size(); i++){
+        if(!ptrs[i]) error_count++;
+    }
+
+    std::cout<<"block volume manager batch test finish, error count: "<<error_count<<std::endl;
+    return error_count == 0 ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+//
+// Created by wyz on 2022/6/4.
+//
+#include "extension/VolumeBlockProviderInterface.hpp"
+#include "core/HostNode.hpp"
+#include "plugin/PluginLoader.hpp"
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+using namespace mrayns;
+//比较部分解码[z0,z1)和完整解码的相同z平面
+int main(int argc,char** argv){
+    PluginLoader::LoadPlugins("./plugins");
+    auto p = std::unique_ptr<IVolumeBlockProviderInterface>(
+        PluginLoader::CreatePlugin<IVolumeBlockProviderInterface>("block-provider"));
+    std::string h264_file_path = argc > 1 ? argv[1] : "E:/MouseNeuronData/mouse_file_config.json";
+    p->open(h264_file_path);
+
+    auto& host_node = HostNode::getInstance();
+    host_node.setGPUNum(1);
+    p->setHostNode(&host_node);
+
+    auto volume = p->getVolume();
+    const int block_length = volume.getBlockLength();
+    const size_t plane_size = static_cast<size_t>(block_length) * block_length;
+    const size_t block_size = volume.getBlockSize();
+    std::vector<uint8_t> full(block_size),partial(block_size);
+
+    std::vector<Volume::BlockIndex> blocks = {{0,0,0,0},{1,2,0,4},{0,0,0,volume.getMaxLod()}};
+    //包含第一帧 中间 最后一帧以及单独一帧的情况
+    std::vector<std::pair<int,int>> ranges = {{0,1},{0,block_length / 4},{block_length / 2 - 3,block_length / 2 + 5},
+                                              {block_length - 8,block_length},{block_length - 1,block_length},
+                                              {0,block_length}};
+    int error_count = 0;
+    for(auto& block:blocks){
+        p->getVolumeBlock(full.data(),block);
+        for(auto& range:ranges){
+            std::memset(partial.data(),0xcd,block_size);
+            p->getVolumeBlockRange(partial.data(),block,range.first,range.second);
+            size_t diff = 0;
+            for(int z = range.first; z < range.second; z++){
+                auto offset = z * plane_size;
+                for(size_t i = 0; i < plane_size; i++){
+                    if(full[offset + i] != partial[offset + i]) diff++;
+                }
+            }
+            std::cout<<"block "<<block.x<<" "<<block.y<<" "<<block.z<<" "<<block.w
+                      <<" range ["<<range.first<<","<<range.second<<") diff count "<<diff<<std::endl;
+            if(diff) error_count++;
+        }
+    }
+    std::cout<<"range decode test finish, error count: "<<error_count<<std::endl;
+    return error_count == 0 ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+//
+// Created by wyz on 2022/6/4.
+//
+#include "core/internal/Common.hpp"
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <unordered_map>
+#include <vector>
+using namespace mrayns;
+using internal::PageDirectory;
+using PageTableItem = std::pair<PageTable::EntryItem,PageTable::ValueItem>;
+
+//和着色器中的解码相同
+static PageTable::EntryItem UnpackEntry(uint32_t packed){
+    return {static_cast<int>(packed & 0x1ffu),static_cast<int>((packed >> 9) & 0x1ffu),
+            static_cast<int>((packed >> 18) & 0x1ffu),static_cast<int>(packed >> 27)};
+}
+
+static int error_count = 0;
+#define CHECK(expr)                                                                                                    \
+    if (!(expr))                                                                                                       \
+    {                                                                                                                  \
+        std::cout << "check failed at line " << __LINE__ << ": " << #expr << std::endl;                                \
+        error_count++;                                                                                                 \
+    }
+
+int main(){
+    Volume volume;
+    volume.name = "test";
+    volume.voxel_type = Volume::UINT8;
+    volume.block_length = 256;
+    volume.padding = 2;
+    volume.volume_dim_x = 3000;
+    volume.volume_dim_y = 2000;
+    volume.volume_dim_z = 1000;
+    volume.volume_space_x = volume.volume_space_y = volume.volume_space_z = 0.01f;
+    volume.max_lod = 5;
+
+    std::vector<uint32_t> buffer(PageDirectory::BufferSize / sizeof(uint32_t),0);
+    auto entries = buffer.data();
+    auto directory = entries + PageDirectory::MaxResidentCount;
+    PageDirectory page_directory;
+    page_directory.reset(volume,buffer.data());
+
+    //每个lod的布局连续排列
+    uint32_t base = 0;
+    for(int lod = 0; lod <= volume.getMaxLod(); lod++){
+        auto dim = VolumeHelper::ComputeLodVolumeBlockDim(volume,lod);
+        const auto& info = page_directory.lods[lod];
+        CHECK(info.dim_x == static_cast<uint32_t>(dim.x) && info.dim_y == static_cast<uint32_t>(dim.y)
+              && info.dim_z == static_cast<uint32_t>(dim.z));
+        CHECK(info.base == base);
+        base += dim.x * dim.y * dim.z;
+    }
+    for(size_t i = 0; i < base; i++){
+        CHECK(directory[i] == PageDirectory::InvalidID);
+    }
+    CHECK(page_directory.getDirectoryIndex({-1,0,0,0}) == -1);
+    CHECK(page_directory.getDirectoryIndex({0,0,0,volume.getMaxLod() + 1}) == -1);
+    auto lod0_dim = VolumeHelper::ComputeLodVolumeBlockDim(volume,0);
+    CHECK(page_directory.getDirectoryIndex({lod0_dim.x,0,0,0}) == -1);
+
+    //texture entry的打包可以还原
+    for(auto entry:{PageTable::EntryItem{0,0,0,0},PageTable::EntryItem{511,511,511,31},PageTable::EntryItem{3,400,77,15}}){
+        CHECK(UnpackEntry(PageDirectory::PackEntry(entry)) == entry);
+    }
+
+    //常驻块
+    std::vector<PageTableItem> items;
+    std::mt19937 rng(2022);
+    for(int lod = 0; lod <= 2; lod++){
+        auto dim = VolumeHelper::ComputeLodVolumeBlockDim(volume,lod);
+        for(int i = 0; i < 64; i++){
+            PageTable::ValueItem block{static_cast<int>(rng() % dim.x),static_cast<int>(rng() % dim.y),
+                                       static_cast<int>(rng() % dim.z),lod};
+            bool exist = false;
+            for(auto& item:items) exist |= item.second == block;
+            if(exist) continue;
+            PageTable::EntryItem entry{static_cast<int>(rng() % 512),static_cast<int>(rng() % 512),
+                                       static_cast<int>(rng() % 512),static_cast<int>(rng() % 16)};
+            items.emplace_back(entry,block);
+        }
+    }
+    std::vector<uint32_t> added;
+    page_directory.update(items,buffer.data(),added);
+    CHECK(added.size() == items.size());
+    auto lookup = [&](const PageTable::ValueItem& block){
+        return directory[page_directory.getDirectoryIndex(block)];
+    };
+    std::unordered_map<PageTable::ValueItem,uint32_t> ids;
+    for(auto& item:items){
+        auto id = lookup(item.second);
+        CHECK(id < PageDirectory::MaxResidentCount);
+        if(id >= PageDirectory::MaxResidentCount) continue;
+        CHECK(UnpackEntry(entries[id]) == item.first);
+        CHECK(page_directory.getResidentBlock(id) == item.second);
+        ids[item.second] = id;
+    }
+
+    //去掉一半 修改一个块的texture entry 保留的块编号不变
+    auto removed = std::vector<PageTableItem>(items.begin() + items.size() / 2,items.end());
+    items.resize(items.size() / 2);
+    items[0].first = {1,2,3,4};
+    page_directory.update(items,buffer.data(),added);
+    CHECK(added.empty());
+    for(auto& item:items){
+        CHECK(lookup(item.second) == ids[item.second]);
+        CHECK(UnpackEntry(entries[ids[item.second]]) == item.first);
+    }
+    for(auto& item:removed){
+        CHECK(lookup(item.second) == PageDirectory::InvalidID);
+        CHECK(entries[ids[item.second]] == PageDirectory::InvalidID);
+        CHECK(!page_directory.getResidentBlock(ids[item.second]).isValid());
+    }
+
+    //缺失的块指向最近的常驻祖先块 透明的块标记为空 只在这一次update中有效
+    PageTable::ValueItem missed{5,6,3,0};
+    PageTable::ValueItem ancestor{1,1,0,2};
+    PageTable::ValueItem empty{0,0,0,1};
+    CHECK(page_directory.getDirectoryIndex(missed) >= 0 && page_directory.getDirectoryIndex(ancestor) >= 0);
+    CHECK(VolumeHelper::GetLodBlockIndex(missed,2) == ancestor);
+    //lod1上的祖先块不能常驻 否则会指向lod1
+    items.erase(std::remove_if(items.begin(),items.end(),[&](const PageTableItem& item){
+        return item.second == missed || item.second == VolumeHelper::GetLodBlockIndex(missed,1)
+            || item.second == ancestor || item.second == empty;
+    }),items.end());
+    items.push_back({{5,6,7,8},ancestor});
+    page_directory.update(items,{missed},{empty},buffer.data(),added);
+    auto ancestor_id = lookup(ancestor);
+    auto value = lookup(missed);
+    CHECK((value & ((1u << PageDirectory::FallbackLodShift) - 1)) == ancestor_id);
+    CHECK((value >> PageDirectory::FallbackLodShift) == 2);
+    CHECK(lookup(empty) == PageDirectory::EmptyID);
+
+    page_directory.update(items,buffer.data(),added);
+    CHECK(lookup(missed) == PageDirectory::InvalidID);
+    CHECK(lookup(empty) == PageDirectory::InvalidID);
+    CHECK(lookup(ancestor) == ancestor_id);
+
+    //全部移除后所有项都无效
+    page_directory.update({},buffer.data(),added);
+    for(size_t i = 0; i < base; i++){
+        CHECK(directory[i] == PageDirectory::InvalidID);
+    }
+
+    std::cout<<"page directory test finish, error count: "<<error_count<<std::endl;
+    return error_count == 0 ? 0 : 1;
+}